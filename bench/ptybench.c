@@ -0,0 +1,503 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file ptybench.c Throughput benchmark of the whole receive path, driven
+  through a pseudo-terminal.
+
+  Builds natively on Linux (make ptybench; make bench runs it over every
+  stream).  A generator thread writes a stream into the master side of a pty
+  pair at a set rate, and the rest is put together the way FUNterm does it:
+    - an Rx thread reads the slave side into the lock-free ring (ring.c),
+      dropping data if the ring is full, and wakes the UI thread only if it
+      isn't awake already, like the MESS_SERIAL message;
+    - the UI thread takes up to RX_SLICE bytes at a time through TermWrite()
+      into the terminal core, with scrolled lines going to the scrollback
+      history, which is the "parser" time;
+    - it renders the dirty spans at most once per frame, into a plain cell
+      buffer in place of the GDI back buffer, which is the "renderer" time.
+
+  Streams: log (timestamped log lines), esc (colored text, cursor movement
+  and erasing, like a full screen program), binary (random bytes), long
+  (4000 character lines), or any file, played in a loop.
+
+  Reports bytes per second, the latency of each 4 KB batch from being
+  written to the pty until it has been through the parser (50th, 90th, 99th
+  percentile and maximum), the bytes dropped because the ring was full, and
+  the CPU time of the Rx thread, the parser and the renderer.
+
+  With -x, it only runs the generator, and prints the name of the slave side
+  so that FUNterm can be pointed at it.  Under Wine, link the name to a COM
+  port, e.g. ln -s /dev/pts/5 ~/.wine/dosdevices/com5.
+
+  Usage: ptybench [-s stream|-f file] [-r bytes/s] [-m MB] [-b ring KB] [-x]
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <termios.h>
+#include "ring.h"
+#include "term.h"
+#include "history.h"
+
+#define BATCH 4096              ///< Bytes per generator write, the unit of latency.
+#define RX_SLICE 65536          ///< Bytes parsed per wakeup, as in funterm.c.
+#define FRAME 0.016             ///< Seconds between renders, one 60 Hz frame.
+#define COLS 132                ///< Screen width.
+#define ROWS 50                 ///< Screen height.
+
+static int Master,Slave;        ///< The pty pair.
+static int Wake[2];             ///< Pipe the Rx thread uses to wake the UI thread.
+static TRing *Rx;               ///< Received bytes.
+static volatile int Posted;     ///< Flag: the UI thread has been woken and not yet drained the ring.
+static volatile int Stop;       ///< Flag: tells the threads to quit.
+static char *Data;              ///< The stream, played in a loop.
+static long DataSize;           ///< Bytes in Data.
+static long long Total;         ///< Bytes to send.
+static double Rate;             ///< Bytes per second to send at, or 0 for as fast as possible.
+static double *Sent;            ///< Time each batch was written.
+static double RxCpu;            ///< CPU seconds used by the Rx thread.
+static THistory *History;       ///< Scrollback history.
+static char Frame[ROWS][COLS];  ///< Rendered characters, in place of the back buffer.
+static unsigned short FrameAttr[ROWS][COLS];  ///< Rendered attributes.
+
+/// Returns a monotonic time in seconds.
+static double Now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/// Returns the CPU time used by the calling thread, in seconds.
+static double ThreadCpu(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/// Terminal core callback: scrolled lines go to the history.
+static void Scroll(void *User,TLines *Lines,int n)
+{
+  int i;
+
+  for (i=0;i<n;i++)
+    HistAppend(History,LineText(Lines,i),LineLen(Lines,i));
+}
+
+static const TTermCallbacks Callbacks = {NULL,Scroll,NULL};
+
+/// Fills a buffer with log lines.
+static void MakeLog(char *buf,long size)
+{
+  static const char *Level[] = {"INFO","DEBUG","WARN","INFO","TRACE"};
+  char s[200];
+  long i = 0;
+  int n,k = 0;
+
+  while (i < size)
+    {
+      n = sprintf(s,"2026-10-17 12:%02d:%02d.%03d [%s] sensor %d: temperature=%d.%dC "
+                  "humidity=%d%% status=%s seq=%d\r\n",
+                  k/60%60,k%60,rand()%1000,Level[rand()%5],rand()%32,
+                  rand()%40,rand()%10,rand()%100,rand()%7 ? "OK" : "FAULT",k);
+      if (n > size - i)
+        n = size - i;
+      memcpy(buf + i,s,n);
+      i += n;
+      k++;
+    }
+}
+
+/// Fills a buffer with escape sequence heavy traffic, like a full screen program.
+static void MakeEsc(char *buf,long size)
+{
+  char s[200];
+  long i = 0;
+  int n;
+
+  while (i < size)
+    {
+      switch (rand() % 6)
+        {
+        case 0:
+          n = sprintf(s,"\x1b[%d;%dH\x1b[K",1 + rand()%ROWS,1 + rand()%COLS);
+          break;
+        case 1:
+          n = sprintf(s,"\x1b[%d;%dm%5d.%d%%\x1b[0m ",rand()%2,30 + rand()%8,
+                      rand()%10000,rand()%10);
+          break;
+        case 2:
+          n = sprintf(s,"\x1b[1;44;37m PID %5d \x1b[0m\x1b[32m%-20s\x1b[39m",
+                      rand()%65536,"worker");
+          break;
+        case 3:
+          n = sprintf(s,"\x1b[%dA\x1b[%dC\x1b[2K",rand()%5,rand()%40);
+          break;
+        case 4:
+          n = sprintf(s,"\x1b]0;top - %d tasks\x07\x1b[H\x1b[7mstatus\x1b[27m",rand()%500);
+          break;
+        default:
+          n = sprintf(s,"\r\n\x1b[38;5;%dmline of output %d\x1b[m",rand()%16,rand());
+          break;
+        }
+      if (n > size - i)
+        n = size - i;
+      memcpy(buf + i,s,n);
+      i += n;
+    }
+}
+
+/// Fills a buffer with random bytes.
+static void MakeBinary(char *buf,long size)
+{
+  long i;
+
+  for (i=0;i<size;i++)
+    buf[i] = rand();
+}
+
+/// Fills a buffer with long lines of hex dump text.
+static void MakeLong(char *buf,long size)
+{
+  static const char Hex[] = "0123456789ABCDEF";
+  long i;
+
+  for (i=0;i<size;i++)
+    buf[i] = i % 4002 == 4000 ? '\r' : i % 4002 == 4001 ? '\n' : Hex[(i*7 + i/13) & 15];
+}
+
+/**
+   Loads the stream to send.
+   @param Name Stream name, or NULL.
+   @param File File to play instead, or NULL.
+   @return Zero if there is no such stream.
+ */
+static int LoadStream(const char *Name,const char *File)
+{
+  FILE *f;
+
+  if (File)
+    {
+      if ((f = fopen(File,"rb")) == NULL)
+        {
+          perror(File);
+          return 0;
+        }
+      fseek(f,0,SEEK_END);
+      DataSize = ftell(f);
+      fseek(f,0,SEEK_SET);
+      Data = malloc(DataSize ? DataSize : 1);
+      DataSize = fread(Data,1,DataSize,f);
+      fclose(f);
+      return DataSize > 0;
+    }
+  DataSize = 16*1024*1024;
+  Data = malloc(DataSize);
+  srand(1);
+  if (!strcmp(Name,"log"))
+    MakeLog(Data,DataSize);
+  else if (!strcmp(Name,"esc"))
+    MakeEsc(Data,DataSize);
+  else if (!strcmp(Name,"binary"))
+    MakeBinary(Data,DataSize);
+  else if (!strcmp(Name,"long"))
+    MakeLong(Data,DataSize);
+  else
+    return 0;
+  return 1;
+}
+
+/**
+   Generator thread: writes the stream to the pty master in batches, keeping
+   to the rate if one is set, and notes when each batch went out.
+ */
+static void *Generator(void *p)
+{
+  long long Pos = 0;
+  double Start = Now(),t;
+  long Off;
+  int n,k,w;
+
+  while (Pos < Total && !Stop)
+    {
+      if (Rate > 0)
+        {
+          t = Start + Pos/Rate - Now();
+          if (t > 0)
+            usleep(t*1e6);
+        }
+      n = Total - Pos < BATCH ? Total - Pos : BATCH;
+      Sent[Pos/BATCH] = Now();
+      for (k=0;k<n && !Stop;k+=w)
+        {
+          Off = (Pos + k) % DataSize;
+          w = n - k;
+          if (w > DataSize - Off)
+            w = DataSize - Off;
+          w = write(Master,Data + Off,w);
+          if (w < 0)
+            return NULL;
+        }
+      Pos += n;
+    }
+  return NULL;
+}
+
+/**
+   Rx thread: reads the pty slave into the ring, the way the serial port Rx
+   thread does, and wakes the UI thread.
+ */
+static void *RxThread(void *p)
+{
+  struct pollfd pfd;
+  char Scratch[256];
+  char *dest;
+  long Room,n;
+
+  pfd.fd = Slave;
+  pfd.events = POLLIN;
+  while (!Stop)
+    {
+      if (poll(&pfd,1,50) <= 0)
+        continue;
+      Room = RingWritePtr(Rx,&dest);
+      if (!Room)
+        {
+          dest = Scratch;
+          Room = sizeof(Scratch);
+        }
+      n = read(Slave,dest,Room);
+      if (n <= 0)
+        continue;
+      if (dest == Scratch)
+        RingDrop(Rx,n);
+      else
+        RingCommit(Rx,n);
+      if (!__atomic_exchange_n(&Posted,1,__ATOMIC_ACQ_REL))
+        n = write(Wake[1],"",1);
+    }
+  RxCpu = ThreadCpu();
+  return NULL;
+}
+
+/**
+   Draws the dirty spans into the frame, the way RenderDirty() does with GDI.
+   @param Lines Terminal screen.
+ */
+static void Render(TLines *Lines)
+{
+  int y,x0,x1,Len;
+
+  for (y=0;y<Lines->Count && y<ROWS;y++)
+    {
+      if (!Lines->AllDirty && !Lines->Dirty[y])
+        continue;
+      x0 = Lines->AllDirty ? 0 : Lines->DirtyStart[y];
+      x1 = Lines->AllDirty ? ToEol : Lines->DirtyEnd[y];
+      Len = LineLen(Lines,y);
+      if (x1 > COLS)
+        x1 = COLS;
+      if (x0 >= x1)
+        continue;
+      // the text, then blanks past the end of the line
+      if (Len > x0)
+        {
+          memcpy(Frame[y] + x0,LineText(Lines,y) + x0,(Len < x1 ? Len : x1) - x0);
+          memcpy(FrameAttr[y] + x0,LineAttr(Lines,y) + x0,((Len < x1 ? Len : x1) - x0)*2);
+        }
+      if (Len < x1)
+        {
+          if (Len < x0)
+            Len = x0;
+          memset(Frame[y] + Len,' ',x1 - Len);
+          memset(FrameAttr[y] + Len,0,(x1 - Len)*2);
+        }
+    }
+  Lines->AllDirty = 0;
+  memset(Lines->Dirty,0,Lines->Rows);
+}
+
+/// Sorts latencies.
+static int CmpDouble(const void *a,const void *b)
+{
+  double x = *(const double *)a,y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+/**
+   Opens the pty pair, with the slave side in raw mode.
+   @return Zero on failure.
+ */
+static int OpenPty(void)
+{
+  struct termios t;
+
+  Master = posix_openpt(O_RDWR|O_NOCTTY);
+  if (Master < 0 || grantpt(Master) || unlockpt(Master))
+    return 0;
+  Slave = open(ptsname(Master),O_RDWR|O_NOCTTY);
+  if (Slave < 0)
+    return 0;
+  tcgetattr(Slave,&t);
+  cfmakeraw(&t);
+  tcsetattr(Slave,TCSANOW,&t);
+  return 1;
+}
+
+int main(int argc,char **argv)
+{
+  const char *Stream = "log",*File = NULL;
+  double MB = 64,Start,Wall,Next,t,Parse = 0,Draw = 0,*Lat;
+  long RingKB = 4096,Batches,NLat = 0,i;
+  int External = 0,n;
+  long long Done = 0;
+  pthread_t Gen,Rxt;
+  struct pollfd pfd;
+  TLines *Lines;
+  const char *p;
+  char c;
+
+  for (i=1;i<argc;i++)
+    if (!strcmp(argv[i],"-x"))
+      External = 1;
+    else if (i + 1 >= argc)
+      break;
+    else if (!strcmp(argv[i],"-s"))
+      Stream = argv[++i];
+    else if (!strcmp(argv[i],"-f"))
+      File = argv[++i];
+    else if (!strcmp(argv[i],"-r"))
+      Rate = atof(argv[++i]);
+    else if (!strcmp(argv[i],"-m"))
+      MB = atof(argv[++i]);
+    else if (!strcmp(argv[i],"-b"))
+      RingKB = atol(argv[++i]);
+  if (i < argc || !LoadStream(Stream,File))
+    {
+      fprintf(stderr,"Usage: ptybench [-s log|esc|binary|long] [-f file] [-r bytes/s] "
+              "[-m MB] [-b ring KB] [-x]\n");
+      return 1;
+    }
+  if (!OpenPty())
+    {
+      perror("pty");
+      return 1;
+    }
+  Total = MB*1024*1024;
+  Batches = (Total + BATCH - 1)/BATCH;
+  Sent = calloc(Batches,sizeof(double));
+  Lat = malloc(Batches*sizeof(double));
+
+  if (External)
+    {
+      // someone else reads the slave side
+      printf("Sending %s to %s, start FUNterm on it and press Enter\n",
+             File ? File : Stream,ptsname(Master));
+      n = read(0,&c,1);
+      Start = Now();
+      Generator(NULL);
+      printf("%.1f MB in %.2f s\n",Total/1e6,Now() - Start);
+      return 0;
+    }
+
+  Rx = RingCreate(RingKB*1024);
+  History = HistCreate(64*1024*1024);
+  Lines = CreateLines(MaxLines,VT_ANSI,&Callbacks,NULL);
+  if (!Rx || !History || !Lines || pipe(Wake))
+    return 1;
+  TermResize(Lines,COLS,ROWS);
+  pfd.fd = Wake[0];
+  pfd.events = POLLIN;
+
+  Start = Now();
+  Next = Start + FRAME;
+  pthread_create(&Rxt,NULL,RxThread,NULL);
+  pthread_create(&Gen,NULL,Generator,NULL);
+  while (Done + RingDropped(Rx) < Total)
+    {
+      // sleep until woken, or the next frame is due, unless there is more
+      t = RingCount(Rx) ? 0 : Next - Now();
+      if (poll(&pfd,1,t > 0 ? t*1000 + 1 : 0) > 0)
+        n = read(Wake[0],&c,1);
+      __atomic_store_n(&Posted,0,__ATOMIC_RELEASE);
+
+      t = ThreadCpu();
+      for (i=0;i<RX_SLICE && (n = RingReadPtr(Rx,&p)) > 0;i+=n)
+        {
+          if (n > RX_SLICE - i)
+            n = RX_SLICE - i;
+          TermWrite(Lines,p,n);
+          RingSkip(Rx,n);
+          Done += n;
+        }
+      // come back for the rest
+      if (RingCount(Rx))
+        __atomic_store_n(&Posted,1,__ATOMIC_RELEASE);
+      Parse += ThreadCpu() - t;
+      // batches that have been through the parser; dropped bytes count as through
+      while (NLat < Batches && Done + RingDropped(Rx) >= (long long)(NLat + 1)*BATCH)
+        {
+          Lat[NLat] = Now() - Sent[NLat];
+          NLat++;
+        }
+
+      if (Now() >= Next)
+        {
+          t = ThreadCpu();
+          Render(Lines);
+          Draw += ThreadCpu() - t;
+          Next = Now() + FRAME;
+        }
+    }
+  Wall = Now() - Start;
+  Stop = 1;
+  pthread_join(Gen,NULL);
+  pthread_join(Rxt,NULL);
+  t = ThreadCpu();
+  Render(Lines);
+  Draw += ThreadCpu() - t;
+
+  qsort(Lat,NLat,sizeof(double),CmpDouble);
+  printf("%-8s %8.1f MB/s  latency ms p50 %.2f p90 %.2f p99 %.2f max %.2f  dropped %lu\n"
+         "         CPU s: Rx thread %.3f  parser %.3f  renderer %.3f  (wall %.3f)\n",
+         File ? "file" : Stream,Done/Wall/1e6,
+         NLat ? Lat[NLat/2]*1e3 : 0,NLat ? Lat[NLat*9/10]*1e3 : 0,
+         NLat ? Lat[NLat*99/100]*1e3 : 0,NLat ? Lat[NLat-1]*1e3 : 0,
+         RingDropped(Rx),RxCpu,Parse,Draw,Wall);
+
+  DestroyLines(Lines);
+  HistDestroy(History);
+  RingDestroy(Rx);
+  return 0;
+}
@@ -0,0 +1,191 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file termfuzz.c Fuzzing driver for the terminal core.
+
+  Builds natively with gcc (make termfuzz), with AddressSanitizer and
+  UndefinedBehaviorSanitizer, and feeds data through TermWrite() into a
+  TLines structure, checking after each piece that the cursor, line lengths
+  and line count are still within bounds.  The first byte of each input picks
+  the parser mode, the CR/LF flag and a window size, so resizing is covered
+  too.
+
+  With file names on the command line, each file is one input.  Otherwise it
+  generates random inputs, biased towards escape sequences, for the number of
+  iterations given by -n (default 100000), from the seed given by -s.
+
+  The same file also works as a libFuzzer target: build it with clang and
+  -fsanitize=fuzzer,address -DLIBFUZZER, for example
+  make termfuzz HOSTCC=clang FUZZFLAGS="-g -fsanitize=fuzzer,address -DLIBFUZZER".
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "term.h"
+
+static TLines *Lines;           ///< Screen model under test.
+static long Scrolled;           ///< Lines handed to the Scroll callback.
+
+/// Checks the Scroll callback gets lines that are on the screen.
+static void Scroll(void *User,TLines *L,int n)
+{
+  if (n < 1 || n > L->Count)
+    {
+      fprintf(stderr,"Scroll of %d lines with %d on screen\n",n,L->Count);
+      abort();
+    }
+  Scrolled += n;
+}
+
+static const TTermCallbacks Callbacks = {NULL,Scroll,NULL};
+
+/// Aborts if the screen model is out of bounds.
+static void Check(void)
+{
+  int y;
+
+  if (Lines->CursX < 0 || Lines->CursX >= Lines->Cols ||
+      Lines->CursY < 0 || Lines->CursY >= Lines->Height ||
+      Lines->Count < 0 || Lines->Count > Lines->Height)
+    {
+      fprintf(stderr,"Out of bounds: cursor %d,%d count %d height %d\n",
+              Lines->CursX,Lines->CursY,Lines->Count,Lines->Height);
+      abort();
+    }
+  for (y=0;y<Lines->Rows;y++)
+    if (Lines->Len[y] < 0 || Lines->Len[y] > Lines->Cols)
+      {
+        fprintf(stderr,"Row %d has length %d\n",y,Lines->Len[y]);
+        abort();
+      }
+}
+
+/**
+   Runs one input.  The first byte sets up the terminal, the rest is fed in
+   pieces of varying size.
+*/
+int LLVMFuzzerTestOneInput(const uint8_t *Data,size_t Size)
+{
+  int k;
+
+  if (!Lines)
+    Lines = CreateLines(MaxLines,VT_ANSI,&Callbacks,NULL);
+  if (Size < 1)
+    return 0;
+  VtSetMode(&Lines->Vt,Data[0] & 1 ? VT_ADM : VT_ANSI);
+  Lines->CrLf = Data[0] & 2;
+  TermResize(Lines,(Data[0] >> 2 & 7)*60 + 1,(Data[0] >> 5)*60 + 1);
+  Check();
+  Data++;
+  Size--;
+  while (Size > 0)
+    {
+      k = Size < 7 ? Size : 1 + Data[0] % 97;
+      if (k > (int)Size)
+        k = Size;
+      TermWrite(Lines,(const char *)Data,k);
+      Check();
+      Data += k;
+      Size -= k;
+    }
+  return 0;
+}
+
+#ifndef LIBFUZZER
+/// Fills a buffer with random data, mostly pieces of escape sequences.
+static void MakeInput(unsigned char *buf,int n)
+{
+  static const char *Bits[] = {"\x1b[","\x1b]0;","\x1b=","\x1b.",";","?","\x07",
+                               "\r\n","\x1b","\x1bM","\x1b" "7","\x1b" "8"};
+  const char *p;
+  int i = 0,k;
+
+  while (i < n)
+    {
+      switch (rand() % 4)
+        {
+        case 0:                 // a piece of a sequence
+          p = Bits[rand() % (sizeof(Bits)/sizeof(Bits[0]))];
+          while (*p && i < n)
+            buf[i++] = *p++;
+          break;
+        case 1:                 // a number
+          k = rand() % 4 ? rand() % 30 : rand();
+          i += snprintf((char *)buf + i,n - i,"%d",k);
+          if (i > n)
+            i = n;
+          break;
+        case 2:                 // any byte
+          buf[i++] = rand();
+          break;
+        default:                // some text
+          for (k=rand()%200;k>0 && i<n;k--)
+            buf[i++] = ' ' + rand() % 95;
+          break;
+        }
+    }
+}
+
+int main(int argc,char **argv)
+{
+  static unsigned char buf[4096];
+  long i,Iter = 100000;
+  unsigned Seed = 1;
+  FILE *f;
+  int n;
+
+  if (argc > 1 && argv[1][0] != '-')
+    {
+      for (i=1;i<argc;i++)
+        {
+          if ((f = fopen(argv[i],"rb")) == NULL)
+            {
+              perror(argv[i]);
+              return 1;
+            }
+          n = fread(buf,1,sizeof(buf),f);
+          fclose(f);
+          LLVMFuzzerTestOneInput(buf,n);
+        }
+      printf("%d inputs OK\n",argc - 1);
+      return 0;
+    }
+  for (i=1;i+1<argc;i+=2)
+    if (!strcmp(argv[i],"-n"))
+      Iter = atol(argv[i+1]);
+    else if (!strcmp(argv[i],"-s"))
+      Seed = atol(argv[i+1]);
+  srand(Seed);
+  for (i=0;i<Iter;i++)
+    {
+      n = 1 + rand() % sizeof(buf);
+      MakeInput(buf,n);
+      LLVMFuzzerTestOneInput(buf,n);
+    }
+  printf("%ld inputs OK, %ld lines scrolled\n",Iter,Scrolled);
+  DestroyLines(Lines);
+  return 0;
+}
+#endif
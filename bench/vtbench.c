@@ -0,0 +1,197 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file vtbench.c Microbenchmark for the escape sequence parser.
+
+  Builds natively with gcc (make vtbench), and feeds synthetic log text
+  through VtParse() into a simple screen model, to compare:
+    - one byte per call, the way characters used to be added,
+    - whole buffers with the scalar printable run scanner,
+    - whole buffers with the SSE2 and AVX2 scanners,
+  and then through TermWrite() into the real screen model of the terminal
+  core, with the fastest scanner.
+
+  Reports bytes per second for each, on log lines of about 100 characters
+  and on long lines of 4000.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "term.h"
+
+#define COLS 132                ///< Screen width for the wrap column.
+#define DATA_SIZE (32*1024*1024) ///< Bytes of test data.
+
+static char Line[COLS];         ///< The current screen line.
+static int CursX;               ///< Cursor column.
+static long Lines;              ///< Lines completed, so the work isn't optimized away.
+
+/// Copies printable runs into the line, wrapping at the right edge.
+static void Print(void *User,const char *s,int n)
+{
+  int k;
+
+  while (n > 0)
+    {
+      if (CursX >= COLS - 1)
+        {
+          CursX = 0;
+          Lines++;
+        }
+      k = COLS - 1 - CursX;
+      if (k > n)
+        k = n;
+      memcpy(Line + CursX,s,k);
+      CursX += k;
+      s += k;
+      n -= k;
+    }
+}
+
+/// Handles CR and LF.
+static void Execute(void *User,int ch)
+{
+  if (ch == '\r')
+    CursX = 0;
+  else if (ch == '\n')
+    Lines++;
+}
+
+static const TVtHandlers Handlers = {Print,Execute,NULL,NULL,NULL};
+
+/// Returns a monotonic time in seconds.
+static double Now(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC,&ts);
+  return ts.tv_sec + ts.tv_nsec*1e-9;
+}
+
+/// Fills a buffer with log-like text.
+static void MakeLog(char *buf,int size)
+{
+  static const char *Level[] = {"INFO","DEBUG","WARN","INFO","TRACE"};
+  char s[200];
+  int n,i = 0,k = 0;
+
+  srand(1);
+  while (i < size)
+    {
+      n = sprintf(s,"2026-10-17 12:%02d:%02d.%03d [%s] sensor %d: temperature=%d.%dC "
+                  "humidity=%d%% status=%s seq=%d\r\n",
+                  k/60%60,k%60,rand()%1000,Level[rand()%5],rand()%32,
+                  rand()%40,rand()%10,rand()%100,rand()%7 ? "OK" : "FAULT",k);
+      if (n > size - i)
+        n = size - i;
+      memcpy(buf + i,s,n);
+      i += n;
+      k++;
+    }
+}
+
+/// Fills a buffer with long lines of hex dump text.
+static void MakeLong(char *buf,int size)
+{
+  static const char Hex[] = "0123456789ABCDEF";
+  int i;
+
+  for (i=0;i<size;i++)
+    buf[i] = i % 4002 == 4000 ? '\r' : i % 4002 == 4001 ? '\n' : Hex[(i*7 + i/13) & 15];
+}
+
+/**
+   Parses the data once and reports the speed.
+   @param Name Name of the test.
+   @param buf Data.
+   @param size Bytes of data.
+   @param Chunk Bytes per VtParse() call.
+ */
+static void Run(const char *Name,const char *buf,int size,int Chunk)
+{
+  TVt vt;
+  double t;
+  int i;
+
+  VtInit(&vt,VT_ANSI,&Handlers,NULL);
+  t = Now();
+  for (i=0;i<size;i+=Chunk)
+    VtParse(&vt,buf + i,size - i < Chunk ? size - i : Chunk);
+  t = Now() - t;
+  printf("%-28s %8.1f MB/s  (%ld lines)\n",Name,size/t/1e6,Lines);
+  Lines = 0;
+}
+
+/**
+   Runs the data through the terminal core once and reports the speed.
+   @param Name Name of the test.
+   @param buf Data.
+   @param size Bytes of data.
+   @param Chunk Bytes per TermWrite() call.
+ */
+static void RunCore(const char *Name,const char *buf,int size,int Chunk)
+{
+  TLines *Term = CreateLines(MaxLines,VT_ANSI,NULL,NULL);
+  double t;
+  int i;
+
+  TermResize(Term,COLS,50);
+  t = Now();
+  for (i=0;i<size;i+=Chunk)
+    TermWrite(Term,buf + i,size - i < Chunk ? size - i : Chunk);
+  t = Now() - t;
+  printf("%-28s %8.1f MB/s\n",Name,size/t/1e6);
+  DestroyLines(Term);
+}
+
+/// Runs every variant over the data.
+static void RunAll(const char *buf)
+{
+  VtSetSimd(0);
+  Run("one byte per call",buf,DATA_SIZE,1);
+  Run("4 KB buffers, scalar",buf,DATA_SIZE,4096);
+  if (VtSetSimd(1) == 1)
+    Run("4 KB buffers, SSE2",buf,DATA_SIZE,4096);
+  if (VtSetSimd(2) == 2)
+    Run("4 KB buffers, AVX2",buf,DATA_SIZE,4096);
+  RunCore("4 KB buffers, terminal core",buf,DATA_SIZE,4096);
+}
+
+int main(void)
+{
+  char *buf = malloc(DATA_SIZE);
+
+  if (!buf)
+    return 1;
+  printf("Log text:\n");
+  MakeLog(buf,DATA_SIZE);
+  RunAll(buf);
+  printf("Long lines:\n");
+  MakeLong(buf,DATA_SIZE);
+  RunAll(buf);
+
+  free(buf);
+  return 0;
+}
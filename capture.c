@@ -0,0 +1,563 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file capture.c This file implements binary capture files, and replaying them.
+  @defgroup capture Capture Files
+
+  @section intro Introduction
+
+  A capture keeps everything received on a port, with the time each read from
+  the driver completed and the line errors seen, so a session can be replayed
+  later with its original timing.  Unlike the log (see logfile.c), nothing is
+  added to the data, so binary protocols can be captured too.
+
+  @section format File Format
+
+  The file starts with a TCapHeader, followed by records: a TCapRecord, then
+  its data, padded to a multiple of 16 bytes.  The file is written in extents
+  of CAP_EXTENT bytes, and no record crosses from one extent into the next;
+  a record with no data fills out the end of an extent when needed.  All
+  numbers are little endian.
+
+  @section writing Writing
+
+  The file is grown an extent at a time, which is preallocated and mapped
+  into memory, so capturing a read costs a memcpy() and no system calls; the
+  system writes the pages out in the background.  A closed capture is cut
+  back to its last record, and the header records where that is.  If the
+  program stops without closing it, the rest of the last extent is zeros,
+  and replay stops at the first record with a Time of zero.
+
+  @section replay Replaying
+
+  ReplayRead() hands back the records in order, each once its time has come:
+  the time since the first record, divided by the replay speed, has passed
+  on the replay clock.  It is called from a timer, so the timing is as exact
+  as the timer.  A speed of zero hands them back as fast as they are asked
+  for.  The clock stops while the replay is paused, and restarts from the
+  next record after a change of speed or a ReplaySeek().
+
+  Files that are not captures, such as logs, are replayed too, as if their
+  characters had come in at a steady rate, for instance the baud rate.  Any
+  file is read through a mapping of CAP_EXTENT bytes at a time, so files far
+  larger than memory replay as quickly as the terminal takes them.
+  @{
+ */
+#include <string.h>
+#include "capture.h"
+
+// Defines:
+#define CAP_EXTENT (32*1024*1024)  ///< Bytes the file grows by, a multiple of the 64 KB mapping granularity.
+#define CAP_ALIGN 16               ///< Records start on a multiple of this.
+#define REC_SIZE(n) ((sizeof(TCapRecord) + (n) + CAP_ALIGN-1) & ~(CAP_ALIGN-1))  ///< Size of a record with n bytes of data.
+#define REPLAY_PIECE 65536         ///< Most bytes ReplayRead() returns at a time from a file that is not a capture.
+#define REPLAY_LINE 4096           ///< Most bytes ReplaySeek() looks ahead for the start of a line.
+
+// Functions:
+static BOOL MapExtent(TCapture *c,unsigned long long Extent);
+static BOOL MapReplay(TReplay *r,unsigned long long Extent);
+static const TCapRecord *Peek(TReplay *r);
+static double RecordTime(TReplay *r,const TCapRecord *Rec);
+static double PlayTime(TReplay *r);
+static void SetClock(TReplay *r);
+
+/**
+   Creates a capture file, replacing one of the same name, and maps its first
+   extent.
+   @param c The capture.  Must not be open already.
+   @param FileName File to capture to.
+   @param Port COM port being captured, for the header.
+   @param Baud Baud rate of the port, for the header.
+   @return FALSE if the file can't be created or mapped.
+ */
+BOOL CapOpen(TCapture *c,const char *FileName,int Port,int Baud)
+{
+  LARGE_INTEGER Li;
+  FILETIME Ft;
+
+  if (c->View)
+    return FALSE;
+  c->File = CreateFile(FileName,GENERIC_READ|GENERIC_WRITE,FILE_SHARE_READ,NULL,
+                       CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (c->File == INVALID_HANDLE_VALUE)
+    return FALSE;
+  if (!MapExtent(c,0))
+    {
+      CloseHandle(c->File);
+      return FALSE;
+    }
+
+  memset(&c->Header,0,sizeof(c->Header));
+  strcpy(c->Header.Magic,CAP_MAGIC);
+  c->Header.Version = CAP_VERSION;
+  c->Header.HeaderSize = sizeof(TCapHeader);
+  QueryPerformanceFrequency(&Li);
+  c->Header.Freq = Li.QuadPart;
+  QueryPerformanceCounter(&Li);
+  c->Header.StartQpc = Li.QuadPart;
+  GetSystemTimeAsFileTime(&Ft);
+  c->Header.StartFt = ((unsigned long long)Ft.dwHighDateTime << 32) | Ft.dwLowDateTime;
+  c->Header.Port = Port;
+  c->Header.Baud = Baud;
+  memcpy(c->View,&c->Header,sizeof(c->Header));
+  c->Pos = sizeof(c->Header);
+  return TRUE;
+}
+
+/**
+   Closes a capture file, cutting it back to the last record.  Safe to call
+   when the capture is not open.
+   @param c The capture.
+ */
+void CapClose(TCapture *c)
+{
+  LARGE_INTEGER Li;
+  DWORD n;
+
+  if (!c->View)
+    return;
+  UnmapViewOfFile(c->View);
+  c->View = NULL;
+  c->Header.DataEnd = c->Extent + c->Pos;
+  Li.QuadPart = c->Header.DataEnd;
+  SetFilePointerEx(c->File,Li,NULL,FILE_BEGIN);
+  SetEndOfFile(c->File);
+  Li.QuadPart = 0;
+  SetFilePointerEx(c->File,Li,NULL,FILE_BEGIN);
+  WriteFile(c->File,&c->Header,sizeof(c->Header),&n,NULL);
+  CloseHandle(c->File);
+}
+
+/**
+   Returns TRUE while the capture is open.
+   @param c The capture.
+ */
+BOOL CapActive(TCapture *c)
+{
+  return c->View != NULL;
+}
+
+/**
+   Adds a read from the port to the capture.  If the file can't be grown,
+   the capture is closed.
+   @param c The capture.
+   @param buf Characters read.
+   @param len Number of characters.
+   @param Time QueryPerformanceCounter() reading when they were read.
+   @param Flags Line errors seen, see TCapRecord.
+ */
+void CapWrite(TCapture *c,const char *buf,int len,LONGLONG Time,DWORD Flags)
+{
+  TCapRecord *Rec;
+  DWORD Room,n;
+
+  while (c->View && len > 0)
+    {
+      // records are aligned, so Room is a multiple of CAP_ALIGN
+      Room = CAP_EXTENT - c->Pos;
+      if (Room < sizeof(TCapRecord) + CAP_ALIGN)
+        {
+          // fill out the extent, so replay steps over the rest of it
+          if (Room)
+            {
+              Rec = (TCapRecord *)(c->View + c->Pos);
+              Rec->Time = Time;
+              Rec->Len = 0;
+              Rec->Flags = 0;
+            }
+          if (!MapExtent(c,c->Extent + CAP_EXTENT))
+            CapClose(c);
+          continue;
+        }
+      n = Room - sizeof(TCapRecord);
+      if (n > (DWORD)len)
+        n = len;
+      Rec = (TCapRecord *)(c->View + c->Pos);
+      Rec->Time = Time;
+      Rec->Len = n;
+      Rec->Flags = Flags;
+      memcpy(Rec + 1,buf,n);
+      c->Pos += REC_SIZE(n);
+      buf += n;
+      len -= n;
+      Flags = 0;
+    }
+}
+
+/**
+   Internal function that grows the capture file to the end of an extent,
+   and maps that extent in place of the last.  On failure, the last stays
+   mapped.
+   @param c The capture.
+   @param Extent File offset of the extent.
+   @return FALSE if the file can't be grown or mapped.
+ */
+static BOOL MapExtent(TCapture *c,unsigned long long Extent)
+{
+  unsigned long long End = Extent + CAP_EXTENT;
+  HANDLE Map;
+  char *View;
+
+  // a mapping larger than the file grows it, and the view keeps it alive
+  Map = CreateFileMapping(c->File,NULL,PAGE_READWRITE,(DWORD)(End >> 32),(DWORD)End,NULL);
+  if (!Map)
+    return FALSE;
+  View = MapViewOfFile(Map,FILE_MAP_WRITE,(DWORD)(Extent >> 32),(DWORD)Extent,CAP_EXTENT);
+  CloseHandle(Map);
+  if (!View)
+    return FALSE;
+  if (c->View)
+    UnmapViewOfFile(c->View);
+  c->View = View;
+  c->Extent = Extent;
+  c->Pos = 0;
+  return TRUE;
+}
+
+/**
+   Opens a file to replay, and starts the replay clock.  A capture file is
+   replayed record by record; any other file, a log for instance, is taken
+   to be characters received at RawRate.
+   @param r The replay.  Must not be open already.
+   @param FileName Capture file, or any other file.
+   @param Speed Times faster than it was captured, or 0 for as fast as it
+   can go.
+   @param RawRate Bytes per second to replay a file that is not a capture
+   at, at a Speed of one.
+   @return FALSE if the file can't be opened or mapped.
+ */
+BOOL ReplayOpen(TReplay *r,const char *FileName,int Speed,unsigned long RawRate)
+{
+  LARGE_INTEGER Li;
+  const TCapRecord *Rec;
+  DWORD n;
+
+  if (r->View)
+    return FALSE;
+  r->File = CreateFile(FileName,GENERIC_READ,FILE_SHARE_READ|FILE_SHARE_WRITE,NULL,
+                       OPEN_EXISTING,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (r->File == INVALID_HANDLE_VALUE)
+    return FALSE;
+  if (!GetFileSizeEx(r->File,&Li))
+    {
+      CloseHandle(r->File);
+      return FALSE;
+    }
+  r->Size = Li.QuadPart;
+  if (!ReadFile(r->File,&r->Header,sizeof(r->Header),&n,NULL) || n != sizeof(r->Header) ||
+      strcmp(r->Header.Magic,CAP_MAGIC) || r->Header.Version != CAP_VERSION ||
+      r->Header.HeaderSize < sizeof(r->Header) || r->Header.HeaderSize % CAP_ALIGN ||
+      r->Header.Freq <= 0)
+    {
+      // not a capture, or not one this can read: just characters
+      memset(&r->Header,0,sizeof(r->Header));
+      r->Raw = TRUE;
+    }
+  else
+    {
+      // a capture that wasn't closed runs to the end of its last extent
+      r->Raw = FALSE;
+      if (r->Header.DataEnd && r->Header.DataEnd < r->Size)
+        r->Size = r->Header.DataEnd;
+    }
+  r->RawRate = RawRate ? RawRate : 1;
+  if (!r->Size || !MapReplay(r,0))
+    {
+      CloseHandle(r->File);
+      return FALSE;
+    }
+  r->Pos = r->Header.HeaderSize;
+  r->First = (Rec = Peek(r)) ? Rec->Time : 0;
+  r->Speed = Speed;
+  r->Paused = FALSE;
+  QueryPerformanceFrequency(&Li);
+  r->Freq = Li.QuadPart;
+  SetClock(r);
+  return TRUE;
+}
+
+/**
+   Closes a replay.  Safe to call when the replay is not open.
+   @param r The replay.
+ */
+void ReplayClose(TReplay *r)
+{
+  if (!r->View)
+    return;
+  UnmapViewOfFile(r->View);
+  r->View = NULL;
+  CloseHandle(r->File);
+}
+
+/**
+   Returns TRUE while the replay is open.
+   @param r The replay.
+ */
+BOOL ReplayActive(TReplay *r)
+{
+  return r->View != NULL;
+}
+
+/**
+   Gets the next piece of the replay, if its time has come.  For a capture,
+   that is a record; for other files, up to REPLAY_PIECE bytes.
+   @param r The replay.
+   @param p Receives a pointer to the data, in the mapped file.  Valid until
+   the next call.
+   @param Flags Receives the line errors recorded with it.
+   @return Number of bytes at *p, 0 if nothing is due yet or the replay is
+   paused, or -1 at the end of the file.
+ */
+int ReplayRead(TReplay *r,const char **p,DWORD *Flags)
+{
+  const TCapRecord *Rec;
+  double Due;
+  DWORD n;
+
+  if (!r->Raw)
+    {
+      Rec = Peek(r);
+      if (!Rec)
+        return -1;
+      if (r->Paused || (r->Speed && RecordTime(r,Rec) > PlayTime(r)))
+        return 0;
+      r->Pos += REC_SIZE(Rec->Len);
+      *p = (const char *)(Rec + 1);
+      *Flags = Rec->Flags;
+      return Rec->Len;
+    }
+
+  if (r->Extent + r->Pos >= r->Size)
+    return -1;
+  if (r->Pos >= r->ViewLen && !MapReplay(r,r->Extent + CAP_EXTENT))
+    return -1;
+  if (r->Paused)
+    return 0;
+  n = r->ViewLen - r->Pos;
+  if (n > REPLAY_PIECE)
+    n = REPLAY_PIECE;
+  if (r->Speed)
+    {
+      Due = PlayTime(r)*r->RawRate - (double)(r->Extent + r->Pos);
+      if (Due < 1)
+        return 0;
+      if (Due < n)
+        n = (DWORD)Due;
+    }
+  *p = r->View + r->Pos;
+  *Flags = 0;
+  r->Pos += n;
+  return n;
+}
+
+/**
+   Pauses or resumes a replay.  Time spent paused doesn't count.
+   @param r The replay.
+   @param Paused TRUE to pause.
+ */
+void ReplayPause(TReplay *r,BOOL Paused)
+{
+  if (Paused != r->Paused)
+    {
+      r->Paused = Paused;
+      SetClock(r);
+    }
+}
+
+/**
+   Changes the speed of a replay, from where it has got to.
+   @param r The replay.
+   @param Speed Times faster than it was captured, or 0 for as fast as it
+   can go.
+ */
+void ReplaySetSpeed(TReplay *r,int Speed)
+{
+  r->Speed = Speed;
+  SetClock(r);
+}
+
+/**
+   Moves a replay to another part of the file, and goes on from there at
+   the same speed.  In a capture, it goes to the first record from Pos on;
+   in other files, to the start of the next line, if it is near.
+   @param r The replay.
+   @param Pos File offset to go to.
+ */
+void ReplaySeek(TReplay *r,unsigned long long Pos)
+{
+  unsigned long long Extent;
+  const TCapRecord *Rec;
+  const char *e;
+  DWORD n;
+
+  if (Pos > r->Size)
+    Pos = r->Size;
+  Extent = Pos - Pos % CAP_EXTENT;
+  if (Extent >= r->Size)
+    Extent = Pos = r->Size;
+  else if (Extent != r->Extent && !MapReplay(r,Extent))
+    return;
+  if (r->Raw)
+    {
+      r->Pos = Pos - r->Extent;
+      n = r->ViewLen - r->Pos;
+      if (n > REPLAY_LINE)
+        n = REPLAY_LINE;
+      if (r->Pos && r->Pos < r->ViewLen && (e = memchr(r->View + r->Pos,'\n',n)) != NULL)
+        r->Pos = e + 1 - r->View;
+    }
+  else
+    {
+      // records can only be found from the start of their extent
+      r->Pos = r->Extent ? 0 : r->Header.HeaderSize;
+      while ((Rec = Peek(r)) != NULL && r->Extent + r->Pos < Pos)
+        r->Pos += REC_SIZE(Rec->Len);
+    }
+  SetClock(r);
+}
+
+/**
+   Returns how far the replay has got, as a file offset, for showing the
+   progress.  Compare with the Size field.
+   @param r The replay.
+ */
+unsigned long long ReplayPos(TReplay *r)
+{
+  return r->Extent + r->Pos;
+}
+
+/**
+   Internal function that finds the next record with data in a capture,
+   mapping the next extent when it gets there.
+   @param r The replay.
+   @return The record, or NULL at the end of the capture.
+ */
+static const TCapRecord *Peek(TReplay *r)
+{
+  const TCapRecord *Rec;
+
+  if (r->Raw)
+    return NULL;
+  for(;;)
+    {
+      if (r->Extent + r->Pos + sizeof(TCapRecord) > r->Size)
+        return NULL;
+      // no record crosses into the next extent
+      if (r->Pos + sizeof(TCapRecord) > r->ViewLen)
+        {
+          if (!MapReplay(r,r->Extent + CAP_EXTENT))
+            return NULL;
+          continue;
+        }
+      Rec = (const TCapRecord *)(r->View + r->Pos);
+      if (!Rec->Time || Rec->Len > r->ViewLen - r->Pos - sizeof(TCapRecord))
+        return NULL;
+      if (Rec->Len)
+        return Rec;
+      r->Pos += sizeof(TCapRecord);
+    }
+}
+
+/**
+   Internal function that returns when a record was received, counted from
+   the first record.
+   @param r The replay.
+   @param Rec The record.
+   @return Time in seconds.
+ */
+static double RecordTime(TReplay *r,const TCapRecord *Rec)
+{
+  return (double)(Rec->Time - r->First)/r->Header.Freq;
+}
+
+/**
+   Internal function that returns how far into the file the replay clock
+   has got.  Compared with RecordTime(), or for other files, with the
+   position divided by RawRate.
+   @param r The replay.
+   @return Time in seconds.
+ */
+static double PlayTime(TReplay *r)
+{
+  LARGE_INTEGER Now;
+
+  QueryPerformanceCounter(&Now);
+  return r->Played + (double)(Now.QuadPart - r->Start)/r->Freq*r->Speed;
+}
+
+/**
+   Internal function that restarts the replay clock from where the replay
+   has got to, after it was paused, moved, or changed speed.
+   @param r The replay.
+ */
+static void SetClock(TReplay *r)
+{
+  const TCapRecord *Rec;
+  LARGE_INTEGER Now;
+
+  if (r->Raw)
+    r->Played = (double)(r->Extent + r->Pos)/r->RawRate;
+  else if ((Rec = Peek(r)) != NULL)
+    r->Played = RecordTime(r,Rec);
+  QueryPerformanceCounter(&Now);
+  r->Start = Now.QuadPart;
+}
+
+/**
+   Internal function that maps an extent of the file for replay, in place
+   of the last.  On failure, the last stays mapped.
+   @param r The replay.
+   @param Extent File offset of the extent.
+   @return FALSE at the end of the file, or if it can't be mapped.
+ */
+static BOOL MapReplay(TReplay *r,unsigned long long Extent)
+{
+  unsigned long long Len;
+  HANDLE Map;
+  const char *View;
+
+  if (Extent >= r->Size)
+    return FALSE;
+  Len = r->Size - Extent;
+  if (Len > CAP_EXTENT)
+    Len = CAP_EXTENT;
+  Map = CreateFileMapping(r->File,NULL,PAGE_READONLY,0,0,NULL);
+  if (!Map)
+    return FALSE;
+  View = MapViewOfFile(Map,FILE_MAP_READ,(DWORD)(Extent >> 32),(DWORD)Extent,(SIZE_T)Len);
+  CloseHandle(Map);
+  if (!View)
+    return FALSE;
+  if (r->View)
+    UnmapViewOfFile(r->View);
+  r->View = View;
+  r->Extent = Extent;
+  r->ViewLen = (DWORD)Len;
+  r->Pos = 0;
+  return TRUE;
+}
+
+/**
+   @}
+*/
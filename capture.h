@@ -0,0 +1,110 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef CAPTURE_H
+#define CAPTURE_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file capture.h Binary capture files, and replaying them.
+   @addtogroup capture
+ */
+
+#include <windows.h>
+
+#define CAP_MAGIC "FUNCAP1"     ///< First 8 bytes of a capture file, with the terminating zero.
+#define CAP_VERSION 1           ///< Version of the file format.
+
+/**
+   Start of a capture file.  The records follow, from HeaderSize on.
+*/
+typedef struct {
+  char Magic[8];                ///< CAP_MAGIC.
+  DWORD Version;                ///< CAP_VERSION.
+  DWORD HeaderSize;             ///< Size of this header, where the first record starts.
+  LONGLONG Freq;                ///< QueryPerformanceFrequency() on the capturing machine, ticks per second.
+  LONGLONG StartQpc;            ///< QueryPerformanceCounter() when the capture started...
+  unsigned long long StartFt;   ///< ...and the system time then, as a FILETIME.
+  unsigned long long DataEnd;   ///< File offset after the last record, or 0 if the capture wasn't closed.
+  DWORD Port;                   ///< COM port captured, COM1 = 1.
+  DWORD Baud;                   ///< Baud rate of the port.
+  char Reserved[8];             ///< Zero.
+} TCapHeader;
+
+/**
+   One read from the port, followed by its Len bytes of data, and padded to
+   a multiple of 16 bytes.  A record with a Time of zero is past the end.
+*/
+typedef struct {
+  LONGLONG Time;                ///< QueryPerformanceCounter() when the read completed.  Never zero.
+  DWORD Len;                    ///< Number of data bytes.  Zero for filler at the end of an extent.
+  DWORD Flags;                  ///< CE_OVERRUN, CE_FRAME, CE_RXPARITY and CE_RXOVER seen before this read.
+} TCapRecord;
+
+/**
+   A capture being written.  Filled in by CapOpen(); the caller provides the
+   memory and keeps it until CapClose().
+*/
+typedef struct {
+  HANDLE File;                  ///< The capture file.
+  char *View;                   ///< Mapped view of the extent being filled, NULL when not capturing.
+  unsigned long long Extent;    ///< File offset of View.
+  DWORD Pos;                    ///< Offset in View of the next record.
+  TCapHeader Header;            ///< Copy of the file's header.
+} TCapture;
+
+/**
+   A capture being replayed.  Filled in by ReplayOpen(); the caller provides
+   the memory and keeps it until ReplayClose().
+*/
+typedef struct {
+  HANDLE File;                  ///< The capture file.
+  const char *View;             ///< Mapped view of the extent being read, NULL when not replaying.
+  unsigned long long Extent;    ///< File offset of View.
+  DWORD ViewLen;                ///< Size of View.
+  DWORD Pos;                    ///< Offset in View of the next record.
+  unsigned long long Size;      ///< File offset after the last record.
+  TCapHeader Header;            ///< The file's header.  All zeros if Raw.
+  int Raw;                      ///< Flag: the file is not a capture, just characters.
+  unsigned long RawRate;        ///< Bytes per second a Raw file is replayed at, at a Speed of one.
+  int Speed;                    ///< Times faster than captured, or 0 for as fast as it can go.
+  int Paused;                   ///< Flag: the replay is paused.
+  LONGLONG First;               ///< Time of the first record.
+  double Played;                ///< Seconds into the file the replay clock was at when it was last set...
+  LONGLONG Start;               ///< ...and QueryPerformanceCounter() then.
+  LONGLONG Freq;                ///< QueryPerformanceFrequency() on this machine.
+} TReplay;
+
+BOOL CapOpen(TCapture *c,const char *FileName,int Port,int Baud);
+void CapClose(TCapture *c);
+BOOL CapActive(TCapture *c);
+void CapWrite(TCapture *c,const char *buf,int len,LONGLONG Time,DWORD Flags);
+BOOL ReplayOpen(TReplay *r,const char *FileName,int Speed,unsigned long RawRate);
+void ReplayClose(TReplay *r);
+BOOL ReplayActive(TReplay *r);
+int ReplayRead(TReplay *r,const char **p,DWORD *Flags);
+void ReplayPause(TReplay *r,BOOL Paused);
+void ReplaySetSpeed(TReplay *r,int Speed);
+void ReplaySeek(TReplay *r,unsigned long long Pos);
+unsigned long long ReplayPos(TReplay *r);
+
+#endif
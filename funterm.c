@@ -30,6 +30,10 @@
 #include <stdlib.h>
 #include "funtermres.h"
 #include "serial.h"
+#include "history.h"
+#include "search.h"
+#include "vtparse.h"
+#include "xfer.h"
 
 /** @file
     This file is the main module of the project. It contains the code
@@ -54,9 +58,29 @@
     If you have MinGW loaded, the included Makefile should work.  If you are compiling from
     Windows, you may need to modify the makefile to work with Windows path conventions.
 
+    The screen model and escape sequence handling (term.c and vtparse.c) have no
+    Win32 dependency, and also build natively with gcc: <b>make termfuzz</b> builds
+    a fuzzing driver for them, and <b>make vtbench</b> a benchmark.  <b>make bench</b>
+    measures the whole receive path, fed through a pseudo-terminal, see bench/ptybench.c.
+
     @section features Features
-    - Supports 128 COM ports.
-    - Supports escape sequences.  All escape sequences start with the escape character, 0x1B.
+    - Supports 128 COM ports, several at once.  Each port has a window of its own
+      (File/New Window, Ctrl-N) with its own scrollback, log, search and file send.
+      Ports given on the command line, as in <b>funterm 3 COM5</b>, each open in a
+      window of their own.
+    - Supports DEC VT100 and ANSI escape sequences, parsed by a state machine after
+      the DEC VT500 series (see vtparse.c).  These control sequences are carried out:
+      - Cursor movement: <b>CSI n A</b>, <b>B</b>, <b>C</b>, <b>D</b>, <b>E</b>, <b>F</b>,
+        <b>G</b>, <b>d</b>, <b>row;col H</b> and <b>f</b>, <b>s</b> and <b>u</b>, <b>ESC 7</b>
+        and <b>ESC 8</b>, <b>ESC D</b>, <b>ESC E</b>, <b>ESC M</b>.
+      - Erasing and editing: <b>CSI n J</b>, <b>K</b>, <b>L</b>, <b>M</b>, <b>@</b>, <b>P</b>,
+        <b>X</b>, and <b>ESC c</b> to reset.
+      - Colors and attributes: <b>CSI ... m</b>, with bold, underline, reverse, and the
+        16 basic colors.  256-color and RGB colors are skipped.
+      - Cursor on/off: <b>CSI ? 25 h</b> and <b>l</b>.
+      - Window title: <b>OSC 0 ; title BEL</b>.
+    - Supports the legacy ADM-style escape sequences instead, if selected in the comm setup
+      dialog.  All escape sequences start with the escape character, 0x1B.
       - <b><ESC> T</b> - Clear to end of line.
       - <b><ESC> Y</b> - Clear to end of screen.
       - <b><ESC> . <i>x</i></b> - Turn cursor on/off.  If <i>x</i> == '0', cursor is off.
@@ -64,10 +88,33 @@
       - <b><ESC> = <i>row col</i></b> - Set cursor position to <i>row, col</i>.  Parameters
                are biased by 0x20 (space character).  For example, to set the column to 40,
                <i>col</i> would be 0x20 + 40 = 32 + 40 = 72 = 0x48 = 'H'.
+    - Keeps a scrollback history of lines that have scrolled off the screen.  The
+      history is limited by a memory cap set in the comm setup dialog, and can
+      hold millions of lines.  Use the scroll bar or mouse wheel to view it.
+      Optionally, history beyond the memory cap is compressed and kept in a
+      temporary file, so days of output can be scrolled back through and saved.
+    - Sends files in the background, straight from a memory mapped view of the file,
+      with the progress and rate in the status bar.  The send can be cancelled, and
+      paced with delays after each character and each line for slow receivers.
+    - Logs received characters to a file, written by a thread of its own so a slow
+      disk never holds up the port.  Optionally, each line starts with the time it
+      was received, to the microsecond, and a new file is started after a set size
+      or number of minutes.
+    - Captures received characters to a binary file, with the time of every read
+      and the line errors seen, written through a memory mapping at almost no cost.
+      Captures can be replayed into the terminal at their original speed, or as
+      fast as it will go.
+    - Counts bytes in and out and line errors (overruns, framing and parity errors,
+      and driver Rx queue overflows), shown next to the LEDs in the status bar.  New
+      errors are also noted in the log file, so they can be found in the data.
+    - Find (Ctrl-F) and Find Next (F3) search the whole scrollback history for a
+      plain string or a regular expression.  The search runs in the background,
+      and matches on screen are highlighted.
     - Supports control-character commands.  Note that these are characters received over the
       serial port, not entered via the keyboard.
-      - <b>Control-X</b> - Move to home position.
-      - <b>Control-Z</b> - Clear screen and home.
+      - <b>Backspace</b>, <b>Tab</b>, <b>CR</b> and <b>LF</b>.
+      - <b>Control-X</b> - Move to home position (ADM mode only).
+      - <b>Control-Z</b> and <b>Control-L</b> - Clear screen and home (ADM mode only).
 
     @section reg Registry Usage
     The registry is used so store program settings.  Settings are stored in
@@ -76,28 +123,40 @@
     - Baud rate.
     - OpenOnStart.  If true the comport is opened on startup.
     - Hardware flow control setting.
+    - ADM mode setting.
+    - Rx buffer and scrollback memory sizes, and whether to spill old
+      scrollback to disk.
+    - Serial driver Rx and Tx queue sizes.  Zero sizes them from the baud rate.
+    - File send character and line delays.
+    - Log time stamps, and the size and age to start a new log file at.
+
+    The settings are saved when they are changed, from the window they were
+    changed in, and new windows start with them.
 
     @defgroup term Terminal
     @{
 
-    See Main Page for features.  This file implements all of the terminal functions, except
-    for serial connectivity.
+    See Main Page for features.  This file implements the user interface of the terminal:
+    the window, drawing, scrollback, logging and settings.  The screen contents are
+    kept by the terminal core, see term.c; serial connectivity is in serial.c.
 
  */
 
 // Defines:
 #define Margin 5           ///< Margin in pixels between edge of main control's edge and text.
 #define FIXED_CONFIG_1 0   ///< Special build flag to create a fixed config version, should be zero for most users
+#define RX_SLICE 65536     ///< Max bytes handled per MESS_SERIAL, so the UI stays responsive under load.
+#define IDT_RENDER 1       ///< Timer ID used to repaint changed lines.
+#define IDT_XFER 2         ///< Timer ID used to show the progress of a file send or paste.
+#define IDT_STATS 3        ///< Timer ID used to show the port's byte and error counts.
+#define IDT_REPLAY 4       ///< Timer ID used to play back a capture.
+#define REPLAY_MS 10       ///< Milliseconds between replay timer ticks.
+#define REPLAY_BUDGET 40   ///< Most milliseconds a replay tick spends feeding the terminal at Max speed.
+#define REPLAY_SHOW 250    ///< Milliseconds between updates of the replay progress.
+#define SEEK_STEPS 1000    ///< Positions on the replay's seek slider.
+#define BIN_WIDTH 94       ///< Characters across a row of the binary view.
 
 // Enumerations:
-/// State variable for processing escape codes (VT100).
-enum TEscProg {
-  Idle=-1,      ///< Not processing escape sequence yet.
-  Ready,        ///< Got the Escape character, waiting for command.
-  CursorOnOff,  ///< Waiting for cursor on/off parameter character.
-  CursPosX,     ///< Waiting for cursor X position.
-  CursPosY      ///< Waiting for cursor Y position.
-} EscProg=Idle;
 /// Current state of serial port, used for updating the status bar.
 enum TStatus {
   stOff,     ///< Serial port is off.
@@ -114,26 +173,66 @@ void CenterWindow(HWND wnd);
 void CopyToClipboard(HWND wnd);
 void PasteFromClipboard(HWND wnd);
 void ShowMenu(HWND wnd);
-void DrawChar(int x,int y,char ch);
 void SetMinMaxInfo(MINMAXINFO *p);
-void ClearScreen(void);
 void SendFile(void);
 void SaveFile(void);
 void StartLog(void);
 void EndLog(void);
-void AddBinaryChar(char ch);
+void OnRawAdded(void);
+void UpdateBin(void);
+void ScrollBin(long long Top);
+void OnBinVScroll(int Code);
+void PaintBin(HWND wnd);
+void ShowRxDropped(BOOL Force);
+void ShowFlowStatus(void);
+void ShowStats(BOOL Force);
+void LogStats(void);
+void StartCapture(void);
+void EndCapture(void);
+void StartReplay(void);
+void EndReplay(void);
+BOOL _stdcall ReplayDlgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+BOOL ReplayDialog(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+void ReplayTick(void);
+void ShowReplayProgress(BOOL Force);
+void BeginSend(void);
+void ShowXferProgress(int Result);
+void EndSend(int Result);
+void ScheduleRender(void);
+void RenderDirty(HWND wnd);
+void ResizeBackBuffer(HWND wnd);
+void DestroyBackBuffer(void);
+void RenderSpan(int Row,int x0,int x1,RECT *R);
+void SetAttrColors(WORD Attr);
+const char *GetLine(long long n,int *Len);
+void ScrollView(long long Top);
+void OnVScroll(int Code);
+void UpdateScrollBar(void);
+void SetupHistory(void);
+void OpenFind(void);
+BOOL FindDialog(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam);
+BOOL StartSearch(HWND dlg);
+void StopSearch(void);
+void FindNext(void);
+void ShowFindStatus(void);
+void OnTermInvalidate(void *User);
+void OnTermScroll(void *User,TLines *Lines,int n);
+void OnTermTitle(void *User,const char *Title);
 LRESULT CALLBACK BinWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam);
+TSession *NewSession(const TRegContents *Reg,BOOL Open);
+LRESULT SessionWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam);
+BOOL OpenSessionPort(void);
+void CloseSessionPort(void);
+void ShowSessionTitle(const char *Title);
+BOOL CALLBACK CloseSessionWnd(HWND hwnd,LPARAM lParam);
 
 // Variables:
 HINSTANCE hInst;                ///< Handle to this instance of the program.
-HWND hwndMain;                  ///< Handle to the main window of the program.
-HWND hwndBin;                   ///< Handle to the binary view window.
-HWND hwndBinEdit;               ///< Handle to the edit control in the bin view window.
-
-TLines *Lines=NULL;             ///< Pointer to the global TLines structure.
-int TopLine=0;                  ///< Index of first line on screen.
-int ScrnLineCount=1;            ///< Number of lines on the screen.
-TRegContents RegContents;       ///< Global registry stuff.
+TSession *Cur=NULL;             /**< Session whose window is handling a message.  Set on
+                                every entry to MainWndProc() and put back on the way out,
+                                so the functions below work on the right session. */
+int SessionCount=0;             ///< Number of open session windows.  The program ends with the last.
+TRegContents RegContents;       ///< Settings from the registry, copied into each new session.
 /// Supported baud rates (in BPS).
 int BaudRates[8] = {9600,19200,38400,57600,115200,230400,460800,921600};
 char FileName[300];             ///< Filename string used anywhere a filename is needed.
@@ -141,12 +240,23 @@ HMENU PopupMenu=NULL;           ///< Pointer to popup menu.
 int CharWd=5,CharHt=5;          /**< Size of a single character in pixels.
                                 This is determined by calling GetTextExtentPoint32()
                                 on an 'A'. */
-int LineLength=80;              ///< Current width of window in characters.
 HFONT font;                     ///< Font used for drawing characters.
-FILE *LogFile=0;                ///< File pointer to the Logging file.
-HWND  hWndStatusbar;            ///< Windows handle to the Status Bar
-BOOL RxFlag=FALSE;              ///< Flag used to signal the Rx "LED" to flash
-BOOL TxFlag=FALSE;              ///< Flag used to signal the Tx "LED" to flash
+int RenderPeriod=16;            ///< Minimum time between repaints in ms, set from the monitor refresh rate.
+HWND hwndFind=NULL;             ///< Handle to the modeless Find dialog.
+TSession *FindSession=NULL;     ///< Session the Find dialog searches.
+HWND hwndReplay=NULL;           ///< Handle to the modeless Replay dialog.
+TSession *ReplaySession=NULL;   ///< Session the Replay dialog controls.
+/// Replay speeds on the Replay dialog, times faster than captured.  0 for Max.
+const int ReplaySpeeds[4] = {1,10,100,0};
+/// Terminal core callbacks.
+const TTermCallbacks TermCallbacks = {OnTermInvalidate,OnTermScroll,OnTermTitle};
+/// Colors for the character attributes: the standard 8 colors, then bright ones.
+const COLORREF Palette[16] = {
+  RGB(0,0,0),RGB(205,0,0),RGB(0,205,0),RGB(205,205,0),
+  RGB(0,0,238),RGB(205,0,205),RGB(0,205,205),RGB(229,229,229),
+  RGB(127,127,127),RGB(255,0,0),RGB(0,255,0),RGB(255,255,0),
+  RGB(92,92,255),RGB(255,0,255),RGB(0,255,255),RGB(255,255,255)
+};
 
 /**
    Updates the statusbar control with the input text.
@@ -159,7 +269,7 @@ BOOL TxFlag=FALSE;              ///< Flag used to signal the Tx "LED" to flash
 */
 void UpdateStatusBar(LPSTR lpszStatusString, WORD partNumber, WORD displayFlags)
 {
-  SendMessage(hWndStatusbar,
+  SendMessage(Cur->StatusBar,
               SB_SETTEXT,
               partNumber | displayFlags,
               (LPARAM)lpszStatusString);
@@ -175,7 +285,7 @@ void UpdateStatusBar(LPSTR lpszStatusString, WORD partNumber, WORD displayFlags)
 void InitializeStatusBar(HWND hwndParent,int nrOfParts)
 {
   const int cSpaceInBetween = 8;
-  int   ptArray[6];   // Array defining the number of parts/sections
+  int   ptArray[10];  // Array defining the number of parts/sections
   RECT  rect;
   HDC   hDC;
 
@@ -183,17 +293,21 @@ void InitializeStatusBar(HWND hwndParent,int nrOfParts)
 
   hDC = GetDC(hwndParent);
   GetClientRect(hwndParent, &rect);
-  LineLength = (rect.right - rect.left)/CharWd;
+  Cur->LineLength = (rect.right - rect.left)/CharWd;
 
   ptArray[0] = 46;
-  ptArray[1] = 100;
-  ptArray[2] = 151;
-  ptArray[3] = 194;
-  ptArray[4] = 326;
+  ptArray[1] = 436;
+  ptArray[2] = 490;
+  ptArray[3] = 541;
+  ptArray[4] = 584;
+  ptArray[5] = 716;
+  ptArray[6] = 790;
+  ptArray[7] = 1010;
+  ptArray[8] = 1290;
   ptArray[nrOfParts-1] = -1;  // Last part extends to right side of window
 
   ReleaseDC(hwndParent, hDC);
-  SendMessage(hWndStatusbar,
+  SendMessage(Cur->StatusBar,
               SB_SETPARTS,
               nrOfParts,
               (LPARAM)(LPINT)ptArray);
@@ -209,11 +323,11 @@ void InitializeStatusBar(HWND hwndParent,int nrOfParts)
 */
 static BOOL CreateSBar(HWND hwndParent,char *initialText,int nrOfParts)
 {
-  hWndStatusbar = CreateStatusWindow(WS_CHILD | WS_VISIBLE | WS_BORDER|SBARS_SIZEGRIP,
+  Cur->StatusBar = CreateStatusWindow(WS_CHILD | WS_VISIBLE | WS_BORDER|SBARS_SIZEGRIP,
                                      initialText,
                                      hwndParent,
                                      IDM_STATUSBAR);
-  if (hWndStatusbar)
+  if (Cur->StatusBar)
     {
       InitializeStatusBar(hwndParent,nrOfParts);
       return TRUE;
@@ -258,23 +372,24 @@ static BOOL InitApplication(void)
 }
 
 /**
-   Creates the Window Class for application.
+   Creates a main window, for a session.
+   @param s The session.  Passed in WM_NCCREATE and kept in GWLP_USERDATA.
    @return Handle to main window created.
 */
-HWND CreatefuntermWndClassWnd(void)
+HWND CreatefuntermWndClassWnd(TSession *s)
 {
   /** Window parameters include WS_MINIMIZEBOX, WS_VISIBLE, WS_CLIPSIBLINGS,
       WS_CLIPCHILDREN, WS_MAXIMIZEBOX, WS_CAPTION, WS_BORDER, WS_SYSMENU,
-      and WS_THICKFRAME.
+      WS_THICKFRAME, and WS_VSCROLL for the scrollback history.
   */
 
   return CreateWindowEx(0,"funtermWndClass","FUNterm",
-                        WS_MINIMIZEBOX|WS_VISIBLE|WS_CLIPSIBLINGS|WS_CLIPCHILDREN|WS_MAXIMIZEBOX|WS_CAPTION|WS_BORDER|WS_SYSMENU|WS_THICKFRAME,
+                        WS_MINIMIZEBOX|WS_VISIBLE|WS_CLIPSIBLINGS|WS_CLIPCHILDREN|WS_MAXIMIZEBOX|WS_CAPTION|WS_BORDER|WS_SYSMENU|WS_THICKFRAME|WS_VSCROLL,
                         CW_USEDEFAULT,0,CW_USEDEFAULT,0,
                         NULL,
                         NULL,
                         hInst,
-                        NULL);
+                        s);
 }
 
 /**
@@ -328,34 +443,38 @@ void MainWndProc_OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
     {
     case IDM_ABOUT:
       DialogBox(hInst,MAKEINTRESOURCE(IDD_ABOUT),
-                hwndMain,DlgWinProc);
+                Cur->Wnd,DlgWinProc);
       break;
     case IDM_CONFIG:
       DialogBoxParam(hInst,MAKEINTRESOURCE(IDD_CONFIG),
-                     hwndMain,DlgWinProc,1);
+                     Cur->Wnd,DlgWinProc,1);
       break;
     case IDM_STARTCOMM:
       // start or stop serial port
-      if (SerialPortIsOpen()) // close it
+      if (Cur->Port) // close it
         {
-          CloseSerialPort();
+          CloseSessionPort();
           FillInStatus(stOff);
         }
-        else if (!OpenPort(RegContents.ComPort,
-                           BaudRates[RegContents.Baud],
-                           RegContents.HdwFlow,
-                           hwndMain))
+        else if (!OpenSessionPort())
           {
-            MessageBox(hwndMain,"Cannot open serial port!\n","Error",MB_OK|MB_ICONSTOP);
-            CloseSerialPort();
+            MessageBox(Cur->Wnd,"Cannot open serial port!\n","Error",MB_OK|MB_ICONSTOP);
             FillInStatus(stError);
           }
         else
           FillInStatus(stRunning);
       break;
-    case IDM_EXIT:
+    case IDM_NEWWINDOW:
+      // another port, in a window of its own; this one is taken, so ask which
+      NewSession(&Cur->Reg,FALSE);
+      break;
+    case IDM_CLOSEWINDOW:
       PostMessage(hwnd,WM_CLOSE,0,0);
       break;
+    case IDM_EXIT:
+      // close every session window
+      EnumThreadWindows(GetCurrentThreadId(),CloseSessionWnd,0);
+      break;
     case IDM_COPY:
       // copy contents to clipboard
       CopyToClipboard(hwnd);
@@ -366,16 +485,22 @@ void MainWndProc_OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
       break;
     case IDM_CLEAR:
       // clear screen
-      ClearScreen();
+      ClearScreen(Cur->Lines);
       break;
     case IDM_SEND:
       // send file to port
       SendFile();
       break;
+    case IDM_CANCELSEND:
+      // stop the file send or paste, MESS_XFER follows
+      XferStop(&Cur->Xfer);
+      break;
     case IDM_CRLF:
       // Toggle CR/LF usage
-      RegContents.CrLf = !RegContents.CrLf;
-      if (SerialPortIsOpen())
+      Cur->Reg.CrLf = !Cur->Reg.CrLf;
+      Cur->Lines->CrLf = Cur->Reg.CrLf;
+      SaveReg();
+      if (Cur->Port)
         FillInStatus(stRunning);
       break;
     case IDM_LOG_START:
@@ -384,40 +509,47 @@ void MainWndProc_OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
     case IDM_LOG_END:
       EndLog();
       break;
+    case IDM_CAP_START:
+      StartCapture();
+      break;
+    case IDM_CAP_END:
+      EndCapture();
+      break;
+    case IDM_REPLAY:
+      StartReplay();
+      break;
+    case IDM_REPLAY_STOP:
+      EndReplay();
+      ShowReplayProgress(TRUE);
+      break;
     case IDM_SAVE:
       // save screen data to file
       SaveFile();
       break;
+    case IDM_FIND:
+      OpenFind();
+      break;
+    case IDM_FINDNEXT:
+      FindNext();
+      break;
     case IDM_BINARY:
-        // Show binary in new window.
-        if (!hwndBin)
+        // Show binary in new window, drawn from the raw history.
+        if (!Cur->Bin)
         {
-            LOGFONT LogFont;
-            HFONT fnt;
-            hwndBin = CreateWindowEx(0,"binWndClass","Binary View",
-                                     WS_MINIMIZEBOX|WS_VISIBLE|WS_CLIPSIBLINGS|WS_CLIPCHILDREN|WS_MAXIMIZEBOX|WS_CAPTION|WS_BORDER|WS_SYSMENU|WS_THICKFRAME,
-                                     CW_USEDEFAULT,0,300,500,
-                                     NULL,
-                                     NULL,
-                                     hInst,
-                                     NULL);
-            hwndBinEdit = CreateWindowEx(0,"EDIT","",
-                                  WS_VISIBLE|WS_CHILD|ES_MULTILINE|ES_AUTOHSCROLL|ES_AUTOVSCROLL|WS_HSCROLL|WS_VSCROLL,
-                                  //CW_USEDEFAULT,0,CW_USEDEFAULT,0,
-                                  0, 0, 100, 100,
-                                  hwndBin,
-                                  NULL,
-                                  hInst,
-                                  NULL);
-
-            fnt = GetStockObject(ANSI_FIXED_FONT);
-            GetObject(fnt,sizeof(LOGFONT),&LogFont);
-            LogFont.lfHeight = LogFont.lfHeight * 4/3; //-MulDiv(10, GetDeviceCaps(DC, LOGPIXELSY), 72);
-            fnt = CreateFontIndirect(&LogFont);
-            SendMessage(hwndBinEdit, WM_SETFONT, (WPARAM)fnt, 0);
+            Cur->BinFollow = TRUE;
+            Cur->BinRows = 0;
+            // sets Cur->Bin in WM_NCCREATE
+            CreateWindowEx(0,"binWndClass","Binary View",
+                           WS_MINIMIZEBOX|WS_VISIBLE|WS_CLIPSIBLINGS|WS_CLIPCHILDREN|WS_MAXIMIZEBOX|WS_CAPTION|WS_BORDER|WS_SYSMENU|WS_THICKFRAME|WS_VSCROLL,
+                           CW_USEDEFAULT,0,
+                           BIN_WIDTH*CharWd + GetSystemMetrics(SM_CXVSCROLL) + 2*GetSystemMetrics(SM_CXSIZEFRAME),500,
+                           NULL,
+                           NULL,
+                           hInst,
+                           Cur);
         }
-        if (hwndBin)
-            ShowWindow(hwndBin,SW_SHOW);
+        if (Cur->Bin)
+            ShowWindow(Cur->Bin,SW_SHOW);
         break;
     default:
         break;
@@ -425,7 +557,9 @@ void MainWndProc_OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
 }
 
 /**
-   The window procedure (callback) for the main window.
+   The window procedure (callback) for the main windows.  Finds the window's
+   session, makes it Cur while the message is handled, and passes the message
+   on to SessionWndProc().
    @param hwnd Handle to main window.
    @param msg Windows message to handle.
    @param wParam First message parameter.
@@ -433,13 +567,48 @@ void MainWndProc_OnCommand(HWND hwnd, int id, HWND hwndCtl, UINT codeNotify)
    @return Depends on the specific message handled.
  */
 LRESULT CALLBACK MainWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
+{
+  TSession *Saved = Cur;
+  LRESULT r;
+
+  if (msg == WM_NCCREATE)
+    {
+      // the session comes from CreatefuntermWndClassWnd()
+      Cur = ((CREATESTRUCT *)lParam)->lpCreateParams;
+      Cur->Wnd = hwnd;
+      SetWindowLongPtr(hwnd,GWLP_USERDATA,(LONG_PTR)Cur);
+    }
+  // message boxes and modal dialogs run other windows' messages, so a
+  // message for one session can arrive while another's is being handled
+  Cur = (TSession *)GetWindowLongPtr(hwnd,GWLP_USERDATA);
+  if (Cur)
+    r = SessionWndProc(hwnd,msg,wParam,lParam);
+  else
+    r = DefWindowProc(hwnd,msg,wParam,lParam);
+  Cur = Saved;
+  return r;
+}
+
+/**
+   Handles the messages of a main window, for the session in Cur.
+   @param hwnd Handle to main window.
+   @param msg Windows message to handle.
+   @param wParam First message parameter.
+   @param lParam Second message parameter.
+   @return Depends on the specific message handled.
+ */
+LRESULT SessionWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
 {
   switch (msg)
     {
     case WM_SIZE:
-      SendMessage(hWndStatusbar,msg,wParam,lParam);
+      SendMessage(Cur->StatusBar,msg,wParam,lParam);
       FillInStatus(stResize);
+      ResizeBackBuffer(hwnd);
       break;
+    case WM_ERASEBKGND:
+      // Paint() covers everything from the back buffer
+      return 1;
     case WM_GETMINMAXINFO:
       // set minimum size of window
       SetMinMaxInfo((MINMAXINFO*)lParam);
@@ -448,39 +617,137 @@ LRESULT CALLBACK MainWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
       HANDLE_WM_COMMAND(hwnd,wParam,lParam,MainWndProc_OnCommand);
       break;
     case WM_CREATE:
-      Lines = CreateLines(4);
+      // WM_DESTROY and WM_NCDESTROY follow even if this fails
+      InitializeCriticalSection(&Cur->HistLock);
+      SessionCount++;
+      Cur->Lines = CreateLines(MaxLines,Cur->Reg.AdmMode ? VT_ADM : VT_ANSI,&TermCallbacks,Cur);
+      Cur->History = HistCreate(64*1024*1024);
+      Cur->Raw = RawCreate(64*1024*1024);
+      if (!Cur->Lines || !Cur->History || !Cur->Raw)
+        return -1;
+      Cur->Lines->CrLf = Cur->Reg.CrLf;
+      CreateSBar(hwnd,"",3);
+      SetupHistory();
       break;
     case WM_DESTROY:
       EndLog();
-      SaveReg();
+      EndCapture();
+      EndReplay();
       // close serial port
-      CloseSerialPort();
-      DestroyLines(Lines);
-      DestroyMenu(PopupMenu);
-      PostQuitMessage(0);
+      CloseSessionPort();
+      StopSearch();
+      if (hwndFind && FindSession == Cur)
+        DestroyWindow(hwndFind);
+      if (Cur->Bin)
+        DestroyWindow(Cur->Bin);
+      if (Cur->Lines)
+        DestroyLines(Cur->Lines);
+      HistDestroy(Cur->History);
+      RawDestroy(Cur->Raw);
+      DeleteCriticalSection(&Cur->HistLock);
+      DestroyBackBuffer();
+      free(Cur->Found);
+      break;
+    case WM_NCDESTROY:
+      // the window is gone, and the session with it
+      SetWindowLongPtr(hwnd,GWLP_USERDATA,0);
+      free(Cur);
+      if (--SessionCount == 0)
+        PostQuitMessage(0);
       break;
     case WM_CHAR:
       DoKey(hwnd,wParam);
       break;
+    case WM_VSCROLL:
+      OnVScroll(LOWORD(wParam));
+      break;
+    case WM_MOUSEWHEEL:
+      ScrollView(Cur->TopLine - 3*GET_WHEEL_DELTA_WPARAM(wParam)/WHEEL_DELTA);
+      break;
     case WM_PAINT:
       Paint(hwnd);
       break;
+    case WM_TIMER:
+      if (wParam == IDT_RENDER)
+        RenderDirty(hwnd);
+      else if (wParam == IDT_XFER)
+        {
+          ShowXferProgress(-1);
+          Cur->TxFlag = TRUE;          // signal LED to go on.
+        }
+      else if (wParam == IDT_STATS)
+        ShowStats(FALSE);
+      else if (wParam == IDT_REPLAY)
+        ReplayTick();
+      break;
+      /// MESS_XFER, posted by the file sender when a send or paste is done.
+    case MESS_XFER:
+      EndSend(wParam);
+      break;
+      /// MESS_CTS, posted when CTS starts or stops holding off the transmitter.
+    case MESS_CTS:
+      ShowFlowStatus();
+      break;
+      /// MESS_LINEERR, posted when the port sees new line errors.
+    case MESS_LINEERR:
+      ShowStats(FALSE);
+      break;
       /// This application includes a custom message type: MESS_SERIAL.
-    case MESS_SERIAL:       // custom message: buf and count sent
+    case MESS_SERIAL:       // custom message: chars waiting in the Rx ring
       {
-        int i;
-        for (i=0;i<wParam;i++)
+        char *p;
+        int n,Total=0;
+        LONGLONG Time;
+        // the port may have been closed since this was posted
+        if (!Cur->Port)
+          break;
+        // a slice at a time, so busy ports take turns with each other.
+        // Characters go from the Rx ring straight into the raw history,
+        // once, and are read from there.
+        while (Total < RX_SLICE)
           {
-            AddChar(((char*)lParam)[i]);
-            RxFlag = TRUE;          // signal LED to go on.
-            // send char to log file
-            if (LogFile)
-              fputc(((char*)lParam)[i],LogFile);
-            // Add to binary window
-            AddBinaryChar(((char*)lParam)[i]);
+            p = RawReserve(Cur->Raw,&n);
+            if (!p)
+              break;
+            if (n > RX_SLICE - Total)
+              n = RX_SLICE - Total;
+            n = SerialPortReadStamped(Cur->Port,p,n,&Time);
+            if (n <= 0)
+              break;
+            RawCommit(Cur->Raw,n,Time);
+            Total += n;
+            AddChars(p,n);
+            if (CapActive(&Cur->Cap))
+              CapWrite(&Cur->Cap,p,n,Time,SerialPortTakeErrors(Cur->Port));
+            Cur->RxFlag = TRUE;          // signal LED to go on.
           }
+        // the log and the binary view read the history at their own pace
+        if (Total)
+          OnRawAdded();
+        // come back for the rest after other messages have been handled
+        if (SerialPortRxPending(Cur->Port))
+          PostMessage(hwnd,MESS_SERIAL,0,(LPARAM)Cur->Port);
+        ShowRxDropped(FALSE);
+        // WM_TIMER is starved while serial messages keep coming, so
+        // repaint from here when a frame is due.
+        if (Cur->RenderPending && GetTickCount() - Cur->LastRender >= RenderPeriod)
+          RenderDirty(hwnd);
       }
       break;
+      /// Also MESS_FOUND, sent by the search thread as it finds matches.
+    case MESS_FOUND:
+      InterlockedExchange(&Cur->SearchPosted,FALSE);
+      // wParam is set when the thread has finished, lParam tells which one
+      if (wParam && Cur->SearchThread && lParam == Cur->SearchGen)
+        {
+          WaitForSingleObject(Cur->SearchThread,INFINITE);
+          CloseHandle(Cur->SearchThread);
+          Cur->SearchThread = NULL;
+        }
+      ShowFindStatus();
+      if (Cur->FindPending)
+        FindNext();
+      break;
     case WM_DRAWITEM:
       if (wParam == IDM_STATUSBAR)
         DrawLEDs((DRAWITEMSTRUCT *)lParam);
@@ -505,20 +772,67 @@ LRESULT CALLBACK MainWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
  */
 LRESULT CALLBACK BinWndProc(HWND hwnd,UINT msg,WPARAM wParam,LPARAM lParam)
 {
+  TSession *Saved = Cur;
+  LRESULT r = 0;
+
+  if (msg == WM_NCCREATE)
+    {
+      // the session comes from IDM_BINARY
+      Cur = ((CREATESTRUCT *)lParam)->lpCreateParams;
+      Cur->Bin = hwnd;
+      SetWindowLongPtr(hwnd,GWLP_USERDATA,(LONG_PTR)Cur);
+    }
+  // the functions below work on Cur, like the session window's
+  Cur = (TSession *)GetWindowLongPtr(hwnd,GWLP_USERDATA);
+  if (!Cur)
+    {
+      Cur = Saved;
+      return DefWindowProc(hwnd,msg,wParam,lParam);
+    }
   switch (msg)
     {
     case WM_SIZE:
-        MoveWindow(hwndBinEdit, 0, 0, LOWORD(lParam), HIWORD(lParam), 1);
+      Cur->BinRows = HIWORD(lParam)/CharHt;
+      UpdateBin();
+      break;
+    case WM_PAINT:
+      PaintBin(hwnd);
+      break;
+    case WM_ERASEBKGND:
+      // PaintBin() fills every row
+      r = 1;
+      break;
+    case WM_VSCROLL:
+      OnBinVScroll(LOWORD(wParam));
+      break;
+    case WM_MOUSEWHEEL:
+      ScrollBin(Cur->BinTop - 3*GET_WHEEL_DELTA_WPARAM(wParam)/WHEEL_DELTA);
       break;
     case WM_DESTROY:
-        // Destroy edit window
-        DestroyWindow(hwndBinEdit);
-        hwndBin = 0;
+      Cur->Bin = NULL;
       break;
     default:
-      return DefWindowProc(hwnd,msg,wParam,lParam);
+      r = DefWindowProc(hwnd,msg,wParam,lParam);
     }
-  return 0;
+  Cur = Saved;
+  return r;
+}
+
+/**
+   Closes a session window.  Called for each window of the program by
+   EnumThreadWindows() when the user picks Exit.
+   @param hwnd Handle to a window.
+   @param lParam Unused.
+   @return TRUE, to go on to the next window.
+ */
+BOOL CALLBACK CloseSessionWnd(HWND hwnd,LPARAM lParam)
+{
+  char Class[40];
+
+  GetClassName(hwnd,Class,sizeof(Class));
+  if (!strcmp(Class,"funtermWndClass"))
+    PostMessage(hwnd,WM_CLOSE,0,0);
+  return TRUE;
 }
 
 /**
@@ -537,10 +851,12 @@ void SetMinMaxInfo(MINMAXINFO *mmi)
 
 /**
    This is the main entry into the application.  WinMain initializes everything,
-   and then executes a message loop until the application exits.
+   opens a session window, and then executes a message loop until the last
+   window is closed.
    @param hInstance Handle to application instance.
    @param hPrevInstance Always NULL.
    @param lpCmdLine String containing the command line used to launch the application.
+   Port numbers on it, like "3 4 COM7", open a window for each port.
    @param nCmdShow Specifies how the window is to be shown.  See WinMain in the
    Win32 help file.
    @return Zero on error, nonzero otherwise.
@@ -553,184 +869,217 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance,
   HDC DC;
   LOGFONT LogFont;
   SIZE Size;
+  int Refresh,Port;
+  BOOL Found;
+  TRegContents Reg;
+  TSession *s = NULL;
+  char *p;
 
   InitCommonControls();
   hInst = hInstance;
   if (!InitApplication())
     return 0;
   hAccelTable = LoadAccelerators(hInst,MAKEINTRESOURCE(IDACCEL));
-  if ((hwndMain = CreatefuntermWndClassWnd()) == (HWND)0)
-    return 0;
-
-  CreateSBar(hwndMain,"",2);
 
   // Load popup menu from resource
   PopupMenu = LoadMenu(hInst,MAKEINTRESOURCE(IDPOPUPMENU));
 
-  // read registry contents, config if no reg info found.
-  ReadReg();
-
-  // Open serial port, fill in status bar
-  if (RegContents.OpenOnStart && !OpenPort(RegContents.ComPort,
-                                           BaudRates[RegContents.Baud],
-                                           RegContents.HdwFlow,
-                                           hwndMain))
-    {
-      MessageBox(NULL,"Cannot open serial port!\n","Error",MB_OK|MB_ICONSTOP);
-      CloseSerialPort();
-      PostMessage(hwndMain,WM_COMMAND,IDM_CONFIG,0);
-      FillInStatus(stError);
-    }
-  else
-    {
-      if (SerialPortIsOpen())
-        FillInStatus(stRunning);
-      else
-        FillInStatus(stOff);
-    }
-
-  // draw LEDs
-  UpdateStatusBar(NULL, 0, SBT_OWNERDRAW);
-
   // init char drawing stuff
 
-  DC = GetDC(hwndMain);
+  DC = GetDC(NULL);
   font = GetStockObject(ANSI_FIXED_FONT);
   GetObject(font,sizeof(LOGFONT),&LogFont);
   LogFont.lfHeight = LogFont.lfHeight * 4/3; //-MulDiv(10, GetDeviceCaps(DC, LOGPIXELSY), 72);
   font = CreateFontIndirect(&LogFont);
   SelectObject(DC,font);
   GetTextExtentPoint32(DC,"A",1,&Size);
-  ReleaseDC(hwndMain,DC);
+  // don't repaint faster than the monitor can show it
+  Refresh = GetDeviceCaps(DC,VREFRESH);
+  if (Refresh > 1)
+    RenderPeriod = 1000 / Refresh;
+  ReleaseDC(NULL,DC);
 
   CharWd = Size.cx;
   CharHt = Size.cy;
 
-  ShowWindow(hwndMain,SW_SHOW);
+  // read registry contents, config if no reg info found.
+  Found = ReadReg();
+
+  // a window for each port on the command line, otherwise one for the
+  // port in the registry
+  for (p=lpCmdLine;*p;)
+    {
+      if (!strnicmp(p,"COM",3))
+        p += 3;
+      Port = strtol(p,&p,10);
+      if (Port >= 1 && Port <= 128)
+        {
+          Reg = RegContents;
+          Reg.ComPort = Port;
+          Reg.OpenOnStart = TRUE;
+          s = NewSession(&Reg,TRUE);
+        }
+      while (*p && !isspace(*p))
+        p++;
+      while (isspace(*p))
+        p++;
+    }
+  if (!s)
+    {
+      s = NewSession(&RegContents,TRUE);
+      if (!s)
+        return 0;
+      if (!Found && !FIXED_CONFIG_1)
+        // Pop up config dialog on first usage
+        PostMessage(s->Wnd,WM_COMMAND,IDM_CONFIG,0);
+    }
+
   while (GetMessage(&msg,NULL,0,0))
     {
+      if (hwndFind && IsDialogMessage(hwndFind,&msg))
+        continue;
+      if (hwndReplay && IsDialogMessage(hwndReplay,&msg))
+        continue;
       if (!TranslateAccelerator(msg.hwnd,hAccelTable,&msg))
         {
           TranslateMessage(&msg);
           DispatchMessage(&msg);
         }
     }
+  DestroyMenu(PopupMenu);
   return msg.wParam;
 }
 
 /**
-   Adds a character to the terminal display.  Called every time a character
-   is received from the serial port.  This function implements escape sequences.
-   See the main page for a description of escape sequences supported.
-   @param ch The character to add to the display.
-*/
-void AddChar(char ch)
+   Opens a session: a new main window with its own screen, scrollback and
+   serial port.
+   @param Reg Settings for the session.
+   @param Open If TRUE, the port is opened if Reg says to open it on
+   startup.  If FALSE, the comm setup dialog is shown, to pick a port.
+   @return The new session, or NULL if the window can't be created.
+ */
+TSession *NewSession(const TRegContents *Reg,BOOL Open)
 {
-  unsigned int x;
-
+  TSession *s,*Saved = Cur;
+
+  s = calloc(1,sizeof(TSession));
+  if (!s)
+    return NULL;
+  s->Reg = *Reg;
+  s->Follow = TRUE;
+  s->ScrnLineCount = 1;
+  s->LineLength = 80;
+  s->CurMatch = -1;
+  // the window owns the session from here, and frees it in WM_NCDESTROY
+  if (!CreatefuntermWndClassWnd(s))
+    return NULL;
 
-  if (EscProg != Idle)    // We're parsing escape sequence
+  // Open serial port, fill in status bar
+  Cur = s;
+  if (!Open)
     {
-      switch (EscProg)
-        {
-        case Ready:
-          switch (toupper(ch))
-            {
-            case 'T':
-              // Clear to EOL
-              Lines->Lines[Lines->CursY][Lines->CursX] = 0;
-              EscProg = Idle;
-              return;
-            case 'Y':
-              // Clear to EOF
-              Lines->Lines[Lines->CursY][Lines->CursX] = 0;
-              for(x=Lines->CursY;x<Lines->Count;x++)
-                Lines->Lines[x][0] = 0;
-              EscProg = Idle;
-              return;
-            case '.':
-              EscProg = CursorOnOff;
-              return;
-            case '=':
-              EscProg = CursPosX;
-              return;
-            default:
-              EscProg = Idle;         // kill the command sequence.
-              return;
-            }
-        case (CursorOnOff):
-          if (ch == '0')
-            Lines->Cursor = FALSE;
-          else
-            {
-              Lines->Cursor = TRUE;
-              InvalidateRect(hwndMain,NULL,FALSE);
-            }
-          EscProg = Idle;
-          return;
-        case (CursPosX):
-          SetCursY(Lines,ch - 0x20);
-          EscProg = CursPosY;
-          return;
-        case (CursPosY):
-          SetCursX(Lines,ch - 0x20);
-          EscProg = Idle;
-          return;
-        default:
-          EscProg = Idle;         // kill the command sequence.
-          return;
-        }
+      FillInStatus(stOff);
+      PostMessage(s->Wnd,WM_COMMAND,IDM_CONFIG,0);
+    }
+  else if (s->Reg.OpenOnStart && !OpenSessionPort())
+    {
+      MessageBox(s->Wnd,"Cannot open serial port!\n","Error",MB_OK|MB_ICONSTOP);
+      PostMessage(s->Wnd,WM_COMMAND,IDM_CONFIG,0);
+      FillInStatus(stError);
+    }
+  else
+    {
+      if (s->Port)
+        FillInStatus(stRunning);
+      else
+        FillInStatus(stOff);
     }
 
-  switch (ch)
+  // draw LEDs
+  UpdateStatusBar(NULL, 0, SBT_OWNERDRAW);
+  ShowSessionTitle(NULL);
+  ShowWindow(s->Wnd,SW_SHOW);
+  Cur = Saved;
+  return s;
+}
+
+/**
+   Opens the serial port of the session in Cur, with the settings in Cur->Reg.
+   @return TRUE if the port was opened.
+ */
+BOOL OpenSessionPort(void)
+{
+  SerialSetRxBufSize(Cur->Reg.RxBufMB*1024*1024);
+  SerialSetQueueSizes(Cur->Reg.RxQueueKB*1024,Cur->Reg.TxQueueKB*1024);
+  Cur->Port = SerialPortOpen(Cur->Reg.ComPort,
+                             BaudRates[Cur->Reg.Baud],
+                             Cur->Reg.HdwFlow,
+                             Cur->Wnd);
+  ShowSessionTitle(NULL);
+  if (!Cur->Port)
+    return FALSE;
+  memset(&Cur->LastStats,0,sizeof(Cur->LastStats));
+  SetTimer(Cur->Wnd,IDT_STATS,1000,NULL);
+  return TRUE;
+}
+
+/**
+   Closes the serial port of the session in Cur, if it is open.  Stops any
+   file send first, since that writes to the port.
+ */
+void CloseSessionPort(void)
+{
+  XferStop(&Cur->Xfer);
+  KillTimer(Cur->Wnd,IDT_STATS);
+  LogStats();
+  SerialPortClose(Cur->Port);
+  Cur->Port = NULL;
+  ShowSessionTitle(NULL);
+}
+
+/**
+   Sets the title of the session's window: the port, and a title set by the
+   host, if any.
+   @param Title Title from the host, or NULL to keep the one shown.
+ */
+void ShowSessionTitle(const char *Title)
+{
+  char s[VT_MAXOSC+40],Old[VT_MAXOSC+40];
+  char *t;
+  int n;
+
+  // keep the host's title, after the " - "
+  if (!Title)
     {
-    case (-1):
-      return;
-    case (0x1e):
-    case (0x18):
-      // Home position (??)
-      SetCursX(Lines,0);
-      SetCursY(Lines,0);
-      break;
-    case (0x1a):  // Control-z
-    case 12:      // Form-feed (cntrl-l)
-      // Clear Screen and home (cntrl-z)
-      ClearScreen();
-      break;
-    case (0x1b):
-      // Start escape sequence
-      EscProg = Ready;
-      break;
-    case 13:
-      SetCursX(Lines,0);
-      break;
-    case 10:
-      if (RegContents.CrLf)
-        // implied CR
-        SetCursX(Lines,0);
-      SetCursY(Lines,Lines->CursY+1);
-      break;
-    case 8:         // backspace
-      SetCursX(Lines,Lines->CursX - 1);
-      break;
-    case 9:         // tab
-      // Must add 8 spaces for tab
-      for (x=0;x<8;x++)
-        AddChar(' ');
-      SetCursX(Lines,(Lines->CursX + 8) % 8);
-      break;
-    default:
-      // check for word wrap
-      if (Lines->CursX >= LineLength -1)
-        {
-          // fake cr/lf
-          SetCursX(Lines,0);
-          SetCursY(Lines,Lines->CursY+1);
-        }
-      DrawChar(Lines->CursX,Lines->CursY,ch);
-      PushChar(Lines,ch);
-      break;
+      GetWindowText(Cur->Wnd,Old,sizeof(Old));
+      t = strstr(Old," - ");
+      Title = t ? t + 3 : "";
     }
+  n = Cur->Port ? sprintf(s,"FUNterm COM%d",Cur->Reg.ComPort) : sprintf(s,"FUNterm");
+  if (*Title)
+    sprintf(s + n," - %s",Title);
+  SetWindowText(Cur->Wnd,s);
+}
+
+/**
+   Adds received characters to the terminal display.  The screen model and the
+   escape sequence handling are in the terminal core, see TermWrite().
+   See the main page for a description of escape sequences supported.
+   @param buf Characters to add to the display.
+   @param len Number of characters.
+*/
+void AddChars(const char *buf,int len)
+{
+  TermWrite(Cur->Lines,buf,len);
+}
+
+/**
+   Adds a character to the terminal display.
+   @param ch The character to add to the display.
+*/
+void AddChar(char ch)
+{
+  AddChars(&ch,1);
 }
 
 /**
@@ -750,21 +1099,46 @@ void InitCommDialog(HWND wnd)
       sprintf(str,"COM%d",i+1);
       SendMessage(Control,LB_ADDSTRING, 0, (long)str);
     }
-  SendMessage(Control,LB_SETCURSEL, RegContents.ComPort-1, 0);
+  SendMessage(Control,LB_SETCURSEL, Cur->Reg.ComPort-1, 0);
 
 
   // init baud rate button
-  Control = GetDlgItem(wnd,ID_BAUD+RegContents.Baud);
+  Control = GetDlgItem(wnd,ID_BAUD+Cur->Reg.Baud);
   SendMessage(Control,BM_SETCHECK,BST_CHECKED,0);
 
   // init auto-open button
   Control = GetDlgItem(wnd,ID_CBOPEN);
-  SendMessage(Control,BM_SETCHECK,RegContents.OpenOnStart ? BST_CHECKED : BST_UNCHECKED,0);
+  SendMessage(Control,BM_SETCHECK,Cur->Reg.OpenOnStart ? BST_CHECKED : BST_UNCHECKED,0);
 
   // init flow control button
   Control = GetDlgItem(wnd,ID_CBFLOW);
-  SendMessage(Control,BM_SETCHECK,RegContents.HdwFlow ? BST_CHECKED : BST_UNCHECKED,0);
+  SendMessage(Control,BM_SETCHECK,Cur->Reg.HdwFlow ? BST_CHECKED : BST_UNCHECKED,0);
+
+  // init ADM mode button
+  Control = GetDlgItem(wnd,ID_CBADM);
+  SendMessage(Control,BM_SETCHECK,Cur->Reg.AdmMode ? BST_CHECKED : BST_UNCHECKED,0);
+
+  // init spill button
+  Control = GetDlgItem(wnd,ID_CBSPILL);
+  SendMessage(Control,BM_SETCHECK,Cur->Reg.SpillToDisk ? BST_CHECKED : BST_UNCHECKED,0);
+
+  // init Rx buffer and scrollback sizes
+  SetDlgItemInt(wnd,ID_RXBUF,Cur->Reg.RxBufMB,FALSE);
+  SetDlgItemInt(wnd,ID_SCROLLBACK,Cur->Reg.ScrollbackMB,FALSE);
 
+  // init driver queue sizes, 0 for sized from the baud rate
+  SetDlgItemInt(wnd,ID_RXQUEUE,Cur->Reg.RxQueueKB,FALSE);
+  SetDlgItemInt(wnd,ID_TXQUEUE,Cur->Reg.TxQueueKB,FALSE);
+
+  // init file send pacing
+  SetDlgItemInt(wnd,ID_CHARDELAY,Cur->Reg.CharDelay,FALSE);
+  SetDlgItemInt(wnd,ID_LINEDELAY,Cur->Reg.LineDelay,FALSE);
+
+  // init log settings
+  Control = GetDlgItem(wnd,ID_CBSTAMP);
+  SendMessage(Control,BM_SETCHECK,Cur->Reg.LogStamps ? BST_CHECKED : BST_UNCHECKED,0);
+  SetDlgItemInt(wnd,ID_LOGMB,Cur->Reg.LogMaxMB,FALSE);
+  SetDlgItemInt(wnd,ID_LOGMIN,Cur->Reg.LogRotateMin,FALSE);
 }
 
 /**
@@ -779,11 +1153,11 @@ void OnConfigComm(HWND wnd)
   int i;
 
   /// Closes and re-opens serial port if it is already open.
-  CloseSerialPort();
+  CloseSessionPort();
 
   // get com port number
   Control = GetDlgItem(wnd,ID_COMPORT);
-  RegContents.ComPort = SendMessage(Control, LB_GETCURSEL, 0, 0) + 1;
+  Cur->Reg.ComPort = SendMessage(Control, LB_GETCURSEL, 0, 0) + 1;
 
   // read baud rate button
   for (i=0;i<8;i++)
@@ -792,337 +1166,911 @@ void OnConfigComm(HWND wnd)
       if (SendMessage(Control,BM_GETCHECK,0,0) == BST_CHECKED)
         break;
     }
-  RegContents.Baud = i;
+  Cur->Reg.Baud = i;
 
   /// Saves config settings to registry.
   // auto-open button
   Control = GetDlgItem(wnd,ID_CBOPEN);
-  RegContents.OpenOnStart = SendMessage(Control,BM_GETCHECK,0,0);
+  Cur->Reg.OpenOnStart = SendMessage(Control,BM_GETCHECK,0,0);
 
   // init flow control button
   Control = GetDlgItem(wnd,ID_CBFLOW);
-  RegContents.HdwFlow = SendMessage(Control,BM_GETCHECK,0,0);
+  Cur->Reg.HdwFlow = SendMessage(Control,BM_GETCHECK,0,0);
+
+  // ADM mode button
+  Control = GetDlgItem(wnd,ID_CBADM);
+  Cur->Reg.AdmMode = SendMessage(Control,BM_GETCHECK,0,0);
+  VtSetMode(&Cur->Lines->Vt,Cur->Reg.AdmMode ? VT_ADM : VT_ANSI);
+
+  // Rx buffer size, 1-64 MB
+  i = GetDlgItemInt(wnd,ID_RXBUF,NULL,FALSE);
+  Cur->Reg.RxBufMB = i < 1 ? 1 : i > 64 ? 64 : i;
+
+  // driver queue sizes, 0-1024 KB
+  i = GetDlgItemInt(wnd,ID_RXQUEUE,NULL,FALSE);
+  Cur->Reg.RxQueueKB = i > 1024 ? 1024 : i;
+  i = GetDlgItemInt(wnd,ID_TXQUEUE,NULL,FALSE);
+  Cur->Reg.TxQueueKB = i > 1024 ? 1024 : i;
+
+  // Scrollback memory limit, 1-1024 MB
+  i = GetDlgItemInt(wnd,ID_SCROLLBACK,NULL,FALSE);
+  Cur->Reg.ScrollbackMB = i < 1 ? 1 : i > 1024 ? 1024 : i;
+
+  // spill old scrollback to disk button
+  Control = GetDlgItem(wnd,ID_CBSPILL);
+  Cur->Reg.SpillToDisk = SendMessage(Control,BM_GETCHECK,0,0);
+  SetupHistory();
+
+  // file send pacing, 0-10000 ms
+  i = GetDlgItemInt(wnd,ID_CHARDELAY,NULL,FALSE);
+  Cur->Reg.CharDelay = i > 10000 ? 10000 : i;
+  i = GetDlgItemInt(wnd,ID_LINEDELAY,NULL,FALSE);
+  Cur->Reg.LineDelay = i > 10000 ? 10000 : i;
+
+  // log settings, used by the next log started
+  Control = GetDlgItem(wnd,ID_CBSTAMP);
+  Cur->Reg.LogStamps = SendMessage(Control,BM_GETCHECK,0,0);
+  i = GetDlgItemInt(wnd,ID_LOGMB,NULL,FALSE);
+  Cur->Reg.LogMaxMB = i > 4096 ? 4096 : i;
+  i = GetDlgItemInt(wnd,ID_LOGMIN,NULL,FALSE);
+  Cur->Reg.LogRotateMin = i > 10080 ? 10080 : i;
+  SaveReg();
 
   /// Opens the serial port with the new settings.
-  PostMessage(hwndMain,WM_COMMAND,IDM_STARTCOMM,0);
+  PostMessage(Cur->Wnd,WM_COMMAND,IDM_STARTCOMM,0);
 }
 
 /**
-   Paints the main window's terminal control area.  Updates the status bar
-   if necessary.  If the window is minimized, the painting is suspended to save
-   CPU time. The cursor is also drawn by this function.  This function is called
-   in response to a WM_PAINT message.
+   Paints the part of the main window's terminal control area that needs it.
+   Updates the status bar if necessary.  If the window is minimized, the painting
+   is suspended to save CPU time.  This function is called in response to a
+   WM_PAINT message.
+
+   The terminal is kept rendered in a back buffer (see RenderDirty()), so all
+   this has to do is copy the update rectangle to the screen.  Drawing through
+   the back buffer also keeps the display from flashing.
    @param wnd Handle to dialog window.
 */
 void Paint(HWND wnd)
 {
   PAINTSTRUCT ps;
-  RECT R,T;
-  HBITMAP Bmp;                    // off-screen bitmap
-  HDC DC;
-  SIZE Size;
-  int i;
+  RECT *U;
 
   // tell statusbar to redraw if nec.
-  if (RxFlag || TxFlag)
+  if (Cur->RxFlag || Cur->TxFlag)
     UpdateStatusBar(NULL, 0, SBT_OWNERDRAW);
 
-  if (IsIconic(wnd))
-    {
-      // must do begin/end paint or WM_PAINTs will be
-      // continuously sent while window is minimized.
-      BeginPaint(wnd,&ps);
-      EndPaint(wnd,&ps);
-      // force the lines to scroll off screen if nec. (on resize shorter)
-      SetCursY(Lines,Lines->CursY);
-      return; // don't draw on minimized window
-    }
-
+  // must do begin/end paint or WM_PAINTs will be
+  // continuously sent while window is minimized.
   BeginPaint(wnd,&ps);
+  U = &ps.rcPaint;
+  if (Cur->BackDC && !IsIconic(wnd))
+    BitBlt(ps.hdc,U->left,U->top,U->right - U->left,U->bottom - U->top,
+           Cur->BackDC,U->left,U->top,SRCCOPY);
+  EndPaint(wnd,&ps);
+}
 
-  /** Painting is done by first drawing the screen to an off-screen bitmap, and
-      then copying the bitmap to the terminal control with a BitBlt() command.
-      Without this copying, the program flashes horribly.
-  */
-  // draw to off-screen bitmap
-  GetClientRect(wnd,&R);
-  Bmp = CreateCompatibleBitmap(ps.hdc,R.right,R.bottom);
-  DC = CreateCompatibleDC(ps.hdc);
-  SelectObject(DC,Bmp);
-  SelectObject(DC,font);
-
-  // clear bitmap
-  FillRect(DC,&R,GetStockObject(WHITE_BRUSH));
+/**
+   (Re)allocates the back buffer to match the main window's client area, and
+   renders the whole terminal into it.  Called in response to WM_SIZE.  Also
+   recalculates the number of lines on screen.
+   @param wnd Handle to main window.
+*/
+void ResizeBackBuffer(HWND wnd)
+{
+  RECT R,T;
+  HDC DC;
+  HBITMAP Bmp;
 
-  // draw border around term window.
-  GetWindowRect(hWndStatusbar,&T);
-  ScreenToClient(wnd,(POINT *)&T);
-  R.bottom = T.top;
-  DrawEdge(DC,&R,EDGE_SUNKEN,BF_RECT);
+  GetClientRect(wnd,&R);
+  if (R.right <= 0 || R.bottom <= 0)
+    return;                     // minimized, keep what we have
 
-  // draw lines
-  if (Lines->CursX)
-    GetTextExtentPoint32(DC,Lines->Lines[Lines->CursY],Lines->CursX,&Size);
-  else
-    {GetTextExtentPoint32(DC,"ABC",3,&Size);
-      Size.cx = 0;
+  // terminal area, excluding status bar
+  Cur->TermRect = R;
+  if (Cur->StatusBar)
+    {
+      GetWindowRect(Cur->StatusBar,&T);
+      ScreenToClient(wnd,(POINT *)&T);
+      Cur->TermRect.bottom = T.top;
     }
-  if (Size.cy)
-    ScrnLineCount = R.bottom/Size.cy;       // number of lines on screen
-  for(i=TopLine;i<Lines->Count;i++)
-    TextOut(DC,Margin,Margin+(i-TopLine)*Size.cy,Lines->Lines[i],strlen(Lines->Lines[i]));
+  Cur->ScrnLineCount = Cur->TermRect.bottom/CharHt;       // number of lines on screen
 
-  // draw cursor
-  if (Lines->Cursor)
+  if (!Cur->BackDC || R.right != Cur->BackWd || R.bottom != Cur->BackHt)
     {
-      int y;                 // y dim.
-      int x;                  // x dim of cursor
-      y = (Lines->CursY - TopLine + 1) * Size.cy + Margin - 2;
-      x = Size.cx + Margin;
-      MoveToEx(DC,x,y,NULL);
-      LineTo(DC,x+CharWd,y);
+      DC = GetDC(wnd);
+      if (!Cur->BackDC)
+        Cur->BackDC = CreateCompatibleDC(DC);
+      Bmp = CreateCompatibleBitmap(DC,R.right,R.bottom);
+      ReleaseDC(wnd,DC);
+      if (!Bmp)
+        return;
+      SelectObject(Cur->BackDC,Bmp);
+      if (Cur->BackBmp)
+        DeleteObject(Cur->BackBmp);
+      Cur->BackBmp = Bmp;
+      Cur->BackWd = R.right;
+      Cur->BackHt = R.bottom;
     }
 
-  // draw bitmap to screen
-  BitBlt(ps.hdc,0,0,R.right,R.bottom,DC,0,0,SRCCOPY);
-
-  DeleteDC(DC);
-  DeleteObject(Bmp);
-  EndPaint(wnd,&ps);
-
   // force the lines to scroll off screen if nec. (on resize shorter)
-  SetCursY(Lines,Lines->CursY);
+  if (Cur->Lines)
+    {
+      TermResize(Cur->Lines,Cur->LineLength,Cur->ScrnLineCount);
+      // fewer, if there was no memory for that many
+      Cur->ScrnLineCount = Cur->Lines->Height;
+      RenderDirty(wnd);
+    }
 }
 
-
 /**
-   Creates and initializes a TLines structure.  Includes the allocation of space for
-   the array of strings to be displayed.
-   @param Count Number of lines to be allocated.
-   @return Pointer to new TLines structure.
+   Frees the back buffer.
 */
-TLines *CreateLines(int Count)
+void DestroyBackBuffer(void)
 {
-  int i;
-  // create the struct.
-  TLines *Lines = malloc(sizeof(TLines));
-  memset(Lines,0,sizeof(TLines));
-  Lines->Count = 0;
-  Lines->Capacity = Count;
-  Lines->Cursor = TRUE;
-
-  // allocate ptr space
-  Lines->Lines = malloc(Count*sizeof(void*));
-  Lines->LineLen = malloc(Count*sizeof(int *));
-
-  // allocate string space
-  for (i=0;i<Count;i++)
-    {
-      Lines->Lines[i] = malloc(8);
-      Lines->Lines[i][0] = 0;         // asciiz terminate
-      Lines->LineLen[i] = 8;
-    }
-
-  return Lines;
+  if (Cur->BackDC)
+    DeleteDC(Cur->BackDC);
+  if (Cur->BackBmp)
+    DeleteObject(Cur->BackBmp);
+  Cur->BackDC = NULL;
+  Cur->BackBmp = NULL;
 }
 
 /**
-   De-allocates TLines structure.  Also de-allocates the lines of text allocated
-   by CreateLines().
-   @param Lines Pointer to TLines structure to destroy.
+   Gets the text of a line.  Lines are numbered through the scrollback history
+   and on into the screen: the history holds lines Base to Next-1, and screen
+   line y is number Next+y.  Hold HistLock while using the result, since the
+   search thread shares the history's read cache.
+   @param n Line number.
+   @param Len Receives the number of characters in the line.
+   @return Pointer to the characters, not NUL terminated, or NULL if there is
+   no such line.
 */
-void DestroyLines(TLines *Lines)
+const char *GetLine(long long n,int *Len)
 {
-  int i;
-
-  // free strings
-  for (i=0;i<Lines->Capacity;i++)
-    free(Lines->Lines[i]);
-
-  // free pointers
-  free(Lines->Lines);
-  free(Lines->LineLen);
+  THistory *h = Cur->History;
+
+  if (n < h->Next)
+    return HistLine(h,n,Len);
+  n -= h->Next;
+  if (n >= Cur->Lines->Count)
+    return NULL;
+  *Len = LineLen(Cur->Lines,n);
+  return LineText(Cur->Lines,n);
 }
 
 /**
-   Sets the current cursor's column position.  Manages the TLines structure
-   to move the cursor.
-   @param Lines Pointer to TLines structure.
-   @param x New column position, zero-based.
+   Sets the back buffer text colors for a character attribute.
+   @param Attr Character attribute, ATTR_BOLD etc.
 */
-void SetCursX(TLines *Lines,int x)
+void SetAttrColors(WORD Attr)
 {
-  int y = Lines->CursY;
-  char *p = Lines->Lines[y];
-  int z;
+  int fg = Attr & ATTR_FGSET ? Attr & ATTR_FG : 0;
+  int bg = Attr & ATTR_BGSET ? (Attr & ATTR_BG) >> 4 : 15;
 
-  if (x < 0) return;
-  if (x > 300) return;
-
-  // expand line if nec.
-  if (x+1 >= Lines->LineLen[y])
+  // bold shows as the bright version of a color
+  if ((Attr & ATTR_BOLD) && (Attr & ATTR_FGSET) && fg < 8)
+    fg += 8;
+  if (Attr & ATTR_REVERSE)
     {
-      p = realloc(p,x+10);
-      Lines->Lines[y] = p;
-      Lines->LineLen[y] = x+10;
+      SetTextColor(Cur->BackDC,Palette[bg]);
+      SetBkColor(Cur->BackDC,Palette[fg]);
     }
-
-  // add spaces if nec.
-  z = strlen(p);
-  while (z < x)
+  else
     {
-      p[z++] = ' ';
-      p[z] = 0;
+      SetTextColor(Cur->BackDC,Palette[fg]);
+      SetBkColor(Cur->BackDC,Palette[bg]);
     }
-
-  // redraw if cursor is visible and has moved.
-  if ((x != Lines->CursX) && Lines->Cursor)
-    InvalidateRect(hwndMain,NULL,FALSE);
-  Lines->CursX = x;
 }
 
-
 /**
-   Sets the current cursor's row position.  Manages the TLines structure
-   to move the cursor.  Allocates and de-allocates lines as necessary.
-   @param Lines Pointer to TLines structure.
-   @param y New column position, zero-based.
+   Draws part of one screen row into the back buffer, including the cursor if it
+   falls inside the span.
+   @param Row Row on screen, zero-based.  Shows line TopLine+Row.
+   @param x0 First column to draw.
+   @param x1 Column after the last one to draw, or ToEol.
+   @param R Receives the rectangle that was drawn, in client coordinates.
 */
-void SetCursY(TLines *Lines,int y)
+void RenderSpan(int Row,int x0,int x1,RECT *R)
 {
-  int NewCap,i;
-
-  if (y > 300) return;
-  if (y < 0) return;
+  int Len,Full,a,b,ms,me;
+  const char *p;
+  const WORD *Attr = NULL;
+  long long y = Cur->TopLine + Row - Cur->History->Next;   // line on screen
+
+  R->left = Margin + x0*CharWd;
+  R->right = Margin + x1*CharWd;
+  if (x1 == ToEol || R->right > Cur->TermRect.right - Margin)
+    R->right = Cur->TermRect.right - Margin;
+  R->top = Margin + Row*CharHt;
+  R->bottom = R->top + CharHt;
+  if (R->right <= R->left)
+    return;
 
-  if (y >= Lines->Capacity)
+  FillRect(Cur->BackDC,R,GetStockObject(WHITE_BRUSH));
+  p = GetLine(Cur->TopLine + Row,&Len);
+  if (!p)
+    return;
+  Full = Len;
+  if (Len > x1)
+    Len = x1;
+
+  // only screen lines have attributes, history is plain text
+  if (y >= 0 && y < Cur->Lines->Count)
+    Attr = LineAttr(Cur->Lines,y);
+  if (!Attr && Len > x0)
+    TextOut(Cur->BackDC,R->left,R->top,p+x0,Len-x0);
+  else
     {
-      // must re-alloc Line list
-      NewCap = y + 10;        // add a little more
-      // alloc new space
-      Lines->Lines = realloc(Lines->Lines,NewCap*sizeof(void*));
-      Lines->LineLen = realloc(Lines->LineLen,NewCap*sizeof(int*));
-      // create new strings
-      for (i=Lines->Capacity;i<NewCap;i++)
+      // draw each run of characters with the same attribute
+      for (a=x0;a<Len;a=b)
         {
-          Lines->Lines[i] = malloc(8);
-          Lines->Lines[i][0] = 0;         // asciiz terminate
-          Lines->LineLen[i] = 8;
+          for (b=a+1;b<Len && Attr[b] == Attr[a];b++)
+            ;
+          SetAttrColors(Attr[a]);
+          TextOut(Cur->BackDC,Margin + a*CharWd,R->top,p+a,b-a);
+          if (Attr[a] & ATTR_UNDERLINE)
+            {
+              MoveToEx(Cur->BackDC,Margin + a*CharWd,R->bottom - 1,NULL);
+              LineTo(Cur->BackDC,Margin + b*CharWd,R->bottom - 1);
+            }
         }
-      Lines->Capacity = NewCap;
-      Lines->Count = y + 1;
+      SetAttrColors(0);
     }
 
-  // redraw if cursor has moved.
-  if ((y != Lines->CursY) && Lines->Cursor)
-    InvalidateRect(hwndMain,NULL,FALSE);
-  Lines->CursY = y;
-
-  // adjust line count
-  if (y >= Lines->Count)
-    Lines->Count = y + 1;
-  SetCursX(Lines,Lines->CursX);   // force Y line to be padded if necessary.
-
-  // Remove lines if too many
-  if (Lines->Count > ScrnLineCount)
+  // highlight search matches, the selected one in a different color
+  if (Cur->ShowMatches)
     {
-      // move lines down
-      int x = Lines->Count+1 - ScrnLineCount;
-      // delete strings from top of list
-      for(i=0;i<x;i++)
-        free(Lines->Lines[i]);
-      // move pointers to bottom;
-      memmove(&(Lines->Lines[0]),&(Lines->Lines[x]),sizeof(void *)*(Lines->Capacity-x));
-      memmove(&(Lines->LineLen[0]),&(Lines->LineLen[x]),sizeof(int *)*(Lines->Capacity-x));
-      // create new lines at end
-      for(i=Lines->Capacity - x;i<Lines->Capacity;i++)
+      SetBkColor(Cur->BackDC,Cur->TopLine + Row == Cur->CurMatch ? RGB(255,160,64) : RGB(255,255,0));
+      for (a=0;a < Full && PatMatch(&Cur->Pattern,p,Full,a,&ms,&me);a = me > ms ? me : ms + 1)
         {
-          Lines->Lines[i] = malloc(8);
-          Lines->Lines[i][0] = 0;         // asciiz terminate
-          Lines->LineLen[i] = 8;
+          if (ms < x0)
+            ms = x0;
+          if (me > Len)
+            me = Len;
+          if (me > ms)
+            TextOut(Cur->BackDC,Margin + ms*CharWd,R->top,p+ms,me-ms);
         }
-      Lines->Count -= x;
-      SetCursY(Lines,Lines->CursY-x);
-      InvalidateRect(hwndMain,NULL,FALSE);
+      SetBkColor(Cur->BackDC,RGB(255,255,255));
+    }
+
+  // draw cursor
+  if (Cur->Lines->Cursor && y == Cur->Lines->CursY && Cur->Lines->CursX >= x0 && Cur->Lines->CursX < x1)
+    {
+      int cy = R->bottom - 2;                  // y dim.
+      int cx = Cur->Lines->CursX * CharWd + Margin; // x dim of cursor
+      MoveToEx(Cur->BackDC,cx,cy,NULL);
+      LineTo(Cur->BackDC,cx+CharWd,cy);
     }
 }
 
 /**
-   Adds a new character to the TLines structure.
-   @param Lines Pointer to TLines structure.
-   @param ch Character to add to display.
+   Renders the parts of lines marked by MarkDirty() into the back buffer, and
+   invalidates them so that Paint() copies them to the screen.  Called from
+   the render timer.
+   @param wnd Handle to main window.
 */
-void PushChar(TLines *Lines,char ch)
+void RenderDirty(HWND wnd)
 {
-  // add a char to list of lines
-  char *p;
-  int x = Lines->CursX;
-
-  // add the char
-  p = Lines->Lines[Lines->CursY];
-  if (!p[x])
-    p[x+1] = 0;                             // asciiz terminate
-  p[x] = ch;
+  RECT R;
+  int i,Row;
+
+  KillTimer(wnd,IDT_RENDER);
+  Cur->RenderPending = FALSE;
+  Cur->LastRender = GetTickCount();
+  if (Cur->BinDirty)
+    UpdateBin();
+  if (!Cur->BackDC)
+    return;
+  SelectObject(Cur->BackDC,font);
+  UpdateScrollBar();
 
-  SetCursX(Lines,Lines->CursX+1);
-  if (Lines->CursY >= Lines->Count)
-    Lines->Count = Lines->CursY+1;
+  EnterCriticalSection(&Cur->HistLock);
+  if (Cur->Lines->AllDirty)
+    {
+      // clear bitmap
+      R.left = R.top = 0;
+      R.right = Cur->BackWd;
+      R.bottom = Cur->BackHt;
+      FillRect(Cur->BackDC,&R,GetStockObject(WHITE_BRUSH));
+      // draw border around term window.
+      DrawEdge(Cur->BackDC,&Cur->TermRect,EDGE_SUNKEN,BF_RECT);
+      for (Row=0;Row<=Cur->ScrnLineCount;Row++)
+        RenderSpan(Row,0,ToEol,&R);
+      InvalidateRect(wnd,NULL,FALSE);
+    }
+  else
+    for (i=0;i<Cur->Lines->Count;i++)
+      {
+        // only the part of the screen that is in view
+        Row = Cur->History->Next + i - Cur->TopLine;
+        if (Cur->Lines->Dirty[i] && Row >= 0 && Row <= Cur->ScrnLineCount)
+          {
+            RenderSpan(Row,Cur->Lines->DirtyStart[i],Cur->Lines->DirtyEnd[i],&R);
+            InvalidateRect(wnd,&R,FALSE);
+          }
+      }
+  LeaveCriticalSection(&Cur->HistLock);
+  Cur->Lines->AllDirty = FALSE;
+  memset(Cur->Lines->Dirty,0,Cur->Lines->Rows);
+  UpdateWindow(wnd);
 }
 
 /**
-   Process an input key from OS.  Called in response to WM_CHAR message.
-   @param wnd Handle to window.
-   @param Key The character corresponding to the key pressed.
+   Scrolls the view of the scrollback history.
+   @param Top Number of the line to show at the top of the screen.  The view
+   is limited to what the history holds, and to the live screen at the bottom.
 */
-void DoKey(HWND wnd,int Key)
+void ScrollView(long long Top)
 {
-  PutSerialChar(Key);
-  TxFlag = TRUE;          // signal LED to go on.
+  THistory *h = Cur->History;
+
+  if (Top > h->Next)
+    Top = h->Next;
+  if (Top < h->Base)
+    Top = h->Base;
+  Cur->Follow = (Top == h->Next);
+  if (Top == Cur->TopLine)
+    return;
+  Cur->TopLine = Top;
+  Cur->Lines->AllDirty = TRUE;
+  RenderDirty(Cur->Wnd);
 }
 
 /**
-   Read config settings from registry.
+   Handles scroll bar actions.  Called in response to WM_VSCROLL.
+   @param Code Scroll bar request, SB_LINEUP etc.
 */
-void ReadReg(void)
+void OnVScroll(int Code)
 {
-  HKEY Key;
-  int Size;
+  SCROLLINFO si;
 
-  // default values
-  RegContents.ComPort = 1;
-  RegContents.Baud = 3;   // 9600 Baud
-  RegContents.OpenOnStart = FIXED_CONFIG_1 ? TRUE : FALSE;
-  RegContents.HdwFlow = FALSE;
-  RegContents.CrLf = FALSE;
+  switch (Code)
+    {
+    case SB_LINEUP:
+      ScrollView(Cur->TopLine - 1);
+      break;
+    case SB_LINEDOWN:
+      ScrollView(Cur->TopLine + 1);
+      break;
+    case SB_PAGEUP:
+      ScrollView(Cur->TopLine - Cur->ScrnLineCount);
+      break;
+    case SB_PAGEDOWN:
+      ScrollView(Cur->TopLine + Cur->ScrnLineCount);
+      break;
+    case SB_TOP:
+      ScrollView(Cur->History->Base);
+      break;
+    case SB_BOTTOM:
+      ScrollView(Cur->History->Next);
+      break;
+    case SB_THUMBTRACK:
+    case SB_THUMBPOSITION:
+      // the position in the message is only 16 bits, get the full one
+      si.cbSize = sizeof(si);
+      si.fMask = SIF_TRACKPOS;
+      GetScrollInfo(Cur->Wnd,SB_VERT,&si);
+      ScrollView(Cur->History->Base + si.nTrackPos);
+      break;
+    }
+}
 
-  // read params from registry
-  if (RegOpenKeyEx(HKEY_CURRENT_USER,"Software\\FUNterm",
-                   0,KEY_ALL_ACCESS,&Key) != ERROR_SUCCESS)
-  {
-      if (!FIXED_CONFIG_1)
-          // Pop up config dialog on first usage
-          PostMessage(hwndMain,WM_COMMAND,IDM_CONFIG,0);
-      return; // key doesn't exist, use defaults
-  }
+/**
+   Applies the session's scrollback settings to the history: the memory
+   limit, and spilling to a temporary file.  An existing spill file is kept if
+   spilling stays on.
+*/
+void SetupHistory(void)
+{
+  THistory *h = Cur->History;
+  char Path[MAX_PATH];
+  char Name[MAX_PATH];
 
-  Size = sizeof(int);
+  EnterCriticalSection(&Cur->HistLock);
+  if (Cur->Reg.SpillToDisk && !h->Spill)
+    {
+      if (!GetTempPath(sizeof(Path),Path) ||
+          !GetTempFileName(Path,"fun",0,Name) ||
+          !HistSpill(h,Name))
+        MessageBox(Cur->Wnd,"Cannot create scrollback spill file","Error",MB_OK|MB_ICONWARNING);
+    }
+  else if (!Cur->Reg.SpillToDisk && h->Spill)
+    HistSpill(h,NULL);
+
+  HistSetLimit(h,Cur->Reg.ScrollbackMB*1024*1024);
+  LeaveCriticalSection(&Cur->HistLock);
+  // the raw bytes for the binary view get the same limit
+  RawSetLimit(Cur->Raw,Cur->Reg.ScrollbackMB*1024*1024);
+  UpdateBin();
+  UpdateScrollBar();
+}
+
+/**
+   Sets the scroll bar to match the history size and the view position.
+   Called once per render, and only touches the scroll bar if something changed.
+*/
+void UpdateScrollBar(void)
+{
+  SCROLLINFO si;
+  THistory *h = Cur->History;
+
+  // lines may have been dropped from the history while we were looking at them
+  if (Cur->TopLine < h->Base)
+    Cur->TopLine = h->Base;
+
+  si.cbSize = sizeof(si);
+  si.fMask = SIF_RANGE|SIF_PAGE|SIF_POS;
+  si.nMin = 0;
+  si.nMax = (int)(h->Next - h->Base) + Cur->ScrnLineCount - 1;
+  si.nPage = Cur->ScrnLineCount;
+  si.nPos = (int)(Cur->TopLine - h->Base);
+  if (si.nMax == Cur->LastScroll.nMax && si.nPage == Cur->LastScroll.nPage &&
+      si.nPos == Cur->LastScroll.nPos)
+    return;
+  Cur->LastScroll = si;
+  SetScrollInfo(Cur->Wnd,SB_VERT,&si,TRUE);
+}
+
+/**
+   Win32 callback function for the modeless Find dialog.
+   @param hwnd Handle to dialog box sending message.
+   @param msg Windows message to handle.
+   @param wParam First message parameter.
+   @param lParam Second message parameter.
+   @return Non-zero if message is processed, zero if not processed.
+*/
+BOOL _stdcall FindDlgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+  TSession *Saved = Cur;
+  BOOL Result;
+
+  // the dialog works on the session it was opened from
+  if (!FindSession)
+    return 0;
+  Cur = FindSession;
+  Result = FindDialog(hwnd,msg,wParam,lParam);
+  Cur = Saved;
+  return Result;
+}
+
+/**
+   Handles the Find dialog's messages, for the session in Cur.
+   @param hwnd Handle to dialog box sending message.
+   @param msg Windows message to handle.
+   @param wParam First message parameter.
+   @param lParam Second message parameter.
+   @return Non-zero if message is processed, zero if not processed.
+*/
+BOOL FindDialog(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+  switch(msg)
+    {
+    case WM_CLOSE:
+      DestroyWindow(hwnd);
+      return 1;
+    case WM_DESTROY:
+      // stop highlighting, but keep the search for Find Next
+      hwndFind = NULL;
+      FindSession = NULL;
+      Cur->ShowMatches = FALSE;
+      Cur->Lines->AllDirty = TRUE;
+      RenderDirty(Cur->Wnd);
+      return 1;
+    case WM_COMMAND:
+      switch (LOWORD(wParam))
+        {
+        case IDOK:
+          if (StartSearch(hwnd))
+            FindNext();
+          return 1;
+        case IDCANCEL:
+          DestroyWindow(hwnd);
+          return 1;
+        }
+      break;
+    case WM_INITDIALOG:
+      SetDlgItemText(hwnd,ID_FINDTEXT,Cur->Pattern.Text);
+      SendMessage(GetDlgItem(hwnd,ID_CBREGEX),BM_SETCHECK,Cur->Pattern.Regex ? BST_CHECKED : BST_UNCHECKED,0);
+      SendMessage(GetDlgItem(hwnd,ID_CBCASE),BM_SETCHECK,Cur->PatternOK && !Cur->Pattern.NoCase ? BST_CHECKED : BST_UNCHECKED,0);
+      return 1;
+    }
+  return 0;
+}
+
+/**
+   Opens the Find dialog, or brings it to the front if it is already open.
+*/
+void OpenFind(void)
+{
+  // one Find dialog, for the session it was opened from
+  if (hwndFind && FindSession != Cur)
+    DestroyWindow(hwndFind);
+  FindSession = Cur;
+  if (!hwndFind)
+    hwndFind = CreateDialog(hInst,MAKEINTRESOURCE(IDD_FIND),Cur->Wnd,FindDlgProc);
+  SetFocus(GetDlgItem(hwndFind,ID_FINDTEXT));
+  Cur->ShowMatches = Cur->PatternOK;
+  ShowFindStatus();
+}
+
+/**
+   Search thread.  Works through the history from SearchPos, a batch of lines
+   at a time so the history lock is never held for long, and adds the numbers
+   of matching lines to Found.  Posts MESS_FOUND to the main window as matches
+   turn up, and when it catches up with the end of the history.
+   The thread works on its own session, not Cur, which belongs to the UI
+   thread.
+   @param lpParameter The session to search.  Its SearchGen tells this
+   thread from the ones before it.
+   @return Always zero.
+*/
+DWORD WINAPI SearchProc(LPVOID lpParameter)
+{
+  TSession *S = lpParameter;
+  LPARAM Gen = S->SearchGen;
+  THistory *h = S->History;
+  long long n,End,*p;
+  const char *s;
+  int len,a,b,Hits;
+  BOOL Done = FALSE;
+
+  while (!S->SearchStop && !Done)
+    {
+      Hits = 0;
+      EnterCriticalSection(&S->HistLock);
+      if (S->SearchPos < h->Base)
+        S->SearchPos = h->Base;
+      End = S->SearchPos + 4096;
+      if (End >= h->Next)
+        {
+          End = h->Next;
+          Done = TRUE;
+        }
+      for (n=S->SearchPos;n<End;n++)
+        {
+          s = HistLine(h,n,&len);
+          if (!s || !PatMatch(&S->Pattern,s,len,0,&a,&b))
+            continue;
+          if (S->NFound == S->FoundAlloc)
+            {
+              p = realloc(S->Found,(S->FoundAlloc + 4096)*sizeof(long long));
+              if (!p)
+                break;
+              S->Found = p;
+              S->FoundAlloc += 4096;
+            }
+          S->Found[S->NFound++] = n;
+          Hits++;
+        }
+      S->SearchPos = n;
+      LeaveCriticalSection(&S->HistLock);
+
+      if (Done)
+        PostMessage(S->Wnd,MESS_FOUND,1,Gen);
+      else if (Hits && !InterlockedExchange(&S->SearchPosted,TRUE))
+        PostMessage(S->Wnd,MESS_FOUND,0,0);
+    }
+  return 0;
+}
+
+/**
+   Starts the search thread on the history lines not searched yet.
+*/
+void ResumeSearch(void)
+{
+  DWORD id;
+
+  if (Cur->SearchThread || Cur->SearchPos >= Cur->History->Next)
+    return;
+  InterlockedExchange(&Cur->SearchStop,FALSE);
+  Cur->SearchGen++;
+  Cur->SearchThread = CreateThread(NULL,0,SearchProc,Cur,0,&id);
+}
+
+/**
+   Stops the search thread, and waits for it to finish.
+*/
+void StopSearch(void)
+{
+  if (Cur->SearchThread)
+    {
+      InterlockedExchange(&Cur->SearchStop,TRUE);
+      WaitForSingleObject(Cur->SearchThread,INFINITE);
+      CloseHandle(Cur->SearchThread);
+      Cur->SearchThread = NULL;
+    }
+  Cur->FindPending = FALSE;
+}
+
+/**
+   Reads the Find dialog and starts a new search if the pattern has changed.
+   The new search looks through the whole history, from the oldest line.
+   @param dlg Handle to the Find dialog.
+   @return TRUE if there is a valid search to go on with.
+*/
+BOOL StartSearch(HWND dlg)
+{
+  char Text[PAT_MAX];
+  BOOL Regex,NoCase;
+
+  GetDlgItemText(dlg,ID_FINDTEXT,Text,sizeof(Text));
+  Regex = SendMessage(GetDlgItem(dlg,ID_CBREGEX),BM_GETCHECK,0,0) == BST_CHECKED;
+  NoCase = SendMessage(GetDlgItem(dlg,ID_CBCASE),BM_GETCHECK,0,0) != BST_CHECKED;
+  if (Cur->PatternOK && !strcmp(Text,Cur->Pattern.Text) && Regex == Cur->Pattern.Regex && NoCase == Cur->Pattern.NoCase)
+    return TRUE;
+
+  StopSearch();
+  Cur->PatternOK = PatCompile(&Cur->Pattern,Text,Regex,NoCase);
+  Cur->NFound = 0;
+  Cur->CurMatch = Cur->TopLine - 1;       // start from the top of the view
+  Cur->SearchPos = Cur->History->Base;
+  Cur->ShowMatches = Cur->PatternOK;
+  Cur->Lines->AllDirty = TRUE;
+  RenderDirty(Cur->Wnd);
+  if (!Cur->PatternOK)
+    {
+      MessageBox(dlg,Regex ? "Bad regular expression" : "Nothing to find","Find",MB_OK|MB_ICONSTOP);
+      return FALSE;
+    }
+  ResumeSearch();
+  return TRUE;
+}
+
+/**
+   Finds the first match in the history after a line.  The caller must hold
+   HistLock.
+   @param n Line number to search after.
+   @return Line number of the match, or -1 if none has been found (yet).
+*/
+long long FoundAfter(long long n)
+{
+  int lo = 0,hi = Cur->NFound,mid;
+
+  if (n < Cur->History->Base)
+    n = Cur->History->Base - 1;
+  while (lo < hi)
+    {
+      mid = (lo + hi) / 2;
+      if (Cur->Found[mid] <= n)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return lo < Cur->NFound ? Cur->Found[lo] : -1;
+}
+
+/**
+   Selects the next match after the current one, scrolling it into view.
+   History matches come from the search thread; lines still on screen are
+   searched here.  If the search thread hasn't got that far, the selection
+   waits for it.  Wraps around to the oldest line after the last match.
+*/
+void FindNext(void)
+{
+  THistory *h = Cur->History;
+  long long n = -1;
+  int y,Pass,a,b;
+
+  if (!Cur->PatternOK)
+    {
+      OpenFind();
+      return;
+    }
+  Cur->FindPending = FALSE;
+  for (Pass=0;Pass<2 && n < 0;Pass++)
+    {
+      EnterCriticalSection(&Cur->HistLock);
+      n = FoundAfter(Cur->CurMatch);
+      LeaveCriticalSection(&Cur->HistLock);
+      if (n >= 0)
+        break;
+
+      // the rest of the history hasn't been searched yet, wait for it
+      if (Cur->SearchThread || Cur->SearchPos < h->Next)
+        {
+          ResumeSearch();
+          Cur->FindPending = TRUE;
+          ShowFindStatus();
+          return;
+        }
+
+      // then the screen
+      for (y=0;y<Cur->Lines->Count;y++)
+        if (h->Next + y > Cur->CurMatch && PatMatch(&Cur->Pattern,LineText(Cur->Lines,y),LineLen(Cur->Lines,y),0,&a,&b))
+          {
+            n = h->Next + y;
+            break;
+          }
+      if (n < 0)
+        Cur->CurMatch = -1;          // wrap around
+    }
+
+  if (n < 0)
+    {
+      MessageBeep(MB_ICONASTERISK);
+      ShowFindStatus();
+      return;
+    }
+
+  Cur->CurMatch = n;
+  Cur->ShowMatches = TRUE;
+  if (n < Cur->TopLine || n >= Cur->TopLine + Cur->ScrnLineCount)
+    ScrollView(n - Cur->ScrnLineCount/2);
+  Cur->Lines->AllDirty = TRUE;
+  RenderDirty(Cur->Wnd);
+  ShowFindStatus();
+}
+
+/**
+   Shows the number of matches found so far in the Find dialog.
+*/
+void ShowFindStatus(void)
+{
+  char s[100];
+
+  if (!hwndFind || FindSession != Cur)
+    return;
+  if (!Cur->PatternOK)
+    s[0] = 0;
+  else if (Cur->CurMatch >= 0 && !Cur->FindPending)
+    sprintf(s,"%d matches in history%s, at line %I64d",Cur->NFound,
+            Cur->SearchThread ? " so far" : "",Cur->CurMatch);
+  else
+    sprintf(s,"%d matches in history%s",Cur->NFound,Cur->SearchThread ? ", searching..." : "");
+  SetDlgItemText(hwndFind,ID_FINDSTATUS,s);
+}
+
+/**
+   Starts the render timer if it isn't running already.  Changes to the display
+   are collected until the timer fires, so the screen is repainted at most once
+   per monitor refresh no matter how fast characters arrive.
+*/
+void ScheduleRender(void)
+{
+  if (Cur->RenderPending)
+    return;
+  Cur->RenderPending = TRUE;
+  SetTimer(Cur->Wnd,IDT_RENDER,RenderPeriod,NULL);
+}
+
+/**
+   Terminal core callback: something changed on screen.
+   @param User Unused.
+*/
+void OnTermInvalidate(void *User)
+{
+  ScheduleRender();
+}
+
+/**
+   Terminal core callback: lines are scrolling off the top of the screen.  They
+   go to the scrollback history, and the view follows them if it is at the bottom.
+   @param User The session, the same as Cur.
+   @param Lines Pointer to TLines structure.
+   @param n Number of lines, starting at screen line 0.
+*/
+void OnTermScroll(void *User,TLines *Lines,int n)
+{
+  int i;
+
+  EnterCriticalSection(&Cur->HistLock);
+  for(i=0;i<n;i++)
+    HistAppend(Cur->History,LineText(Lines,i),LineLen(Lines,i));
+  LeaveCriticalSection(&Cur->HistLock);
+  if (Cur->Follow)
+    Cur->TopLine = Cur->History->Next;
+}
+
+/**
+   Terminal core callback: the host set the window title.
+   @param User Unused.
+   @param Title New title.
+*/
+void OnTermTitle(void *User,const char *Title)
+{
+  ShowSessionTitle(Title);
+}
+
+/**
+   Process an input key from OS.  Called in response to WM_CHAR message.
+   @param wnd Handle to window.
+   @param Key The character corresponding to the key pressed.
+*/
+void DoKey(HWND wnd,int Key)
+{
+  // typing brings the view back to the live screen
+  if (!Cur->Follow)
+    ScrollView(Cur->History->Next);
+  if (Cur->Port)
+    {
+      char c = Key;
+
+      SerialPortPut(Cur->Port,&c,1);
+      Cur->TxFlag = TRUE;          // signal LED to go on.
+    }
+}
+
+/**
+   Read config settings from registry into RegContents, the settings new
+   sessions start with.
+   @return FALSE if there are no settings in the registry yet, in which case
+   RegContents holds the defaults.
+*/
+BOOL ReadReg(void)
+{
+  HKEY Key;
+  int Size;
+
+  // default values
+  RegContents.ComPort = 1;
+  RegContents.Baud = 3;   // 9600 Baud
+  RegContents.OpenOnStart = FIXED_CONFIG_1 ? TRUE : FALSE;
+  RegContents.HdwFlow = FALSE;
+  RegContents.CrLf = FALSE;
+  RegContents.AdmMode = FALSE;
+  RegContents.RxBufMB = 4;
+  RegContents.RxQueueKB = 0;
+  RegContents.TxQueueKB = 0;
+  RegContents.ScrollbackMB = 64;
+  RegContents.SpillToDisk = TRUE;
+  RegContents.CharDelay = 0;
+  RegContents.LineDelay = 0;
+  RegContents.LogStamps = FALSE;
+  RegContents.LogMaxMB = 0;
+  RegContents.LogRotateMin = 0;
+
+  // read params from registry
+  if (RegOpenKeyEx(HKEY_CURRENT_USER,"Software\\FUNterm",
+                   0,KEY_ALL_ACCESS,&Key) != ERROR_SUCCESS)
+    return FALSE; // key doesn't exist, use defaults
+
+  Size = sizeof(int);
   RegQueryValueEx(Key,"ComPort",0,NULL,(LPBYTE)&RegContents.ComPort,(LPDWORD)&Size);
   RegQueryValueEx(Key,"Baud",0,NULL,(LPBYTE)&RegContents.Baud,(LPDWORD)&Size);
   RegQueryValueEx(Key,"OpenOnStart",0,NULL,(LPBYTE)&RegContents.OpenOnStart,(LPDWORD)&Size);
   RegQueryValueEx(Key,"HdwFlow",0,NULL,(LPBYTE)&RegContents.HdwFlow,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"AdmMode",0,NULL,(LPBYTE)&RegContents.AdmMode,(LPDWORD)&Size);
   RegQueryValueEx(Key,"CrLf",0,NULL,(LPBYTE)&RegContents.CrLf,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"RxBufMB",0,NULL,(LPBYTE)&RegContents.RxBufMB,(LPDWORD)&Size);
+  if (RegContents.RxBufMB < 1 || RegContents.RxBufMB > 64)
+    RegContents.RxBufMB = 4;
+  RegQueryValueEx(Key,"RxQueueKB",0,NULL,(LPBYTE)&RegContents.RxQueueKB,(LPDWORD)&Size);
+  if (RegContents.RxQueueKB < 0 || RegContents.RxQueueKB > 1024)
+    RegContents.RxQueueKB = 0;
+  RegQueryValueEx(Key,"TxQueueKB",0,NULL,(LPBYTE)&RegContents.TxQueueKB,(LPDWORD)&Size);
+  if (RegContents.TxQueueKB < 0 || RegContents.TxQueueKB > 1024)
+    RegContents.TxQueueKB = 0;
+  RegQueryValueEx(Key,"ScrollbackMB",0,NULL,(LPBYTE)&RegContents.ScrollbackMB,(LPDWORD)&Size);
+  if (RegContents.ScrollbackMB < 1 || RegContents.ScrollbackMB > 1024)
+    RegContents.ScrollbackMB = 64;
+  RegQueryValueEx(Key,"SpillToDisk",0,NULL,(LPBYTE)&RegContents.SpillToDisk,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"CharDelay",0,NULL,(LPBYTE)&RegContents.CharDelay,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"LineDelay",0,NULL,(LPBYTE)&RegContents.LineDelay,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"LogStamps",0,NULL,(LPBYTE)&RegContents.LogStamps,(LPDWORD)&Size);
+  RegQueryValueEx(Key,"LogMaxMB",0,NULL,(LPBYTE)&RegContents.LogMaxMB,(LPDWORD)&Size);
+  if (RegContents.LogMaxMB < 0 || RegContents.LogMaxMB > 4096)
+    RegContents.LogMaxMB = 0;
+  RegQueryValueEx(Key,"LogRotateMin",0,NULL,(LPBYTE)&RegContents.LogRotateMin,(LPDWORD)&Size);
+  if (RegContents.LogRotateMin < 0 || RegContents.LogRotateMin > 10080)
+    RegContents.LogRotateMin = 0;
 
   RegCloseKey(Key);
+  return TRUE;
 }
 
 /**
-   Saves config settings to registry.
+   Saves config settings to registry.  The settings of the current session
+   become the defaults for new ones.
 */
 void SaveReg(void)
 {
   HKEY Key;
   int x;
 
+  if (Cur)
+    RegContents = Cur->Reg;
+
   // store all of this in registry
   if (RegCreateKeyEx(HKEY_CURRENT_USER,"Software\\FUNterm",
                      0,0,0,KEY_ALL_ACCESS,NULL,&Key,(LPDWORD)&x) != ERROR_SUCCESS)
@@ -1132,7 +2080,18 @@ void SaveReg(void)
   RegSetValueEx(Key,"Baud",0,REG_DWORD,(BYTE *)&RegContents.Baud,sizeof(RegContents.Baud));
   RegSetValueEx(Key,"OpenOnStart",0,REG_DWORD,(BYTE *)&RegContents.OpenOnStart,sizeof(RegContents.OpenOnStart));
   RegSetValueEx(Key,"HdwFlow",0,REG_DWORD,(BYTE *)&RegContents.HdwFlow,sizeof(RegContents.HdwFlow));
+  RegSetValueEx(Key,"AdmMode",0,REG_DWORD,(BYTE *)&RegContents.AdmMode,sizeof(RegContents.AdmMode));
   RegSetValueEx(Key,"CrLf",0,REG_DWORD,(BYTE *)&RegContents.CrLf,sizeof(RegContents.CrLf));
+  RegSetValueEx(Key,"RxBufMB",0,REG_DWORD,(BYTE *)&RegContents.RxBufMB,sizeof(RegContents.RxBufMB));
+  RegSetValueEx(Key,"RxQueueKB",0,REG_DWORD,(BYTE *)&RegContents.RxQueueKB,sizeof(RegContents.RxQueueKB));
+  RegSetValueEx(Key,"TxQueueKB",0,REG_DWORD,(BYTE *)&RegContents.TxQueueKB,sizeof(RegContents.TxQueueKB));
+  RegSetValueEx(Key,"ScrollbackMB",0,REG_DWORD,(BYTE *)&RegContents.ScrollbackMB,sizeof(RegContents.ScrollbackMB));
+  RegSetValueEx(Key,"SpillToDisk",0,REG_DWORD,(BYTE *)&RegContents.SpillToDisk,sizeof(RegContents.SpillToDisk));
+  RegSetValueEx(Key,"CharDelay",0,REG_DWORD,(BYTE *)&RegContents.CharDelay,sizeof(RegContents.CharDelay));
+  RegSetValueEx(Key,"LineDelay",0,REG_DWORD,(BYTE *)&RegContents.LineDelay,sizeof(RegContents.LineDelay));
+  RegSetValueEx(Key,"LogStamps",0,REG_DWORD,(BYTE *)&RegContents.LogStamps,sizeof(RegContents.LogStamps));
+  RegSetValueEx(Key,"LogMaxMB",0,REG_DWORD,(BYTE *)&RegContents.LogMaxMB,sizeof(RegContents.LogMaxMB));
+  RegSetValueEx(Key,"LogRotateMin",0,REG_DWORD,(BYTE *)&RegContents.LogRotateMin,sizeof(RegContents.LogRotateMin));
 
   RegCloseKey(Key);
 }
@@ -1147,16 +2106,16 @@ void DrawLEDs(DRAWITEMSTRUCT *dis)
   RECT *R;
   HDC DC;
   HBITMAP RxLed,TxLed;
-  BOOL RedrawFlag = RxFlag || TxFlag;
+  BOOL RedrawFlag = Cur->RxFlag || Cur->TxFlag;
 
-  if (dis->hwndItem != hWndStatusbar)
+  if (dis->hwndItem != Cur->StatusBar)
     return;
 
   R = &dis->rcItem;
 
   // draw LEDs on
-  RxLed = LoadBitmap(hInst,MAKEINTRESOURCE(RxFlag ? IDB_REDLEDON : IDB_REDLEDOFF));
-  TxLed = LoadBitmap(hInst,MAKEINTRESOURCE(TxFlag ? IDB_GRNLEDON : IDB_GRNLEDOFF));
+  RxLed = LoadBitmap(hInst,MAKEINTRESOURCE(Cur->RxFlag ? IDB_REDLEDON : IDB_REDLEDOFF));
+  TxLed = LoadBitmap(hInst,MAKEINTRESOURCE(Cur->TxFlag ? IDB_GRNLEDON : IDB_GRNLEDOFF));
 
   DC = CreateCompatibleDC(dis->hDC);
   SelectObject(DC,RxLed);
@@ -1168,12 +2127,12 @@ void DrawLEDs(DRAWITEMSTRUCT *dis)
   DeleteObject(TxLed);
   DeleteObject(RxLed);
 
-  RxFlag = FALSE;
-  TxFlag = FALSE;
+  Cur->RxFlag = FALSE;
+  Cur->TxFlag = FALSE;
 
   if (RedrawFlag)
     // using PostMessage allows the LED to stay on for a bit before it's cleared.
-    PostMessage(hWndStatusbar,SB_SETTEXT,SBT_OWNERDRAW,0);
+    PostMessage(Cur->StatusBar,SB_SETTEXT,SBT_OWNERDRAW,0);
 }
 
 
@@ -1190,53 +2149,118 @@ void FillInStatus(int Status)
   switch(Status)
     {
     case stOff:
-      InitializeStatusBar(hWndStatusbar,2);
+      InitializeStatusBar(Cur->StatusBar,3);
       UpdateStatusBar("Serial port closed", 1, 0);
       break;
     case stError:
-      InitializeStatusBar(hWndStatusbar,2);
+      InitializeStatusBar(Cur->StatusBar,3);
       UpdateStatusBar("Unable to open serial port - check comm setup", 1, 0);
       break;
     case stRunning:
-      InitializeStatusBar(hWndStatusbar,6);
-      sprintf(s," COM%d",RegContents.ComPort);
-      UpdateStatusBar(s, 1, 0);
-      sprintf(s," %d",BaudRates[RegContents.Baud]);
+      InitializeStatusBar(Cur->StatusBar,10);
+      ShowStats(TRUE);
+      sprintf(s," COM%d",Cur->Reg.ComPort);
       UpdateStatusBar(s, 2, 0);
-      sprintf(s," N-8-1");
+      sprintf(s," %d",BaudRates[Cur->Reg.Baud]);
       UpdateStatusBar(s, 3, 0);
-      sprintf(s," %s Flow Control",RegContents.HdwFlow ? "Hardware" : "No");
+      sprintf(s," N-8-1");
       UpdateStatusBar(s, 4, 0);
-      sprintf(s," %s CR/LF",RegContents.CrLf ? "UNIX" : "DOS");
-      UpdateStatusBar(s, 5, 0);
-      break;
-    case stResize:  // resize the bar only - 5 panes for serial on, 2 panes for serial off
-      InitializeStatusBar(hWndStatusbar,SerialPortIsOpen() ? 6 : 2);
+      ShowFlowStatus();
+      sprintf(s," %s CR/LF",Cur->Reg.CrLf ? "UNIX" : "DOS");
+      UpdateStatusBar(s, 6, 0);
+      ShowRxDropped(TRUE);
       break;
+    case stResize:  // resize the bar only - 10 panes for serial on, 3 panes for serial off
+      InitializeStatusBar(Cur->StatusBar,Cur->Port ? 10 : 3);
+      return;
     }
+  // the replay has the last pane either way
+  ShowReplayProgress(TRUE);
 }
 
 /**
-   Draws a single character onto the main window's device context.  Uses the application's
-   font as initialized by WinMain.
-   @param x X location of character.
-   @param y Y location of character.
-   @param ch The character to draw.
+   Shows the Rx ring buffer overflow counters in the status bar.  These count
+   characters that were received but lost because the display could not keep up.
+   @param Force If FALSE, the status bar is only updated if the counters changed.
 */
-void DrawChar(int x,int y,char ch)
+void ShowRxDropped(BOOL Force)
 {
-  // draw one char at x and y
-  HDC DC;
+  unsigned long Dropped;
+  char s[100];
 
-  x = x * CharWd + Margin;
-  y = y * CharHt + Margin;
+  if (!Cur->Port)
+    return;
+  Dropped = SerialPortRxDropped(Cur->Port);
+  if (!Force && Dropped == Cur->LastDropped)
+    return;
+  Cur->LastDropped = Dropped;
+  sprintf(s," Rx lost: %lu bytes, %lu overflows",Dropped,SerialPortRxOverflows(Cur->Port));
+  UpdateStatusBar(s, 7, 0);
+}
 
-  DC = GetDC(hwndMain);
-  SelectObject(DC,font);
+/**
+   Shows the port's bytes in and out and its line error counts in the status
+   bar, next to the LEDs.  New line errors are also noted in the log file.
+   @param Force If FALSE, the status bar is only updated if the counts changed.
+*/
+void ShowStats(BOOL Force)
+{
+  TSerialStats St,*Last = &Cur->LastStats;
+  char s[160];
 
-  TextOut(DC,x,y,&ch,1);
+  if (!Cur->Port)
+    return;
+  SerialPortStats(Cur->Port,&St);
+  if (St.Overruns != Last->Overruns || St.Framing != Last->Framing ||
+      St.Parity != Last->Parity || St.QueueOverflows != Last->QueueOverflows)
+    LogStats();
+  else if (!Force && St.RxBytes/1024 == Last->RxBytes/1024 &&
+           St.TxBytes/1024 == Last->TxBytes/1024)
+    return;
+  *Last = St;
+  sprintf(s," In %I64u KB, out %I64u KB | overrun %lu, frame %lu, parity %lu, queue %lu",
+          St.RxBytes/1024,St.TxBytes/1024,St.Overruns,St.Framing,St.Parity,St.QueueOverflows);
+  UpdateStatusBar(s, 1, 0);
+}
 
-  ReleaseDC(hwndMain,DC);
+/**
+   Writes the port's byte and line error counts to the log file, if one is
+   open, as a line of its own between the received characters.
+*/
+void LogStats(void)
+{
+  TSerialStats St;
+
+  if (!LogActive(&Cur->Log) || !Cur->Port)
+    return;
+  SerialPortStats(Cur->Port,&St);
+  LogPrintf(&Cur->Log,"\r\n[COM%d: %I64u bytes in, %I64u out; %lu overrun, %lu framing, "
+          "%lu parity, %lu Rx queue overflow]\r\n",Cur->Reg.ComPort,St.RxBytes,St.TxBytes,
+          St.Overruns,St.Framing,St.Parity,St.QueueOverflows);
+}
+
+/**
+   Shows the flow control setting in the status bar, or that the other end
+   is holding off the transmitter with CTS.  Once it has, also shows the
+   total time it was held off.
+*/
+void ShowFlowStatus(void)
+{
+  unsigned long ms;
+  char s[100];
+
+  if (!Cur->Port)
+    return;
+  ms = SerialPortTxBlockedTime(Cur->Port);
+  if (!Cur->Reg.HdwFlow)
+    strcpy(s," No Flow Control");
+  else if (SerialPortTxBlocked(Cur->Port))
+    strcpy(s," Tx blocked by CTS");
+  else if (ms)
+    sprintf(s," Hardware, held %lu.%lu s",ms/1000,ms/100%10);
+  else
+    strcpy(s," Hardware Flow Control");
+  UpdateStatusBar(s, 5, 0);
 }
 
 /**
@@ -1280,8 +2304,8 @@ void CopyToClipboard(HWND wnd)
   // copies lines to clipboard
 
   // count btyes need to alloc
-  for(i=0;i<Lines->Count;i++)
-    Count += strlen(Lines->Lines[i]) + 2;   // cr/lf added.
+  for(i=0;i<Cur->Lines->Count;i++)
+    Count += LineLen(Cur->Lines,i) + 2;   // cr/lf added.
   Count += 10;    // just in case
 
   // alloc mem and copy data to mem
@@ -1293,10 +2317,10 @@ void CopyToClipboard(HWND wnd)
       return;
     }
 
-  for(i=0;i<Lines->Count;i++)
+  for(i=0;i<Cur->Lines->Count;i++)
     {
-      strcpy(p,Lines->Lines[i]);
-      p += strlen(Lines->Lines[i]);
+      memcpy(p,LineText(Cur->Lines,i),LineLen(Cur->Lines,i));
+      p += LineLen(Cur->Lines,i);
       *(p++) = '\r';
       *(p++) = '\n';
     }
@@ -1315,15 +2339,23 @@ void CopyToClipboard(HWND wnd)
 }
 
 /**
-   Pastes data from clipboard to serial port.
+   Pastes data from clipboard to serial port.  The characters are sent in
+   the background by the file sender, see xfer.c, so a long paste doesn't
+   hold up the window, and File/Cancel Send stops it.
    @param wnd Handle to display window.
 */
 void PasteFromClipboard(HWND wnd)
 {
   HGLOBAL Mem;
-  char *buf,*clip,*p;
+  char *buf,*clip;
   int Count;
 
+  if (!Cur->Port) return;
+  if (XferActive(&Cur->Xfer))
+    {
+      MessageBox(NULL,"A file is already being sent","Error",MB_OK|MB_ICONSTOP);
+      return;
+    }
   if (!OpenClipboard(wnd)) return;
   Mem = GetClipboardData(CF_TEXT);
 
@@ -1341,19 +2373,28 @@ void PasteFromClipboard(HWND wnd)
       return;
     }
   clip = GlobalLock(Mem);
-  buf = malloc(Count);
-  CopyMemory(buf,clip,Count);
-  GlobalUnlock(Mem);
+  buf = clip ? malloc(Count) : NULL;
+  if (buf)
+    CopyMemory(buf,clip,Count);
+  if (clip)
+    GlobalUnlock(Mem);
   CloseClipboard();
+  if (!buf)
+    {
+      MessageBox(NULL,"Not enough memory to paste","Error",MB_OK|MB_ICONSTOP);
+      return;
+    }
 
   // send chars to serial port
-  p = buf;
-  while(*p)
+  // up to the terminating NUL
+  if ((clip = memchr(buf,0,Count)) != NULL)
+    Count = clip - buf;
+  if (!Count || !XferStartBuf(&Cur->Xfer,buf,Count,Cur->Port,Cur->Wnd))
     {
-      PutSerialChar(*p++);
-      TxFlag = TRUE;          // signal LED to go on.
+      free(buf);
+      return;
     }
-  free(buf);
+  BeginSend();
 }
 
 /**
@@ -1370,33 +2411,21 @@ void ShowMenu(HWND wnd)
 
 
 /**
-   Clears all data from display.
-*/
-void ClearScreen(void)
-{
-  int x;
-
-  SetCursX(Lines,0);
-  SetCursY(Lines,0);
-  for(x=0;x<Lines->Count;x++)
-    Lines->Lines[x][0] = 0;
-  InvalidateRect(hwndMain,NULL,FALSE);
-}
-
-/**
-   Saves data displayed to file.  Does not scrollback.
+   Saves the scrollback history and the data displayed to file.
 */
 void SaveFile(void)
 {
   // save screen lines to file
   OPENFILENAME OpenStruct;
   FILE *file;
-  int i;
+  const char *p;
+  long long n;
+  int Len;
 
   // open file
   memset(&OpenStruct,0,sizeof(OPENFILENAME));
   OpenStruct.lStructSize = sizeof(OPENFILENAME);
-  OpenStruct.hwndOwner = hwndMain;
+  OpenStruct.hwndOwner = Cur->Wnd;
   OpenStruct.hInstance = NULL;
   OpenStruct.lpstrFilter = "";
   OpenStruct.lpstrCustomFilter = NULL;
@@ -1430,12 +2459,14 @@ void SaveFile(void)
       return;
     }
 
-  // write the screen contents to file
-  for (i=0;i<Lines->Count;i++)
+  // write the history and screen contents to file
+  EnterCriticalSection(&Cur->HistLock);
+  for (n=Cur->History->Base;(p = GetLine(n,&Len)) != NULL;n++)
     {
-      fputs(Lines->Lines[i],file);
+      fwrite(p,1,Len,file);
       fputs("\n",file);
     }
+  LeaveCriticalSection(&Cur->HistLock);
 
   fclose(file);
 
@@ -1443,18 +2474,20 @@ void SaveFile(void)
 
 /**
    Start logging input data to file.  Gets the filename from user first.
+   The log is written in the background, with the time stamp and new file
+   settings from the comm setup dialog.
 */
 void StartLog(void)
 {
   OPENFILENAME OpenStruct;
 
-  if (LogFile)
+  if (LogActive(&Cur->Log))
     return;
 
   // open file
   memset(&OpenStruct,0,sizeof(OPENFILENAME));
   OpenStruct.lStructSize = sizeof(OPENFILENAME);
-  OpenStruct.hwndOwner = hwndMain;
+  OpenStruct.hwndOwner = Cur->Wnd;
   OpenStruct.hInstance = NULL;
   OpenStruct.lpstrFilter = "";
   OpenStruct.lpstrCustomFilter = NULL;
@@ -1481,8 +2514,9 @@ void StartLog(void)
     }
 
   // open file
-  LogFile = fopen(FileName,"wb");
-  if (!LogFile)
+  if (!LogOpen(&Cur->Log,Cur->Raw,FileName,Cur->Reg.LogStamps,
+               (unsigned long long)Cur->Reg.LogMaxMB*1024*1024,
+               (DWORD)Cur->Reg.LogRotateMin*60000))
     {
       MessageBox(NULL,"Can't open file","Error",MB_OK|MB_ICONSTOP);
       return;
@@ -1491,30 +2525,303 @@ void StartLog(void)
 }
 
 /**
-   Closes the log file.
+   Closes the log file, after noting the port's totals in it.
 */
 void EndLog(void)
 {
 
-  if (LogFile)
-    fclose(LogFile);
-  LogFile = NULL;
+  LogStats();
+  LogClose(&Cur->Log);
+}
+
+/**
+   Starts a binary capture of the received characters.  Gets the filename
+   from the user first.
+*/
+void StartCapture(void)
+{
+  OPENFILENAME OpenStruct;
+
+  if (CapActive(&Cur->Cap))
+    return;
+
+  memset(&OpenStruct,0,sizeof(OPENFILENAME));
+  OpenStruct.lStructSize = sizeof(OPENFILENAME);
+  OpenStruct.hwndOwner = Cur->Wnd;
+  OpenStruct.lpstrFilter = "Captures (*.cap)\0*.cap\0All files\0*.*\0";
+  OpenStruct.lpstrFile = FileName;
+  OpenStruct.nMaxFile = 300;
+  OpenStruct.Flags = OFN_OVERWRITEPROMPT;
+  OpenStruct.lpstrDefExt = "cap";
+
+  if (!GetSaveFileName(&OpenStruct))
+    return;
+
+  // line errors from before the capture don't belong to it
+  if (Cur->Port)
+    SerialPortTakeErrors(Cur->Port);
+  if (!CapOpen(&Cur->Cap,FileName,Cur->Reg.ComPort,BaudRates[Cur->Reg.Baud]))
+    MessageBox(NULL,"Can't create capture file","Error",MB_OK|MB_ICONSTOP);
+}
+
+/**
+   Closes the capture file.
+*/
+void EndCapture(void)
+{
+  CapClose(&Cur->Cap);
+}
+
+/**
+   Opens a capture file, or any other file such as a log, and plays it back
+   into the terminal, with the Replay dialog to pause, move and change the
+   speed.  Gets the filename from the user first.  The characters go into
+   the raw history like received ones, so to the screen, the binary view
+   and an open log, but not to a capture.  A capture
+   starts at the speed it was captured; other files start at Max, so a big
+   log is taken in as fast as the terminal can.
+*/
+void StartReplay(void)
+{
+  OPENFILENAME OpenStruct;
+
+  memset(&OpenStruct,0,sizeof(OPENFILENAME));
+  OpenStruct.lStructSize = sizeof(OPENFILENAME);
+  OpenStruct.hwndOwner = Cur->Wnd;
+  OpenStruct.lpstrFilter = "Captures (*.cap)\0*.cap\0Logs (*.log, *.txt)\0*.log;*.txt\0All files\0*.*\0";
+  OpenStruct.lpstrFile = FileName;
+  OpenStruct.nMaxFile = 300;
+  OpenStruct.Flags = OFN_FILEMUSTEXIST;
+
+  if (!GetOpenFileName(&OpenStruct))
+    return;
+
+  EndReplay();
+  // a file that is not a capture comes in as if at the port's baud rate
+  if (!ReplayOpen(&Cur->Replay,FileName,1,BaudRates[Cur->Reg.Baud]/10))
+    {
+      MessageBox(NULL,"Can't open file","Error",MB_OK|MB_ICONSTOP);
+      return;
+    }
+  if (Cur->Replay.Raw)
+    ReplaySetSpeed(&Cur->Replay,0);
+  Cur->ReplayBytes = 0;
+  Cur->ReplayBusy = 0;
+  Cur->ReplayEnded = FALSE;
+  Cur->ReplaySeeking = FALSE;
+  EnableMenuItem(GetMenu(Cur->Wnd),IDM_REPLAY_STOP,MF_ENABLED);
+  SetTimer(Cur->Wnd,IDT_REPLAY,REPLAY_MS,NULL);
+
+  // one Replay dialog, for the session it was opened from
+  if (hwndReplay)
+    DestroyWindow(hwndReplay);
+  ReplaySession = Cur;
+  hwndReplay = CreateDialog(hInst,MAKEINTRESOURCE(IDD_REPLAY),Cur->Wnd,ReplayDlgProc);
+  ShowReplayProgress(TRUE);
+}
+
+/**
+   Stops a replay, if one is running, and closes its Replay dialog.
+*/
+void EndReplay(void)
+{
+  if (hwndReplay && ReplaySession == Cur)
+    DestroyWindow(hwndReplay);
+  if (!ReplayActive(&Cur->Replay))
+    return;
+  KillTimer(Cur->Wnd,IDT_REPLAY);
+  ReplayClose(&Cur->Replay);
+  EnableMenuItem(GetMenu(Cur->Wnd),IDM_REPLAY_STOP,MF_GRAYED);
+}
+
+/**
+   Win32 callback function for the modeless Replay dialog.
+   @param hwnd Handle to dialog box sending message.
+   @param msg Windows message to handle.
+   @param wParam First message parameter.
+   @param lParam Second message parameter.
+   @return Non-zero if message is processed, zero if not processed.
+*/
+BOOL _stdcall ReplayDlgProc(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+  TSession *Saved = Cur;
+  BOOL Result;
+
+  // the dialog works on the session it was opened from
+  if (!ReplaySession)
+    return 0;
+  Cur = ReplaySession;
+  Result = ReplayDialog(hwnd,msg,wParam,lParam);
+  Cur = Saved;
+  return Result;
+}
+
+/**
+   Handles the Replay dialog's messages, for the session in Cur.
+   @param hwnd Handle to dialog box sending message.
+   @param msg Windows message to handle.
+   @param wParam First message parameter.
+   @param lParam Second message parameter.
+   @return Non-zero if message is processed, zero if not processed.
+*/
+BOOL ReplayDialog(HWND hwnd, UINT msg, WPARAM wParam, LPARAM lParam)
+{
+  TReplay *r = &Cur->Replay;
+  int i;
+
+  switch(msg)
+    {
+    case WM_CLOSE:
+      EndReplay();
+      ShowReplayProgress(TRUE);
+      return 1;
+    case WM_DESTROY:
+      hwndReplay = NULL;
+      ReplaySession = NULL;
+      return 1;
+    case WM_HSCROLL:
+      // move when the slider is let go, not all the way while it is dragged
+      if (LOWORD(wParam) != TB_ENDTRACK)
+        Cur->ReplaySeeking = TRUE;
+      else
+        {
+          Cur->ReplaySeeking = FALSE;
+          i = SendDlgItemMessage(hwnd,ID_RSEEK,TBM_GETPOS,0,0);
+          ReplaySeek(r,r->Size*i/SEEK_STEPS);
+          Cur->ReplayEnded = FALSE;
+          SetTimer(Cur->Wnd,IDT_REPLAY,REPLAY_MS,NULL);
+          ShowReplayProgress(TRUE);
+        }
+      return 1;
+    case WM_COMMAND:
+      i = LOWORD(wParam);
+      if (i == ID_RPAUSE)
+        {
+          ReplayPause(r,!r->Paused);
+          SetDlgItemText(hwnd,ID_RPAUSE,r->Paused ? "Play" : "Pause");
+          ShowReplayProgress(TRUE);
+          return 1;
+        }
+      if (i >= ID_RSPEED && i < ID_RSPEED+4)
+        {
+          ReplaySetSpeed(r,ReplaySpeeds[i-ID_RSPEED]);
+          return 1;
+        }
+      if (i == IDCANCEL)
+        {
+          EndReplay();
+          ShowReplayProgress(TRUE);
+          return 1;
+        }
+      break;
+    case WM_INITDIALOG:
+      SendDlgItemMessage(hwnd,ID_RSEEK,TBM_SETRANGE,FALSE,MAKELONG(0,SEEK_STEPS));
+      for (i=0;i<3 && ReplaySpeeds[i] != r->Speed;i++)
+        ;
+      SendDlgItemMessage(hwnd,ID_RSPEED+i,BM_SETCHECK,BST_CHECKED,0);
+      return 1;
+    }
+  return 0;
+}
+
+/**
+   Feeds the replay to the terminal, like MESS_SERIAL.  Called from the
+   replay timer.  At Max speed it goes on for REPLAY_BUDGET ms a tick, and
+   the screen is only repainted on the render timer, so the time goes to
+   taking the characters in; otherwise it takes up to RX_SLICE bytes of what
+   is due.  The time spent is counted for the MB/s.
+*/
+void ReplayTick(void)
+{
+  LARGE_INTEGER t0,t;
+  LONGLONG Budget = Cur->Replay.Freq*REPLAY_BUDGET/1000;
+  const char *p;
+  DWORD Flags;
+  int n=0,Total=0;
+
+  QueryPerformanceCounter(&t0);
+  t = t0;
+  while ((Cur->Replay.Speed ? Total < RX_SLICE : t.QuadPart - t0.QuadPart < Budget) &&
+         (n = ReplayRead(&Cur->Replay,&p,&Flags)) > 0)
+    {
+      Total += n;
+      RawAppend(Cur->Raw,p,n,t.QuadPart);
+      AddChars(p,n);
+      QueryPerformanceCounter(&t);
+    }
+  if (Total)
+    OnRawAdded();
+  Cur->ReplayBytes += Total;
+  Cur->ReplayBusy += t.QuadPart - t0.QuadPart;
+  if (Total)
+    Cur->RxFlag = TRUE;          // signal LED to go on.
+  if (n < 0)
+    {
+      // stay open at the end, to move back or read the MB/s
+      KillTimer(Cur->Wnd,IDT_REPLAY);
+      Cur->ReplayEnded = TRUE;
+      ShowReplayProgress(TRUE);
+    }
+  else
+    ShowReplayProgress(FALSE);
+  // the replay timer can keep the render timer waiting
+  if (Cur->RenderPending && GetTickCount() - Cur->LastRender >= RenderPeriod)
+    RenderDirty(Cur->Wnd);
+}
+
+/**
+   Shows how far the replay has got, and how fast the terminal took it in,
+   in the last pane of the status bar, which is the replay's own, and in the
+   Replay dialog.
+   @param Force TRUE to show it now, FALSE to show it only if REPLAY_SHOW ms
+   have passed since the last time.
+*/
+void ShowReplayProgress(BOOL Force)
+{
+  TReplay *r = &Cur->Replay;
+  unsigned long long Pos;
+  double Rate;
+  int Pct,Part = Cur->Port ? 9 : 2;
+  char s[100];
+
+  if (!ReplayActive(r))
+    {
+      UpdateStatusBar("", Part, 0);
+      return;
+    }
+  if (!Force && GetTickCount() - Cur->ReplayShown < REPLAY_SHOW)
+    return;
+  Cur->ReplayShown = GetTickCount();
+  Pos = ReplayPos(r);
+  Pct = (int)(Pos*100/r->Size);
+  Rate = Cur->ReplayBusy ? Cur->ReplayBytes/1048576.0*r->Freq/Cur->ReplayBusy : 0;
+  sprintf(s," Replay %d%%, %.1f MB/s",Pct,Rate);
+  UpdateStatusBar(s, Part, 0);
+
+  if (!hwndReplay || ReplaySession != Cur)
+    return;
+  sprintf(s,"%s%I64u of %I64u MB (%d%%), %.1f MB/s",
+          Cur->ReplayEnded ? "End, " : r->Paused ? "Paused, " : "",
+          Pos/1048576,r->Size/1048576,Pct,Rate);
+  SetDlgItemText(hwndReplay,ID_RSTATUS,s);
+  if (!Cur->ReplaySeeking)
+    SendDlgItemMessage(hwndReplay,ID_RSEEK,TBM_SETPOS,TRUE,(LPARAM)(Pos*SEEK_STEPS/r->Size));
 }
 
 /**
-   Sends an input file to serial port.  Gets filename from user.
+   Sends an input file to serial port.  Gets filename from user, and starts
+   the background file sender.  Progress is shown in the status bar, and
+   File/Cancel Send stops it.
 */
 void SendFile(void)
 {
 
   OPENFILENAME OpenStruct;
-  FILE *file;
-  int ch;
 
   // open file
   memset(&OpenStruct,0,sizeof(OPENFILENAME));
   OpenStruct.lStructSize = sizeof(OPENFILENAME);
-  OpenStruct.hwndOwner = hwndMain;
+  OpenStruct.hwndOwner = Cur->Wnd;
   OpenStruct.hInstance = NULL;
   OpenStruct.lpstrFilter = "";// "Cfg files\0" "*.cfg\0" "\0" "\0";
   OpenStruct.lpstrCustomFilter = NULL;
@@ -1540,48 +2847,211 @@ void SendFile(void)
       return;
     }
 
-  // load from file
-  file = fopen(FileName,"rb");
-  if (!file)
-    {
-      MessageBox(NULL,"Can't open file","Error",MB_OK|MB_ICONSTOP);
-      return;
-    }
+  // the rest happens in the background, see xfer.c
+  if (!Cur->Port)
+    MessageBox(NULL,"Serial port is not open","Error",MB_OK|MB_ICONSTOP);
+  else if (!XferStart(&Cur->Xfer,FileName,Cur->Port,Cur->Reg.CharDelay,Cur->Reg.LineDelay,Cur->Wnd))
+    MessageBox(NULL,"A file is already being sent","Error",MB_OK|MB_ICONSTOP);
+  else
+    BeginSend();
+}
 
-  // read the chars, send to port
-  while ((ch = fgetc(file)) >= 0)
+/**
+   Starts showing the progress of a file send or paste, once the file sender
+   is running, and lets File/Cancel Send stop it.
+*/
+void BeginSend(void)
+{
+  EnableMenuItem(GetMenu(Cur->Wnd),IDM_CANCELSEND,MF_ENABLED);
+  SetTimer(Cur->Wnd,IDT_XFER,250,NULL);
+  ShowXferProgress(-1);
+}
+
+/**
+   Cleans up after a file send or paste, when MESS_XFER arrives, and shows
+   how it went.
+   @param Result XFER_DONE, XFER_CANCELLED or XFER_ERROR.
+*/
+void EndSend(int Result)
+{
+  KillTimer(Cur->Wnd,IDT_XFER);
+  XferStop(&Cur->Xfer);
+  EnableMenuItem(GetMenu(Cur->Wnd),IDM_CANCELSEND,MF_GRAYED);
+  ShowXferProgress(Result);
+  if (Result == XFER_ERROR)
+    MessageBox(NULL,"Send failed.  The file can't be read, or the serial port "
+               "stopped sending; check flow control.","Error",MB_OK|MB_ICONSTOP);
+}
+
+/**
+   Shows the progress of the file send or paste in the status bar: bytes sent, the
+   percentage, and the rate.
+   @param Result -1 while the send is running, otherwise how it ended.
+*/
+void ShowXferProgress(int Result)
+{
+  static const char *Verb[] = {"Sent","Cancelled,","Failed,"};
+  unsigned long long Sent,Size;
+  DWORD ms;
+  char s[100];
+
+  XferProgress(&Cur->Xfer,&Sent,&Size,&ms);
+  sprintf(s," %s %I64u of %I64u KB (%d%%), %lu bytes/s",Result < 0 ? "Sending" : Verb[Result],
+          Sent/1024,Size/1024,Size ? (int)(Sent*100/Size) : 100,
+          ms ? (unsigned long)(Sent*1000/ms) : 0UL);
+  UpdateStatusBar(s, 8, 0);
+}
+
+/**
+   Tells the readers of the raw history that characters were added: wakes
+   the log writer if plenty are waiting, and has the binary view brought up
+   to date along with the screen, by RenderDirty().
+*/
+void OnRawAdded(void)
+{
+  LogPoke(&Cur->Log);
+  if (Cur->Bin)
     {
-      PutSerialChar(ch);
-      TxFlag = TRUE;          // signal LED to go on.
+      Cur->BinDirty = TRUE;
+      ScheduleRender();
     }
-
-  fclose(file);
 }
 
+/**
+   Brings the binary view up to date with the raw history: follows new rows
+   if it is at the bottom, and sets the scroll bar.  The rows in view are
+   drawn by PaintBin().
+*/
+void UpdateBin(void)
+{
+  TRawHist *h = Cur->Raw;
+  long long First = h->Base/RAW_ROW;
+  long long Rows = (h->End + RAW_ROW-1)/RAW_ROW;
+  SCROLLINFO si;
+
+  Cur->BinDirty = FALSE;
+  if (!Cur->Bin)
+    return;
+  if (Cur->BinFollow || Cur->BinTop > Rows - Cur->BinRows)
+    Cur->BinTop = Rows - Cur->BinRows;
+  if (Cur->BinTop < First)
+    Cur->BinTop = First;
+  si.cbSize = sizeof(si);
+  si.fMask = SIF_RANGE|SIF_PAGE|SIF_POS;
+  si.nMin = 0;
+  si.nMax = Rows > First ? (int)(Rows - First - 1) : 0;
+  si.nPage = Cur->BinRows;
+  si.nPos = (int)(Cur->BinTop - First);
+  SetScrollInfo(Cur->Bin,SB_VERT,&si,TRUE);
+  InvalidateRect(Cur->Bin,NULL,FALSE);
+}
 
 /**
-   Add a character to the binary viewer window.
+   Scrolls the binary view.
+   @param Top Row of the raw history to show at the top.  Limited to what
+   the history holds.
 */
-void AddBinaryChar(char ch)
+void ScrollBin(long long Top)
 {
-    static int ndx;
-    char str[5];
+  Cur->BinFollow = Top >= (long long)((Cur->Raw->End + RAW_ROW-1)/RAW_ROW) - Cur->BinRows;
+  Cur->BinTop = Top;
+  UpdateBin();
+}
 
-    if (!hwndBin)
-        return;
+/**
+   Handles the binary view's scroll bar.  Called in response to WM_VSCROLL.
+   @param Code Scroll bar request, SB_LINEUP etc.
+*/
+void OnBinVScroll(int Code)
+{
+  SCROLLINFO si;
 
-    // Print 16 chars wide
-    if (++ndx == 16)
+  switch (Code)
     {
-        SendMessage(hwndBinEdit, WM_CHAR, '\r', 0);
-        ndx = 0;
+    case SB_LINEUP:
+      ScrollBin(Cur->BinTop - 1);
+      break;
+    case SB_LINEDOWN:
+      ScrollBin(Cur->BinTop + 1);
+      break;
+    case SB_PAGEUP:
+      ScrollBin(Cur->BinTop - Cur->BinRows);
+      break;
+    case SB_PAGEDOWN:
+      ScrollBin(Cur->BinTop + Cur->BinRows);
+      break;
+    case SB_TOP:
+      ScrollBin(0);
+      break;
+    case SB_BOTTOM:
+      ScrollBin(Cur->Raw->End/RAW_ROW + 1);
+      break;
+    case SB_THUMBTRACK:
+    case SB_THUMBPOSITION:
+      // the position in the message is only 16 bits, get the full one
+      si.cbSize = sizeof(si);
+      si.fMask = SIF_TRACKPOS;
+      GetScrollInfo(Cur->Bin,SB_VERT,&si);
+      ScrollBin(Cur->Raw->Base/RAW_ROW + si.nTrackPos);
+      break;
     }
-    // Convert to ch-ch-space
-    sprintf(str, "%02X ", ch);
-    SendMessage(hwndBinEdit, WM_CHAR, str[0], 0);
-    SendMessage(hwndBinEdit, WM_CHAR, str[1], 0);
-    SendMessage(hwndBinEdit, WM_CHAR, str[2], 0);
+}
+
+/**
+   Paints the binary view: for each row in view, the number of its first
+   byte, when it came in, and its bytes in hex and as characters.  Only the
+   rows being painted are read from the raw history, so the view costs the
+   same however much has been received.
+   @param wnd Handle to the binary view window.
+*/
+void PaintBin(HWND wnd)
+{
+  TRawHist *h = Cur->Raw;
+  PAINTSTRUCT ps;
+  RECT C,R;
+  unsigned long long Pos;
+  const unsigned char *p;
+  LONGLONG Time;
+  char s[BIN_WIDTH+8];
+  int i,n,len,Row;
 
+  BeginPaint(wnd,&ps);
+  SelectObject(ps.hdc,font);
+  SetTextColor(ps.hdc,RGB(0,0,0));
+  SetBkColor(ps.hdc,RGB(255,255,255));
+  GetClientRect(wnd,&C);
+  for (Row=0;Row*CharHt < C.bottom;Row++)
+    {
+      R.left = 0;
+      R.right = C.right;
+      R.top = Row*CharHt;
+      R.bottom = R.top + CharHt;
+      if (R.bottom <= ps.rcPaint.top || R.top >= ps.rcPaint.bottom)
+        continue;
+      Pos = (Cur->BinTop + Row)*RAW_ROW;
+      p = (const unsigned char *)RawPeek(h,Pos,&n);
+      len = 0;
+      if (p)
+        {
+          if (n > RAW_ROW)
+            n = RAW_ROW;
+          len = sprintf(s,"%010I64X  ",Pos);
+          Time = RawTime(h,Pos);
+          len += Time ? RawStamp(h,Time,s+len) : sprintf(s+len,"%15s","");
+          len += sprintf(s+len,"  ");
+          for (i=0;i<RAW_ROW;i++)
+            if (i < n)
+              len += sprintf(s+len,"%02X ",p[i]);
+            else
+              len += sprintf(s+len,"   ");
+          s[len++] = ' ';
+          for (i=0;i<n;i++)
+            s[len++] = p[i] >= ' ' && p[i] < 127 ? p[i] : '.';
+        }
+      // opaque, so rows past the end are cleared too
+      ExtTextOut(ps.hdc,0,R.top,ETO_OPAQUE,&R,s,len,NULL);
+    }
+  EndPaint(wnd,&ps);
 }
 
 /**
@@ -25,25 +25,23 @@
 #define _TFUNTERM_H_ID_
 
 #include <windows.h>
+#include <stdio.h>
+#include "history.h"
+#include "term.h"
+#include "search.h"
+#include "serial.h"
+#include "xfer.h"
+#include "logfile.h"
+#include "capture.h"
+#include "rawhist.h"
+
+#define MESS_FOUND (WM_USER+2)  ///< Custom windows message ID for search results.
 /**
    @file funterm.h This file contains definitions used by FUNterm.
     @addtogroup term
     @{
  */
 
-// Defines
-/** Contains the state of the display.  This structure describes the current
-    state of the display - which characters are displayed, and the cursor
-    position and state.
-*/
-typedef struct {
-  char **Lines;		///< Pointer to the array of char pointers (lines of text)
-  int Count;		///< Number of lines in display.
-  int Capacity;		///< Allocated number of lines.
-  int *LineLen;		///< Pointer to array of line lengths.
-  int CursX,CursY;	///< Current cursor position.
-  BOOL Cursor;		///< On/off state of cursor.
-} TLines;
 /**
    Contains the items stored in the system registry.  These are stored under 
 the registry key HKEY_CURRENT_USER\\Software\\FUNterm.
@@ -53,34 +51,99 @@ typedef struct {
   int Baud;		    ///< Baud rate of serial port the last time it was opened.
   BOOL OpenOnStart;         ///< Should the port be opened on program startup?  1 = YES, 0 = NO.
   BOOL HdwFlow;		    ///< Should hardware flow control used?  1 = YES, 0 = NO.
+  BOOL AdmMode;             ///< Flag: use the legacy ADM escapes instead of VT100/ANSI.
   BOOL CrLf;                ///< CR/LF flag, true for unix behavior
+  int RxBufMB;              ///< Size of the Rx ring buffer in megabytes, 1-64.
+  int RxQueueKB;            ///< Size of the driver's Rx queue in KB, 0-1024.  0 sizes it from the baud rate.
+  int TxQueueKB;            ///< Size of the driver's Tx queue in KB, 0-1024.  0 sizes it from the baud rate.
+  int ScrollbackMB;         ///< Memory limit of the scrollback history in megabytes, 1-1024.
+  BOOL SpillToDisk;         ///< Flag: keep scrollback beyond the memory limit in a compressed temp file.
+  int CharDelay;            ///< File send pacing: milliseconds to wait after each character.
+  int LineDelay;            ///< File send pacing: milliseconds to wait after each line feed.
+  BOOL LogStamps;           ///< Flag: start each logged line with the time it was received.
+  int LogMaxMB;             ///< Start a new log file after this many megabytes, 0-4096.  0 for no limit.
+  int LogRotateMin;         ///< Start a new log file after this many minutes, 0-10080.  0 for never.
 } TRegContents;
 
+/**
+   One terminal window and the serial port it talks to.  Every window has its
+   own screen, scrollback, log file, search and settings, so several ports can
+   be watched at once.  The window's GWLP_USERDATA points to its session.
+ */
+typedef struct {
+  HWND Wnd;                     ///< The session's window.
+  HWND StatusBar;               ///< Windows handle to the Status Bar.
+  HWND Bin;                     ///< Handle to the binary view window, or NULL.
+  TRawHist *Raw;                ///< Bytes received, as they came, for the binary view.
+  long long BinTop;             ///< Row of the raw history at the top of the binary view.
+  int BinRows;                  ///< Number of rows the binary view shows.
+  BOOL BinFollow;               ///< Flag: the binary view is at the bottom and follows new rows.
+  BOOL BinDirty;                ///< Flag: bytes came in since the binary view was last updated.
+  TRegContents Reg;             ///< Settings of this session.
+  TSerial *Port;                ///< The open serial port, or NULL.
+  TXfer Xfer;                   ///< Background file send.
+  TLines *Lines;                ///< Screen contents, see term.c.
+  THistory *History;            ///< Lines scrolled off the top of the screen.
+  CRITICAL_SECTION HistLock;    ///< Guards the scrollback history, which the search thread reads.
+  long long TopLine;            /**< Number of first line on screen.  Lines are numbered
+                                through the scrollback history and on into the screen,
+                                see GetLine(). */
+  BOOL Follow;                  ///< Flag: view is at the bottom and follows new lines.
+  int ScrnLineCount;            ///< Number of lines on the screen.
+  int LineLength;               ///< Current width of window in characters.
+  TLog Log;                     ///< Log of received characters, written in the background.
+  TCapture Cap;                 ///< Binary capture of received characters, see capture.c.
+  TReplay Replay;               ///< Capture or other file being played back into the terminal.
+  unsigned long long ReplayBytes; ///< Bytes the replay has fed to the terminal...
+  LONGLONG ReplayBusy;          ///< ...and the QueryPerformanceCounter() ticks it took, for the MB/s.
+  DWORD ReplayShown;            ///< Tick count when the replay progress was last shown.
+  BOOL ReplayEnded;             ///< Flag: the replay has got to the end of the file.
+  BOOL ReplaySeeking;           ///< Flag: the Replay dialog's slider is being dragged.
+  BOOL RxFlag;                  ///< Flag used to signal the Rx "LED" to flash
+  BOOL TxFlag;                  ///< Flag used to signal the Tx "LED" to flash
+  unsigned long LastDropped;    ///< Rx lost count last shown in the status bar.
+  TSerialStats LastStats;       ///< Port totals last shown in the status bar, see ShowStats().
+  SCROLLINFO LastScroll;        ///< Scroll bar settings last set.
+  BOOL RenderPending;           ///< Flag: the render timer is running.
+  DWORD LastRender;             ///< Tick count of the last repaint.
+  HDC BackDC;                   ///< Memory DC holding the rendered terminal.
+  HBITMAP BackBmp;              ///< Back buffer bitmap selected into BackDC.
+  int BackWd,BackHt;            ///< Size of the back buffer, same as the client area.
+  RECT TermRect;                ///< Terminal area of the main window, excluding status bar.
+  TPattern Pattern;             ///< Current search pattern.
+  BOOL PatternOK;               ///< Flag: Pattern holds a valid search.
+  BOOL ShowMatches;             ///< Flag: highlight matches on screen.
+  HANDLE SearchThread;          ///< Handle to the background search thread.
+  volatile LONG SearchStop;     ///< Flag: tells the search thread to quit.
+  volatile LONG SearchPosted;   ///< Flag: a MESS_FOUND message is waiting.
+  int SearchGen;                ///< Counts search threads, to ignore messages from old ones.
+  long long SearchPos;          ///< Next history line the search thread will look at.
+  long long *Found;             ///< Numbers of matching history lines, in order.  Guarded by HistLock.
+  int NFound;                   ///< Number of entries in Found.
+  int FoundAlloc;               ///< Allocated size of Found.
+  long long CurMatch;           ///< Line number of the selected match.
+  BOOL FindPending;             ///< Flag: Find Next is waiting for the search thread.
+} TSession;
+
 // Variables
-// flags used to signal lighting of rx/tx LEDs
-extern BOOL RxFlag;
-extern BOOL TxFlag;
+extern TSession *Cur;
 
 // Functions
 void UpdateStatusBar (LPSTR lpszStatusString ,WORD partNumber ,WORD displayFlags );
 static BOOL CreateSBar (HWND hwndParent ,char * initialText ,int nrOfParts );
 static BOOL InitApplication (void);
-HWND CreatefuntermWndClassWnd (void);
+HWND CreatefuntermWndClassWnd (TSession *s);
 BOOL _stdcall DlgWinProc (HWND hwnd ,UINT msg ,WPARAM wParam ,LPARAM lParam );
 void MainWndProc_OnCommand (HWND hwnd ,int id ,HWND hwndCtl ,UINT codeNotify );
 LRESULT CALLBACK MainWndProc (HWND hwnd ,UINT msg ,WPARAM wParam ,LPARAM lParam );
 int WINAPI WinMain (HINSTANCE hInstance ,HINSTANCE hPrevInstance ,LPSTR lpCmdLine ,INT nCmdShow );
 void AddChar (char ch );
+void AddChars(const char *buf,int len);
 void InitCommDialog (HWND wnd );
 void Paint (HWND wnd );
 void DoKey(HWND wnd,int Key);
-TLines *CreateLines(int Count);
-void DestroyLines(TLines *Lines);
-void PushChar(TLines *Lines,char ch);
-void SetCursX(TLines *Lines,int x);
-void SetCursY(TLines *Lines,int y);
 void AddChar(char ch);
-void ReadReg(void);
+BOOL ReadReg(void);
 void SaveReg(void);
 
 
@@ -31,16 +31,25 @@
 #define	IDACCEL	100
 #define	IDD_ABOUT	101
 #define	IDM_CONFIG	200
+#define IDM_NEWWINDOW   201
+#define IDM_CLOSEWINDOW 202
 #define	IDM_STARTCOMM	210
 #define IDM_COPY 	211
 #define IDM_PASTE	212
 #define IDM_CLEAR       213
 #define IDM_BINARY      214
+#define IDM_FIND        215
+#define IDM_FINDNEXT    216
 #define IDM_SEND        220
+#define IDM_CANCELSEND  221
 #define IDM_SAVE        230
 #define IDM_CRLF        235
 #define IDM_LOG_START   240
+#define IDM_CAP_START   242
 #define IDM_LOG_END     250
+#define IDM_CAP_END     252
+#define IDM_REPLAY      260
+#define IDM_REPLAY_STOP 262
 #define	IDM_EXIT	300
 #define	IDD_CONFIG	400
 #define IDD_BINARY      410
@@ -49,6 +58,27 @@
 #define	ID_BAUD         407
 #define	ID_CBOPEN	415
 #define	ID_CBFLOW	416
+#define	ID_RXBUF	417
+#define	ID_SCROLLBACK	418
+#define	ID_CBSPILL	419
+#define	ID_CBADM	421
+#define	ID_CHARDELAY	422
+#define	ID_LINEDELAY	423
+#define	ID_RXQUEUE	424
+#define	ID_TXQUEUE	425
+#define	ID_CBSTAMP	426
+#define	ID_LOGMB	427
+#define	ID_LOGMIN	428
+#define	IDD_FIND	430
+#define	ID_FINDTEXT	431
+#define	ID_CBREGEX	432
+#define	ID_CBCASE	433
+#define	ID_FINDSTATUS	434
+#define	IDD_REPLAY	460
+#define	ID_RSEEK	461
+#define	ID_RPAUSE	462
+#define	ID_RSTATUS	463
+#define	ID_RSPEED	464
 #define	IDM_ABOUT	500
 #define	IDMAINMENU	600
 #define IDPOPUPMENU	601
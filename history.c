@@ -0,0 +1,384 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file history.c This file implements the scrollback history.
+  @defgroup history Scrollback History
+
+  @section intro Introduction
+
+  Lines that scroll off the top of the terminal are appended here.  Rather than
+  allocating every line separately, text is packed into large chunks with a
+  small table of line offsets, so adding a line is just a memcpy().  When the
+  memory limit is reached, the oldest chunk is discarded and re-used for new
+  lines, so a full history costs no allocations at all.
+
+  Lookups go through a binary search over the chunk list, with the last chunk
+  found cached, since the display asks for consecutive lines.
+
+  @section spill Spill File
+
+  Days of output won't fit in memory, so chunks leaving memory can instead be
+  compressed (see lz.c) and appended to a spill file.  A small index in memory
+  maps line numbers to blocks in the file, and a line from the spill file is
+  read by decompressing just its block into a one-block cache.  Scrolling
+  through old history or saving it to file reads each block only once.
+
+  The history is not thread safe, and reading a line may now do file I/O.
+  @{
+ */
+#define _FILE_OFFSET_BITS 64
+#include <stdlib.h>
+#include <string.h>
+#include "history.h"
+#include "lz.h"
+
+#ifdef _WIN32
+#define FSEEK(f,pos) fseeko64(f,pos,SEEK_SET)   ///< Seek, beyond 2 GB.
+#else
+#define FSEEK(f,pos) fseeko(f,pos,SEEK_SET)     ///< Seek, beyond 2 GB.
+#endif
+
+/// Most bytes a chunk packs into: its offset table and text.
+#define PACK_RAW (sizeof(((THistChunk *)0)->Off) + HIST_CHUNK)
+
+/**
+   Creates an empty history.
+   @param MaxBytes Approximate memory limit for stored lines.
+   @return Pointer to new history, or NULL if out of memory.
+ */
+THistory *HistCreate(unsigned long MaxBytes)
+{
+  THistory *h = malloc(sizeof(THistory));
+
+  if (!h)
+    return NULL;
+  memset(h,0,sizeof(THistory));
+  h->CacheBlock = -1;
+  HistSetLimit(h,MaxBytes);
+  return h;
+}
+
+/**
+   De-allocates a history and all of its lines.
+   @param h Pointer to history to destroy.
+ */
+void HistDestroy(THistory *h)
+{
+  int i;
+
+  if (!h)
+    return;
+  HistSpill(h,NULL);
+  for (i=0;i<h->NChunks;i++)
+    free(h->Chunks[i]);
+  free(h->Chunks);
+  free(h->Cache);
+  free(h->Pack);
+  free(h);
+}
+
+/**
+   Compresses a chunk and appends it to the spill file.  Stops spilling if
+   the file can't be written.
+   @param h Pointer to history.
+   @param c Chunk to write.
+ */
+static void SpillChunk(THistory *h,THistChunk *c)
+{
+  THistBlock *b;
+  char *z = h->Pack + PACK_RAW;
+  int n = (c->Count + 1)*sizeof(c->Off[0]);
+
+  if (h->NBlocks == h->BlockAlloc)
+    {
+      b = realloc(h->Blocks,(h->BlockAlloc + 1024)*sizeof(THistBlock));
+      if (!b)
+        {
+          HistSpill(h,NULL);
+          return;
+        }
+      h->Blocks = b;
+      h->BlockAlloc += 1024;
+    }
+
+  // pack the offset table and text together, and compress
+  memcpy(h->Pack,c->Off,n);
+  memcpy(h->Pack + n,c->Data,c->Off[c->Count]);
+  n = LzCompress(h->Pack,n + c->Off[c->Count],z);
+
+  if (FSEEK(h->Spill,h->SpillSize) || fwrite(z,1,n,h->Spill) != n)
+    {
+      HistSpill(h,NULL);
+      return;
+    }
+  b = &h->Blocks[h->NBlocks++];
+  b->First = c->First;
+  b->Count = c->Count;
+  b->Size = n;
+  b->Pos = h->SpillSize;
+  h->SpillSize += n;
+}
+
+/**
+   Removes the oldest chunk from the list, writing it to the spill file if
+   there is one.
+   @param h Pointer to history.
+   @return The removed chunk, for re-use or freeing.
+ */
+static THistChunk *DropOldest(THistory *h)
+{
+  THistChunk *c = h->Chunks[0];
+
+  if (h->Spill)
+    SpillChunk(h,c);
+  h->NChunks--;
+  memmove(&h->Chunks[0],&h->Chunks[1],h->NChunks*sizeof(THistChunk *));
+  h->RamBase += c->Count;
+  if (!h->Spill)
+    h->Base = h->RamBase;
+  h->Last = 0;
+  return c;
+}
+
+/**
+   Reads a block back from the spill file into the cache.
+   @param h Pointer to history.
+   @param i Index of the block.
+   @return The cached chunk, or NULL if the block couldn't be read.
+ */
+static THistChunk *LoadBlock(THistory *h,int i)
+{
+  THistBlock *b = &h->Blocks[i];
+  THistChunk *c = h->Cache;
+  char *z = h->Pack + PACK_RAW;
+  int n = (b->Count + 1)*sizeof(c->Off[0]);
+  int len;
+
+  if (i == h->CacheBlock)
+    return c;
+  h->CacheBlock = -1;
+  if (FSEEK(h->Spill,b->Pos) || fread(z,1,b->Size,h->Spill) != b->Size)
+    return NULL;
+  len = LzDecompress(z,b->Size,h->Pack,PACK_RAW);
+  if (len < n)
+    return NULL;
+
+  c->First = b->First;
+  c->Count = b->Count;
+  memcpy(c->Off,h->Pack,n);
+  if (c->Off[c->Count] != len - n)
+    return NULL;
+  memcpy(c->Data,h->Pack + n,len - n);
+  h->CacheBlock = i;
+  return c;
+}
+
+/**
+   Starts or stops spilling lines that leave memory to a file, instead of
+   discarding them.  Stopping deletes the file, along with the lines in it.
+   @param h Pointer to history.
+   @param FileName Name of the spill file, which is overwritten, or NULL to
+   stop spilling.
+   @return Nonzero if the history is now spilling to the file.
+ */
+int HistSpill(THistory *h,const char *FileName)
+{
+  if (h->Spill)
+    {
+      fclose(h->Spill);
+      remove(h->SpillName);
+      free(h->SpillName);
+      free(h->Blocks);
+      h->Spill = NULL;
+      h->SpillName = NULL;
+      h->Blocks = NULL;
+      h->NBlocks = h->BlockAlloc = 0;
+      h->SpillSize = 0;
+      h->CacheBlock = -1;
+      h->Base = h->RamBase;
+    }
+  if (!FileName)
+    return 0;
+
+  if (!h->Cache)
+    h->Cache = malloc(sizeof(THistChunk));
+  if (!h->Pack)
+    h->Pack = malloc(PACK_RAW + LZ_BOUND(PACK_RAW));
+  h->SpillName = malloc(strlen(FileName) + 1);
+  if (!h->Cache || !h->Pack || !h->SpillName)
+    {
+      free(h->SpillName);
+      h->SpillName = NULL;
+      return 0;
+    }
+  strcpy(h->SpillName,FileName);
+  h->Spill = fopen(FileName,"w+b");
+  if (!h->Spill)
+    {
+      free(h->SpillName);
+      h->SpillName = NULL;
+      return 0;
+    }
+  return 1;
+}
+
+/**
+   Sets the memory limit.  Discards old lines if the history is already bigger.
+   @param h Pointer to history.
+   @param MaxBytes Approximate memory limit for stored lines.
+ */
+void HistSetLimit(THistory *h,unsigned long MaxBytes)
+{
+  h->MaxChunks = MaxBytes / sizeof(THistChunk);
+  if (h->MaxChunks < 2)
+    h->MaxChunks = 2;
+  while (h->NChunks > h->MaxChunks)
+    free(DropOldest(h));
+}
+
+/**
+   Starts a new chunk at the end of the list, re-using the oldest one if the
+   memory limit has been reached.
+   @param h Pointer to history.
+   @return The new chunk, or NULL if out of memory.
+ */
+static THistChunk *NewChunk(THistory *h)
+{
+  THistChunk *c = NULL;
+  THistChunk **p;
+
+  if (h->NChunks >= h->MaxChunks)
+    c = DropOldest(h);
+  else
+    {
+      if (h->NChunks == h->Alloc)
+        {
+          p = realloc(h->Chunks,(h->Alloc + 64)*sizeof(THistChunk *));
+          if (!p)
+            return NULL;
+          h->Chunks = p;
+          h->Alloc += 64;
+        }
+      c = malloc(sizeof(THistChunk));
+      if (!c && h->NChunks)
+        c = DropOldest(h);      // out of memory, recycle instead
+      if (!c)
+        return NULL;
+    }
+
+  c->First = h->Next;
+  c->Count = 0;
+  c->Off[0] = 0;
+  h->Chunks[h->NChunks++] = c;
+  return c;
+}
+
+/**
+   Adds a line to the end of the history.
+   @param h Pointer to history.
+   @param text Characters of the line.  Need not be NUL terminated.
+   @param len Number of characters.
+ */
+void HistAppend(THistory *h,const char *text,int len)
+{
+  THistChunk *c = h->NChunks ? h->Chunks[h->NChunks-1] : NULL;
+
+  if (len > HIST_CHUNK)
+    len = HIST_CHUNK;
+  if (!c || c->Count == HIST_CHUNK_LINES || c->Off[c->Count] + len > HIST_CHUNK)
+    {
+      c = NewChunk(h);
+      if (!c)
+        return;
+    }
+
+  memcpy(c->Data + c->Off[c->Count],text,len);
+  c->Off[c->Count+1] = c->Off[c->Count] + len;
+  c->Count++;
+  h->Next++;
+}
+
+/**
+   Gets a line from the history.
+   @param h Pointer to history.
+   @param n Line number, from Base to Next-1.
+   @param len Receives the number of characters in the line.
+   @return Pointer to the characters, not NUL terminated, or NULL if the line
+   is not held.  Valid until the next call to HistAppend() or HistLine().
+ */
+const char *HistLine(THistory *h,long long n,int *len)
+{
+  THistChunk *c;
+  int lo,hi,mid,k;
+
+  if (n < h->Base || n >= h->Next)
+    return NULL;
+
+  // old lines come from the spill file
+  if (n < h->RamBase)
+    {
+      lo = 0;
+      hi = h->NBlocks - 1;
+      while (lo < hi)
+        {
+          mid = (lo + hi + 1) / 2;
+          if (h->Blocks[mid].First <= n)
+            lo = mid;
+          else
+            hi = mid - 1;
+        }
+      c = LoadBlock(h,lo);
+      if (!c)
+        return NULL;
+      k = n - c->First;
+      *len = c->Off[k+1] - c->Off[k];
+      return c->Data + c->Off[k];
+    }
+
+  // try the last chunk used first, it's usually right
+  c = h->Chunks[h->Last];
+  if (n < c->First || n >= c->First + c->Count)
+    {
+      lo = 0;
+      hi = h->NChunks - 1;
+      while (lo < hi)
+        {
+          mid = (lo + hi + 1) / 2;
+          if (h->Chunks[mid]->First <= n)
+            lo = mid;
+          else
+            hi = mid - 1;
+        }
+      h->Last = lo;
+      c = h->Chunks[lo];
+    }
+
+  k = n - c->First;
+  *len = c->Off[k+1] - c->Off[k];
+  return c->Data + c->Off[k];
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef HISTORY_H
+#define HISTORY_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file history.h Scrollback history storage.
+   @addtogroup history
+ */
+
+#include <stdio.h>
+
+#define HIST_CHUNK 0xFF00        ///< Bytes of text per chunk.  Must fit in an unsigned short.
+#define HIST_CHUNK_LINES 4096    ///< Maximum number of lines per chunk.
+
+/**
+   A block of consecutive history lines.  Text is packed back to back in Data,
+   and line i occupies Data[Off[i]] up to Data[Off[i+1]].
+*/
+typedef struct {
+  long long First;                        ///< Line number of the first line in this chunk.
+  int Count;                              ///< Number of lines in this chunk.
+  unsigned short Off[HIST_CHUNK_LINES+1]; ///< Start of each line in Data.  Off[Count] is bytes used.
+  char Data[HIST_CHUNK];                  ///< Text of the lines, not NUL terminated.
+} THistChunk;
+
+/**
+   Index entry for a chunk that has been compressed and written to the spill file.
+*/
+typedef struct {
+  long long First;              ///< Line number of the first line in the block.
+  int Count;                    ///< Number of lines in the block.
+  int Size;                     ///< Compressed size in bytes.
+  long long Pos;                ///< Offset of the block in the spill file.
+} THistBlock;
+
+/**
+   Lines that have scrolled off the top of the screen.  Lines are numbered from
+   zero in the order they were added, and keep their numbers when older lines
+   are discarded to stay under the memory limit.  If a spill file is set, lines
+   pushed out of memory are compressed and kept there instead of discarded.
+*/
+typedef struct {
+  THistChunk **Chunks;          ///< Chunks, oldest first.
+  int NChunks;                  ///< Number of chunks in use.
+  int Alloc;                    ///< Allocated size of the Chunks array.
+  int MaxChunks;                ///< Chunk limit, from the memory limit.
+  int Last;                     ///< Index of the chunk found by the last lookup.
+  long long Base;               ///< Number of the oldest line still held, in memory or on disk.
+  long long RamBase;            ///< Number of the oldest line held in memory.
+  long long Next;               ///< Number the next added line will get.
+  FILE *Spill;                  ///< Spill file, or NULL if not spilling.
+  char *SpillName;              ///< Name of the spill file, deleted when done.
+  long long SpillSize;          ///< Bytes written to the spill file.
+  THistBlock *Blocks;           ///< Index of the spilled blocks, oldest first.
+  int NBlocks;                  ///< Number of spilled blocks.
+  int BlockAlloc;               ///< Allocated size of the Blocks array.
+  int CacheBlock;               ///< Block held in Cache, or -1.
+  THistChunk *Cache;            ///< The last block read back from the spill file.
+  char *Pack;                   ///< Scratch space for compressing and decompressing.
+} THistory;
+
+THistory *HistCreate(unsigned long MaxBytes);
+void HistDestroy(THistory *h);
+void HistSetLimit(THistory *h,unsigned long MaxBytes);
+void HistAppend(THistory *h,const char *text,int len);
+const char *HistLine(THistory *h,long long n,int *len);
+int HistSpill(THistory *h,const char *FileName);
+
+#endif
@@ -0,0 +1,431 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file logfile.c This file implements the background log file writer.
+  @defgroup logfile Log File Writer
+
+  @section intro Introduction
+
+  Writes received characters to a log file from a thread of its own, so a
+  slow disk or network share never holds up the window, and through it the
+  serial port.  Each log is a TLog, so every session can log at once.
+
+  The characters are not copied for the log: the writer thread reads them
+  from the session's raw history (see rawhist.c), holding a segment at a
+  time, and remembers how far it has got.  It wakes when LogPoke() sees
+  LOG_CHUNK bytes waiting, or every LOG_FLUSH_MS, and writes everything
+  waiting in a few large WriteFile() calls, so the file is never more than
+  about a second behind.  If the writer falls behind by more than the
+  history holds, or writes fail (a full disk, a share that went away),
+  characters are dropped instead of waited for, and a note of how many is
+  written in the file once it can be.  Notes from LogPrintf() go through a
+  small ring (see ring.c), and are written after the characters before them.
+
+  Optionally, every line starts with the local time it was received, to the
+  microsecond, from the times the history keeps; see SerialPortReadStamped().
+
+  A new file can be started after a number of bytes, or of minutes.  The new
+  file has the date and time added to its name, and starts at the beginning
+  of a line, unless no line ends within LOG_LINE bytes.
+  @{
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "logfile.h"
+
+// Defines:
+#define LOG_NOTES 65536          ///< Size of the ring between LogPrintf() and the writer.
+#define LOG_CHUNK (256*1024)     ///< Bytes waiting that wake the writer early, and the size of Out.
+#define LOG_STAMP 40             ///< Most characters in a time stamp.
+#define LOG_FLUSH_MS 1000        ///< Most milliseconds characters wait before being written.
+#define LOG_LINE 4096            ///< Most bytes a new file waits for the end of a line.
+
+// Functions:
+DWORD WINAPI LogProc(void *p);
+static void Drain(TLog *l);
+static void Emit(TLog *l,const char *p,DWORD n,unsigned long long Pos);
+static void Flush(TLog *l);
+static void Put(TLog *l,const char *p,DWORD n);
+static BOOL NewFileDue(TLog *l);
+static void NewFile(TLog *l);
+static int FormatStamp(TLog *l,LONGLONG Time,char *s);
+
+/**
+   Opens a log file, replacing one of the same name, and starts the writer.
+   The log starts with the next character added to the history.
+   @param l The log.  Must not be open already.
+   @param Raw History of the characters received.  Must be kept until
+   LogClose().
+   @param FileName File to log to.
+   @param Stamps If set, each line starts with the time it was received.
+   @param MaxBytes Start a new file after this many bytes, or 0 for no limit.
+   @param RotateMs Start a new file after this many milliseconds, or 0 for never.
+   @return FALSE if the file can't be created, or the writer can't be started.
+ */
+BOOL LogOpen(TLog *l,TRawHist *Raw,const char *FileName,int Stamps,unsigned long long MaxBytes,DWORD RotateMs)
+{
+  DWORD ThreadID;
+
+  if (l->Thread)
+    return FALSE;
+  strncpy(l->Name,FileName,MAX_PATH-1);
+  l->Name[MAX_PATH-1] = 0;
+  l->Raw = Raw;
+  l->Pos = Raw->End;
+  l->OutLen = 0;
+  l->Stamps = Stamps;
+  l->MaxBytes = MaxBytes;
+  l->RotateMs = RotateMs;
+  l->LineStart = TRUE;
+  l->Stop = FALSE;
+  l->FileBytes = l->Lost = 0;
+  l->Waited = 0;
+  l->FileStart = GetTickCount();
+
+  l->File = CreateFile(l->Name,GENERIC_WRITE,FILE_SHARE_READ,NULL,
+                       CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  if (l->File == INVALID_HANDLE_VALUE)
+    return FALSE;
+  l->Notes = RingCreate(LOG_NOTES);
+  l->Out = malloc(LOG_CHUNK);
+  l->Wake = CreateEvent(NULL,FALSE,FALSE,NULL);
+  if (l->Notes && l->Out && l->Wake)
+    l->Thread = CreateThread(NULL,0,LogProc,l,0,&ThreadID);
+  if (!l->Thread)
+    {
+      if (l->Wake)
+        CloseHandle(l->Wake);
+      free(l->Out);
+      RingDestroy(l->Notes);
+      CloseHandle(l->File);
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+   Writes what is left to the file, and closes it.  Safe to call when the
+   log is not open.
+   @param l The log.
+ */
+void LogClose(TLog *l)
+{
+  if (!l->Thread)
+    return;
+  InterlockedExchange(&l->Stop,TRUE);
+  SetEvent(l->Wake);
+  WaitForSingleObject(l->Thread,INFINITE);
+  CloseHandle(l->Thread);
+  CloseHandle(l->Wake);
+  free(l->Out);
+  RingDestroy(l->Notes);
+  l->Thread = NULL;
+}
+
+/**
+   Returns TRUE while the log is open.
+   @param l The log.
+ */
+BOOL LogActive(TLog *l)
+{
+  return l->Thread != NULL;
+}
+
+/**
+   Wakes the writer if LOG_CHUNK characters are waiting in the history.
+   Called after characters are added to it.
+   @param l The log.
+ */
+void LogPoke(TLog *l)
+{
+  // Pos may be read half way through a change, which only wakes the writer
+  if (l->Thread && l->Raw->End - l->Pos >= LOG_CHUNK)
+    SetEvent(l->Wake);
+}
+
+/**
+   Adds a formatted note to the log, like printf().
+   @param l The log.
+   @param fmt Format string.
+ */
+void LogPrintf(TLog *l,const char *fmt,...)
+{
+  char s[512];
+  va_list Args;
+  int n;
+
+  va_start(Args,fmt);
+  n = _vsnprintf(s,sizeof(s)-1,fmt,Args);
+  va_end(Args);
+  if (n < 0)
+    n = sizeof(s)-1;
+  if (l->Thread)
+    RingWrite(l->Notes,s,n);
+}
+
+/**
+   Internal thread procedure of the writer.  Writes what is waiting every
+   LOG_FLUSH_MS, or sooner when a LOG_CHUNK is waiting, and what is left
+   when the log closes.
+   @param p The log.
+ */
+DWORD WINAPI LogProc(void *p)
+{
+  TLog *l = p;
+  int Stop;
+
+  do
+    {
+      WaitForSingleObject(l->Wake,LOG_FLUSH_MS);
+      // LogClose() is called after the last characters and notes, so once
+      // Stop is seen, this drains everything
+      Stop = l->Stop;
+      Drain(l);
+    }
+  while (!Stop);
+  if (l->File != INVALID_HANDLE_VALUE)
+    CloseHandle(l->File);
+  return 0;
+}
+
+/**
+   Internal function that writes everything waiting in the history, noting
+   any characters lost, and then the notes waiting.
+   @param l The log.
+ */
+static void Drain(TLog *l)
+{
+  char s[100];
+  const char *p;
+  unsigned long long Pos;
+  TRawSeg *Seg;
+  int n;
+
+  for (;;)
+    {
+      Pos = l->Pos;
+      p = RawHold(l->Raw,&Pos,&n,&Seg);
+      if (!p)
+        break;
+      if (Pos != l->Pos)
+        {
+          // the history dropped them before they could be written
+          Flush(l);
+          n = sprintf(s,"\r\n[log: %I64u bytes lost, the log file could not keep up]\r\n",
+                      Pos - l->Pos);
+          Put(l,s,n);
+          l->LineStart = TRUE;
+          RawRelease(l->Raw,Seg);
+          l->Pos = Pos;
+          continue;
+        }
+      if (n > LOG_CHUNK)
+        n = LOG_CHUNK;
+      Emit(l,p,n,Pos);
+      RawRelease(l->Raw,Seg);
+      l->Pos = Pos + n;
+    }
+  Flush(l);
+  while ((n = RingReadPtr(l->Notes,&p)) != 0)
+    {
+      Put(l,p,n);
+      RingSkip(l->Notes,n);
+      l->LineStart = TRUE;
+    }
+}
+
+/**
+   Internal function that writes characters from the history, time stamping
+   the lines if asked to, and starting new files when they are due.  Without
+   stamps, the characters are written straight from the history.
+   @param l The log.
+   @param p The characters.
+   @param n Number of characters.
+   @param Pos Number of the first character in the history, for its time.
+ */
+static void Emit(TLog *l,const char *p,DWORD n,unsigned long long Pos)
+{
+  const char *e;
+  LARGE_INTEGER Li;
+  LONGLONG Time;
+  DWORD k;
+
+  while (n > 0)
+    {
+      // line by line only for stamps, or to finish the line before a new file
+      if (!l->Stamps && !NewFileDue(l))
+        {
+          Put(l,p,n);
+          l->LineStart = p[n-1] == '\n';
+          return;
+        }
+      e = memchr(p,'\n',n);
+      k = e ? e + 1 - p : n;
+      if (!l->Stamps)
+        Put(l,p,k);
+      else
+        {
+          if (l->LineStart)
+            {
+              if (l->OutLen + LOG_STAMP > LOG_CHUNK)
+                Flush(l);
+              Time = RawTime(l->Raw,Pos);
+              if (!Time)
+                {
+                  QueryPerformanceCounter(&Li);
+                  Time = Li.QuadPart;
+                }
+              l->OutLen += FormatStamp(l,Time,l->Out + l->OutLen);
+            }
+          if (l->OutLen + k > LOG_CHUNK)
+            Flush(l);
+          if (k > LOG_CHUNK)
+            Put(l,p,k);
+          else
+            {
+              memcpy(l->Out + l->OutLen,p,k);
+              l->OutLen += k;
+            }
+        }
+      l->LineStart = e != NULL;
+      p += k;
+      n -= k;
+      Pos += k;
+      if (NewFileDue(l))
+        {
+          // finish the line first, unless it goes on and on
+          if (e || l->Waited + k >= LOG_LINE)
+            {
+              Flush(l);
+              NewFile(l);
+            }
+          else
+            l->Waited += k;
+        }
+    }
+}
+
+/**
+   Internal function that writes the time stamped lines waiting in Out.
+   @param l The log.
+ */
+static void Flush(TLog *l)
+{
+  if (l->OutLen)
+    Put(l,l->Out,l->OutLen);
+  l->OutLen = 0;
+}
+
+/**
+   Internal function that writes to the file.  Characters that can't be
+   written are counted, and a note of them is written once writes work again.
+   @param l The log.
+   @param p Characters to write.
+   @param n Number of characters.
+ */
+static void Put(TLog *l,const char *p,DWORD n)
+{
+  char s[100];
+  DWORD Done = 0,Len;
+
+  if (l->File != INVALID_HANDLE_VALUE && l->Lost)
+    {
+      Len = sprintf(s,"\r\n[log: %I64u bytes lost, writing to the log file failed]\r\n",l->Lost);
+      if (WriteFile(l->File,s,Len,&Done,NULL) && Done == Len)
+        {
+          l->FileBytes += Done;
+          l->Lost = 0;
+        }
+    }
+  Done = 0;
+  if (l->File != INVALID_HANDLE_VALUE)
+    WriteFile(l->File,p,n,&Done,NULL);
+  l->FileBytes += Done;
+  l->Lost += n - Done;
+}
+
+/**
+   Internal function that checks if the file is over its size or age limit.
+   @param l The log.
+   @return TRUE if a new file should be started.
+ */
+static BOOL NewFileDue(TLog *l)
+{
+  return (l->MaxBytes && l->FileBytes + l->OutLen >= l->MaxBytes) ||
+    (l->RotateMs && GetTickCount() - l->FileStart >= l->RotateMs);
+}
+
+/**
+   Internal function that closes the file, and starts the next with the
+   date and time added to the name, as in capture_20100401-151945.log.  If
+   it can't be created, writing goes on failing until the next is due.
+   @param l The log.
+ */
+static void NewFile(TLog *l)
+{
+  char Name[MAX_PATH+20];
+  char *Ext,*Slash;
+  SYSTEMTIME St;
+  int n;
+
+  if (l->File != INVALID_HANDLE_VALUE)
+    CloseHandle(l->File);
+  GetLocalTime(&St);
+  Ext = strrchr(l->Name,'.');
+  Slash = strrchr(l->Name,'\\');
+  if (!Ext || (Slash && Ext < Slash))
+    Ext = l->Name + strlen(l->Name);
+  n = Ext - l->Name;
+  sprintf(Name,"%.*s_%04d%02d%02d-%02d%02d%02d%s",n,l->Name,St.wYear,St.wMonth,St.wDay,
+          St.wHour,St.wMinute,St.wSecond,Ext);
+  l->File = CreateFile(Name,GENERIC_WRITE,FILE_SHARE_READ,NULL,
+                       CREATE_ALWAYS,FILE_ATTRIBUTE_NORMAL,NULL);
+  l->FileBytes = 0;
+  l->FileStart = GetTickCount();
+  l->Waited = 0;
+}
+
+/**
+   Internal function that formats a time stamp: the local date and time a
+   performance counter reading stands for, to the microsecond, by the
+   history's clock.
+   @param l The log.
+   @param Time QueryPerformanceCounter() reading.
+   @param s Receives the stamp, at least 40 characters.
+   @return Length of the stamp.
+ */
+static int FormatStamp(TLog *l,LONGLONG Time,char *s)
+{
+  SYSTEMTIME St;
+  int Us = RawLocalTime(l->Raw,Time,&St);
+
+  return sprintf(s,"%04d-%02d-%02d %02d:%02d:%02d.%06d ",St.wYear,St.wMonth,St.wDay,
+                 St.wHour,St.wMinute,St.wSecond,Us);
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef LOGFILE_H
+#define LOGFILE_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file logfile.h Background log file writer.
+   @addtogroup logfile
+ */
+
+#include <windows.h>
+#include "ring.h"
+#include "rawhist.h"
+
+/**
+   A log file.  Filled in by LogOpen(); the caller provides the memory and
+   keeps it until LogClose() has been called.  Only one thread may call
+   LogPoke() and LogPrintf(), the one that adds to the history.
+*/
+typedef struct {
+  HANDLE Thread;                ///< Handle to the writer thread, NULL when not logging.
+  HANDLE Wake;                  ///< Event: there is a LOG_CHUNK to write, or the log is closing.
+  volatile LONG Stop;           ///< Flag: tells the writer to write what is left and quit.
+  TRawHist *Raw;                ///< History the received characters are written from.
+  unsigned long long Pos;       ///< Number of the next byte of Raw to write.  Set by the writer thread.
+  TRing *Notes;                 ///< Notes from LogPrintf() waiting to be written.
+  char *Out;                    ///< Time stamped lines waiting to be written.  Writer thread only.
+  DWORD OutLen;                 ///< Bytes in Out.  Writer thread only.
+  char Name[MAX_PATH];          ///< File name chosen by the user.  Rotated files get a time added.
+  int Stamps;                   ///< Flag: start every line with the time it was received.
+  unsigned long long MaxBytes;  ///< Start a new file after this many bytes, or 0 for no limit.
+  DWORD RotateMs;               ///< Start a new file after this many milliseconds, or 0 for never.
+  int LineStart;                ///< Flag: the next character written starts a line.  Writer thread only.
+  HANDLE File;                  ///< File being written.  Writer thread only.
+  unsigned long long FileBytes; ///< Bytes in File.  Writer thread only.
+  DWORD FileStart;              ///< Tick count when File was started.  Writer thread only.
+  unsigned long long Lost;      ///< Bytes lost to failed writes, not yet noted in the file.  Writer thread only.
+  unsigned long Waited;         ///< Bytes written since a new file was due, waiting for a line end.  Writer thread only.
+} TLog;
+
+BOOL LogOpen(TLog *l,TRawHist *Raw,const char *FileName,int Stamps,unsigned long long MaxBytes,DWORD RotateMs);
+void LogClose(TLog *l);
+BOOL LogActive(TLog *l);
+void LogPoke(TLog *l);
+void LogPrintf(TLog *l,const char *fmt,...);
+
+#endif
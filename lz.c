@@ -0,0 +1,225 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file lz.c This file implements a small LZ block compressor.
+  @defgroup lz LZ Compression
+
+  @section intro Introduction
+
+  A fast byte-oriented LZ77 codec in the style of LZ4, used to squeeze old
+  scrollback before it goes to disk.  Terminal output is very repetitive, so
+  even this simple scheme typically gets it down to a quarter of its size, and
+  decompression is little more than a string of memcpy() calls.
+
+  A block is a series of sequences.  Each sequence is a token byte, whose high
+  nibble is the literal count and low nibble the match length minus 4, then any
+  extra literal count bytes, the literals, a 2-byte little-endian match offset,
+  and any extra match length bytes.  A nibble of 15 means more count bytes
+  follow, each added in until one is less than 255.  The last sequence has only
+  literals, and ends at the end of the block.
+  @{
+ */
+#include <string.h>
+#include "lz.h"
+
+#define MIN_MATCH 4             ///< Shortest match worth coding.
+#define MAX_OFFSET 65535        ///< Farthest back a match can reach.
+#define HASH_BITS 12            ///< Log2 of the match finder table size.
+
+/// Hash of the four bytes at p, for the match finder.
+#define HASH(p) ((((unsigned)(unsigned char)(p)[0] | (unsigned)(unsigned char)(p)[1] << 8 | \
+                   (unsigned)(unsigned char)(p)[2] << 16 | (unsigned)(unsigned char)(p)[3] << 24) \
+                  * 2654435761U) >> (32 - HASH_BITS))
+
+/**
+   Writes a length that didn't fit in its nibble.
+   @param d Output pointer.
+   @param n Length minus 15.
+   @return Output pointer after the count bytes.
+ */
+static char *PutCount(char *d,int n)
+{
+  for (;n >= 255;n -= 255)
+    *d++ = (char)255;
+  *d++ = n;
+  return d;
+}
+
+/**
+   Writes one sequence: literals, then a match unless this is the last one.
+   @param d Output pointer.
+   @param lit Start of the literals.
+   @param nlit Number of literals.
+   @param off Match offset.
+   @param mlen Match length, or 0 for the last sequence.
+   @return Output pointer after the sequence.
+ */
+static char *PutSequence(char *d,const char *lit,int nlit,int off,int mlen)
+{
+  char *token = d++;
+  int m = mlen ? mlen - MIN_MATCH : 0;
+
+  *token = (nlit < 15 ? nlit : 15) << 4 | (m < 15 ? m : 15);
+  if (nlit >= 15)
+    d = PutCount(d,nlit - 15);
+  memcpy(d,lit,nlit);
+  d += nlit;
+  if (mlen)
+    {
+      *d++ = off;
+      *d++ = off >> 8;
+      if (m >= 15)
+        d = PutCount(d,m - 15);
+    }
+  return d;
+}
+
+/**
+   Compresses a block.
+   @param src Data to compress.
+   @param len Number of bytes.
+   @param dst Output, at least LZ_BOUND(len) bytes.
+   @return Compressed size.
+ */
+int LzCompress(const char *src,int len,char *dst)
+{
+  int Table[1 << HASH_BITS];
+  const char *ip = src;
+  const char *lit = src;
+  const char *end = src + len;
+  const char *limit = end - MIN_MATCH;  // last place a match can start
+  const char *ref;
+  char *d = dst;
+  unsigned h;
+  int mlen;
+
+  memset(Table,0xff,sizeof(Table));
+  while (ip < limit)
+    {
+      h = HASH(ip);
+      ref = src + Table[h];
+      Table[h] = ip - src;
+      if (ref < src || ip - ref > MAX_OFFSET || memcmp(ref,ip,MIN_MATCH))
+        {
+          ip++;
+          continue;
+        }
+
+      // extend the match as far as it goes
+      for (mlen=MIN_MATCH;ip + mlen < end && ref[mlen] == ip[mlen];mlen++)
+        ;
+      d = PutSequence(d,lit,ip - lit,ip - ref,mlen);
+      ip += mlen;
+      lit = ip;
+    }
+
+  d = PutSequence(d,lit,end - lit,0,0);
+  return d - dst;
+}
+
+/**
+   Reads a length that didn't fit in its nibble.
+   @param s Input pointer, advanced past the count bytes.
+   @param end End of input.
+   @return The extra length, or -1 if the input ran out.
+ */
+static int GetCount(const char **s,const char *end)
+{
+  int n = 0;
+  unsigned char b;
+
+  do
+    {
+      if (*s >= end)
+        return -1;
+      b = *(*s)++;
+      n += b;
+    }
+  while (b == 255);
+  return n;
+}
+
+/**
+   Decompresses a block.  Corrupt input is detected, and never writes outside
+   the output buffer.
+   @param src Compressed data.
+   @param len Number of compressed bytes.
+   @param dst Output buffer.
+   @param max Size of the output buffer.
+   @return Decompressed size, or -1 if the data is corrupt.
+ */
+int LzDecompress(const char *src,int len,char *dst,int max)
+{
+  const char *end = src + len;
+  char *d = dst;
+  char *dend = dst + max;
+  const char *ref;
+  unsigned char token;
+  int n,x,off;
+
+  while (src < end)
+    {
+      token = *src++;
+
+      // literals
+      n = token >> 4;
+      if (n == 15)
+        {
+          if ((x = GetCount(&src,end)) < 0)
+            return -1;
+          n += x;
+        }
+      if (n > end - src || n > dend - d)
+        return -1;
+      memcpy(d,src,n);
+      d += n;
+      src += n;
+      if (src == end)
+        break;                  // last sequence
+
+      // match
+      if (end - src < 2)
+        return -1;
+      off = (unsigned char)src[0] | (unsigned char)src[1] << 8;
+      src += 2;
+      n = (token & 15) + MIN_MATCH;
+      if (n == 15 + MIN_MATCH)
+        {
+          if ((x = GetCount(&src,end)) < 0)
+            return -1;
+          n += x;
+        }
+      ref = d - off;
+      if (off == 0 || ref < dst || n > dend - d)
+        return -1;
+      // may overlap, so copy forwards a byte at a time
+      while (n--)
+        *d++ = *ref++;
+    }
+  return d - dst;
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,38 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef LZ_H
+#define LZ_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file lz.h Small built-in LZ block compressor.
+   @addtogroup lz
+ */
+
+/// Worst case compressed size of a block of n bytes.
+#define LZ_BOUND(n) ((n) + (n)/255 + 16)
+
+int LzCompress(const char *src,int len,char *dst);
+int LzDecompress(const char *src,int len,char *dst,int max);
+
+#endif
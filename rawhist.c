@@ -0,0 +1,462 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file rawhist.c This file implements the history of raw received bytes.
+  @defgroup rawhist Raw History
+
+  @section intro Introduction
+
+  Every byte received is kept here once, as it came from the port, and the
+  rest of the program reads it from here: the terminal takes it straight
+  from the history, the hex view draws its rows from it, and the log writer
+  thread writes it out at its own pace.  The scrollback history (see
+  history.c) keeps text as the terminal showed it; this keeps the bytes.
+
+  Bytes are added to segments of RAW_SEG bytes.  RawReserve() hands out
+  the free space of the newest segment, so a read from the port can go
+  straight into it, and RawCommit() makes it part of the history.  Once the
+  memory limit is reached the oldest segment is dropped and re-used.
+
+  Every byte keeps its number, counted from the first byte received, and
+  segments start on multiples of RAW_SEG, so finding a byte is a division
+  and a row of the hex view never spans two segments.
+
+  @section sharing Sharing
+
+  Bytes never change once added, so other threads can read them without
+  copying.  RawHold() finds a byte and holds its segment, RawRelease() lets
+  it go; a segment dropped from the history while held is only freed with
+  the last release, and the history starts a new one instead.  The lock is
+  only held to find segments, count references and change lengths, never
+  while bytes are copied.
+
+  @section times Times
+
+  A read that starts a row of RAW_ROW bytes, or a line, is marked with when
+  it completed, so the hex view can stamp its rows and the log its lines.
+  Other reads add nothing, so there are never more marks than rows and lines.
+  @{
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rawhist.h"
+
+// Functions:
+static TRawSeg *NewSeg(TRawHist *h);
+static void DropSeg(TRawHist *h);
+static void FreeSeg(TRawSeg *s);
+static void AddMark(TRawSeg *s,DWORD Off,LONGLONG Time);
+
+/**
+   Creates an empty history.
+   @param MaxBytes Approximate memory limit for stored bytes.
+   @return Pointer to new history, or NULL if out of memory.
+ */
+TRawHist *RawCreate(unsigned long MaxBytes)
+{
+  TRawHist *h = malloc(sizeof(TRawHist));
+  LARGE_INTEGER Li;
+  FILETIME Ft;
+
+  if (!h)
+    return NULL;
+  memset(h,0,sizeof(TRawHist));
+  InitializeCriticalSection(&h->Lock);
+  h->LineStart = TRUE;
+  QueryPerformanceFrequency(&Li);
+  h->Freq = Li.QuadPart;
+  QueryPerformanceCounter(&Li);
+  h->Qpc0 = Li.QuadPart;
+  GetSystemTimeAsFileTime(&Ft);
+  h->Ft0 = (unsigned long long)Ft.dwHighDateTime << 32 | Ft.dwLowDateTime;
+  RawSetLimit(h,MaxBytes);
+  if (!h->Segs)
+    {
+      DeleteCriticalSection(&h->Lock);
+      free(h);
+      return NULL;
+    }
+  return h;
+}
+
+/**
+   Frees a history and everything in it.  No segment may still be held.
+   @param h The history.  May be NULL.
+ */
+void RawDestroy(TRawHist *h)
+{
+  int i;
+
+  if (!h)
+    return;
+  for (i=0;i<h->NSegs;i++)
+    FreeSeg(h->Segs[i]);
+  free(h->Segs);
+  DeleteCriticalSection(&h->Lock);
+  free(h);
+}
+
+/**
+   Changes the memory limit.  The oldest bytes are dropped if they no longer
+   fit.
+   @param h The history.
+   @param MaxBytes Approximate memory limit for stored bytes.
+ */
+void RawSetLimit(TRawHist *h,unsigned long MaxBytes)
+{
+  TRawSeg **Segs;
+  int Max = MaxBytes/RAW_SEG;
+
+  // the newest segment is being filled, and the one before is still in view
+  if (Max < 2)
+    Max = 2;
+  EnterCriticalSection(&h->Lock);
+  while (h->NSegs > Max)
+    DropSeg(h);
+  Segs = realloc(h->Segs,Max*sizeof(TRawSeg *));
+  if (Segs)
+    {
+      h->Segs = Segs;
+      h->MaxSegs = Max;
+    }
+  LeaveCriticalSection(&h->Lock);
+}
+
+/**
+   Internal function that frees a segment.
+   @param s The segment.
+ */
+static void FreeSeg(TRawSeg *s)
+{
+  free(s->Marks);
+  free(s);
+}
+
+/**
+   Internal function that drops the oldest segment from the history.  It
+   is freed unless a reader still holds it.  Called with the lock held.
+   @param h The history.
+ */
+static void DropSeg(TRawHist *h)
+{
+  TRawSeg *s = h->Segs[0];
+
+  memmove(h->Segs,h->Segs+1,--h->NSegs*sizeof(TRawSeg *));
+  h->Base += RAW_SEG;
+  if (--s->Refs == 0)
+    FreeSeg(s);
+}
+
+/**
+   Internal function that starts a new segment after the last.  When the
+   history is full, the oldest is dropped, and re-used if no reader holds it.
+   @param h The history.
+   @return The new segment, or NULL if out of memory.
+ */
+static TRawSeg *NewSeg(TRawHist *h)
+{
+  TRawSeg *s = NULL;
+
+  EnterCriticalSection(&h->Lock);
+  if (h->NSegs == h->MaxSegs)
+    {
+      if (h->Segs[0]->Refs == 1)
+        {
+          s = h->Segs[0];
+          s->Refs++;
+        }
+      DropSeg(h);
+    }
+  LeaveCriticalSection(&h->Lock);
+  if (!s)
+    {
+      s = malloc(sizeof(TRawSeg));
+      if (!s)
+        return NULL;
+      s->Marks = NULL;
+      s->MarkAlloc = 0;
+    }
+  s->Start = h->End;
+  s->Len = 0;
+  s->Refs = 1;
+  s->NMarks = 0;
+  EnterCriticalSection(&h->Lock);
+  h->Segs[h->NSegs++] = s;
+  LeaveCriticalSection(&h->Lock);
+  return s;
+}
+
+/**
+   Internal function that marks when a read completed.  If there is no
+   memory for it, the read shares the time of the mark before.  Called with
+   the lock held.
+   @param s The segment.
+   @param Off Offset in the segment of the read's first byte.
+   @param Time QueryPerformanceCounter() reading.
+ */
+static void AddMark(TRawSeg *s,DWORD Off,LONGLONG Time)
+{
+  TRawMark *Marks;
+  int n;
+
+  if (s->NMarks == s->MarkAlloc)
+    {
+      n = s->MarkAlloc ? 2*s->MarkAlloc : 64;
+      Marks = realloc(s->Marks,n*sizeof(TRawMark));
+      if (!Marks)
+        return;
+      s->Marks = Marks;
+      s->MarkAlloc = n;
+    }
+  s->Marks[s->NMarks].Off = Off;
+  s->Marks[s->NMarks].Time = Time;
+  s->NMarks++;
+}
+
+/**
+   Gets the free space after the newest byte, for a read to go straight
+   into.  Follow with RawCommit().
+   @param h The history.
+   @param len Receives the number of bytes free, at least one.
+   @return Pointer to the free space, or NULL if out of memory.
+ */
+char *RawReserve(TRawHist *h,int *len)
+{
+  TRawSeg *s = h->NSegs ? h->Segs[h->NSegs-1] : NULL;
+
+  if (!s || s->Len == RAW_SEG)
+    {
+      s = NewSeg(h);
+      if (!s)
+        return NULL;
+    }
+  *len = RAW_SEG - s->Len;
+  return s->Data + s->Len;
+}
+
+/**
+   Adds bytes written at RawReserve()'s pointer to the history.
+   @param h The history.
+   @param len Number of bytes written, no more than RawReserve() said.
+   @param Time QueryPerformanceCounter() when the read completed.
+ */
+void RawCommit(TRawHist *h,int len,LONGLONG Time)
+{
+  TRawSeg *s = h->Segs[h->NSegs-1];
+  const char *p = s->Data + s->Len;
+  BOOL Mark;
+
+  if (len <= 0)
+    return;
+  // only reads that start a row or a line need a time
+  Mark = h->LineStart || (s->Len + RAW_ROW-1)/RAW_ROW*RAW_ROW < s->Len + len ||
+    memchr(p,'\n',len-1);
+  h->LineStart = p[len-1] == '\n';
+  EnterCriticalSection(&h->Lock);
+  if (Mark)
+    AddMark(s,s->Len,Time);
+  s->Len += len;
+  h->End += len;
+  LeaveCriticalSection(&h->Lock);
+}
+
+/**
+   Adds the bytes of a read to the history.
+   @param h The history.
+   @param buf The bytes.
+   @param len Number of bytes.
+   @param Time QueryPerformanceCounter() when the read completed.
+ */
+void RawAppend(TRawHist *h,const char *buf,int len,LONGLONG Time)
+{
+  char *p;
+  int n;
+
+  while (len > 0 && (p = RawReserve(h,&n)) != NULL)
+    {
+      if (n > len)
+        n = len;
+      memcpy(p,buf,n);
+      RawCommit(h,n,Time);
+      buf += n;
+      len -= n;
+    }
+}
+
+/**
+   Finds a byte of the history, from the thread that adds them.
+   @param h The history.
+   @param Pos Number of the byte.
+   @param len Receives the number of bytes from Pos on that are held
+   together, up to the end of its segment.  Zero if Pos is not held.
+   @return Pointer to the byte, valid until the next byte is added, or NULL
+   if it is not held.
+ */
+const char *RawPeek(TRawHist *h,unsigned long long Pos,int *len)
+{
+  TRawSeg *s;
+  DWORD Off;
+
+  if (Pos < h->Base || Pos >= h->End)
+    {
+      *len = 0;
+      return NULL;
+    }
+  s = h->Segs[(Pos - h->Base)/RAW_SEG];
+  Off = (Pos - h->Base)%RAW_SEG;
+  *len = s->Len - Off;
+  return s->Data + Off;
+}
+
+/**
+   Finds a byte of the history, from any thread, and holds its segment
+   until RawRelease(), so the bytes stay put however far the history moves
+   on.
+   @param h The history.
+   @param Pos Number of the byte.  If it has been dropped already, this is
+   moved on to the oldest byte held.
+   @param len Receives the number of bytes from *Pos on in the segment.
+   @param Seg Receives the segment, for RawRelease().
+   @return Pointer to the byte, or NULL if there are no bytes from *Pos on
+   yet.
+ */
+const char *RawHold(TRawHist *h,unsigned long long *Pos,int *len,TRawSeg **Seg)
+{
+  TRawSeg *s;
+  DWORD Off;
+
+  EnterCriticalSection(&h->Lock);
+  if (*Pos < h->Base)
+    *Pos = h->Base;
+  if (*Pos >= h->End)
+    {
+      LeaveCriticalSection(&h->Lock);
+      return NULL;
+    }
+  s = h->Segs[(*Pos - h->Base)/RAW_SEG];
+  Off = *Pos - s->Start;
+  *len = s->Len - Off;
+  s->Refs++;
+  LeaveCriticalSection(&h->Lock);
+  *Seg = s;
+  return s->Data + Off;
+}
+
+/**
+   Lets go of a segment held by RawHold().
+   @param h The history.
+   @param Seg The segment.
+ */
+void RawRelease(TRawHist *h,TRawSeg *Seg)
+{
+  EnterCriticalSection(&h->Lock);
+  if (--Seg->Refs == 0)
+    FreeSeg(Seg);
+  LeaveCriticalSection(&h->Lock);
+}
+
+/**
+   Returns when a byte was received, or rather when the last marked read at
+   or before it completed.  That is exact for the first byte of a row or a
+   line.
+   @param h The history.
+   @param Pos Number of the byte.
+   @return QueryPerformanceCounter() reading, or 0 if not known.
+ */
+LONGLONG RawTime(TRawHist *h,unsigned long long Pos)
+{
+  LONGLONG Time = 0;
+  TRawSeg *s;
+  DWORD Off;
+  int i,lo,hi;
+
+  EnterCriticalSection(&h->Lock);
+  if (Pos >= h->Base && Pos < h->End)
+    {
+      i = (Pos - h->Base)/RAW_SEG;
+      Off = (Pos - h->Base)%RAW_SEG;
+      // last mark at or before Off, else the last mark of an earlier segment
+      for (;i >= 0 && !Time;i--,Off = RAW_SEG)
+        {
+          s = h->Segs[i];
+          lo = 0;
+          hi = s->NMarks;
+          while (lo < hi)
+            {
+              if (s->Marks[(lo+hi)/2].Off <= Off)
+                lo = (lo+hi)/2 + 1;
+              else
+                hi = (lo+hi)/2;
+            }
+          if (lo)
+            Time = s->Marks[lo-1].Time;
+        }
+    }
+  LeaveCriticalSection(&h->Lock);
+  return Time;
+}
+
+/**
+   Converts a time from the history to local time, to the microsecond.
+   @param h The history.
+   @param Time QueryPerformanceCounter() reading.
+   @param St Receives the local date and time.
+   @return Microseconds past the second.
+ */
+int RawLocalTime(TRawHist *h,LONGLONG Time,SYSTEMTIME *St)
+{
+  LONGLONG d = Time - h->Qpc0;
+  ULARGE_INTEGER u;
+  FILETIME Ft,Local;
+
+  // in two parts, so a long session doesn't overflow
+  u.QuadPart = h->Ft0 + d/h->Freq*10000000 + d%h->Freq*10000000/h->Freq;
+  Ft.dwLowDateTime = u.LowPart;
+  Ft.dwHighDateTime = u.HighPart;
+  FileTimeToLocalFileTime(&Ft,&Local);
+  FileTimeToSystemTime(&Local,St);
+  u.LowPart = Local.dwLowDateTime;
+  u.HighPart = Local.dwHighDateTime;
+  return (int)(u.QuadPart/10%1000000);
+}
+
+/**
+   Formats a time from the history as local time of day, to the microsecond.
+   @param h The history.
+   @param Time QueryPerformanceCounter() reading.
+   @param s Receives the time, at least 20 characters.
+   @return Length of the time.
+ */
+int RawStamp(TRawHist *h,LONGLONG Time,char *s)
+{
+  SYSTEMTIME St;
+  int Us = RawLocalTime(h,Time,&St);
+
+  return sprintf(s,"%02d:%02d:%02d.%06d",St.wHour,St.wMinute,St.wSecond,Us);
+}
+
+/**
+   @}
+*/
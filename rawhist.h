@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef RAWHIST_H
+#define RAWHIST_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file rawhist.h History of the raw bytes received.
+   @addtogroup rawhist
+ */
+
+#include <windows.h>
+
+#define RAW_SEG 0x100000        ///< Bytes per segment.  A multiple of RAW_ROW.
+#define RAW_ROW 16              ///< Bytes per row of the hex view.
+
+/**
+   When a read completed.  Only reads that start a row or a line get a
+   mark; the bytes up to the next mark came in with it, or later.
+*/
+typedef struct {
+  LONGLONG Time;                ///< QueryPerformanceCounter() when the read completed.
+  DWORD Off;                    ///< Offset in the segment of the read's first byte.
+} TRawMark;
+
+/**
+   RAW_SEG consecutive bytes of the history.  Every segment but the newest
+   is full.  A segment is freed when the history has dropped it and no
+   reader holds it any more.
+*/
+typedef struct {
+  unsigned long long Start;     ///< Number of the byte at Data[0].  A multiple of RAW_SEG.
+  DWORD Len;                    ///< Bytes used in Data.  Changed under the lock.
+  int Refs;                     ///< One for the history while it holds the segment, one per RawHold().
+  int NMarks;                   ///< Number of marks in use.
+  int MarkAlloc;                ///< Allocated size of the Marks array.
+  TRawMark *Marks;              ///< Read times, in order of Off.  Changed under the lock.
+  char Data[RAW_SEG];           ///< The bytes.
+} TRawSeg;
+
+/**
+   Bytes received, numbered from zero in the order they came in.  They keep
+   their numbers when the oldest segments are dropped to stay under the
+   memory limit, so the segment holding a byte is found by division.
+   Only one thread adds bytes and calls RawPeek(); any thread may use
+   RawHold(), RawRelease() and RawTime().
+*/
+typedef struct {
+  CRITICAL_SECTION Lock;        ///< Guards the segment list, lengths, marks and Refs.
+  TRawSeg **Segs;               ///< Segments, oldest first.
+  int NSegs;                    ///< Number of segments in use.
+  int MaxSegs;                  ///< Segment limit, from the memory limit.
+  unsigned long long Base;      ///< Number of the oldest byte held.  A multiple of RAW_SEG.
+  unsigned long long End;       ///< Number the next byte added will get.  Changed under the lock.
+  int LineStart;                ///< Flag: the next byte added starts a line.
+  LONGLONG Freq;                ///< QueryPerformanceFrequency(), to convert times.
+  LONGLONG Qpc0;                ///< QueryPerformanceCounter() when the history was created...
+  unsigned long long Ft0;       ///< ...and the system time then, as a FILETIME.
+} TRawHist;
+
+TRawHist *RawCreate(unsigned long MaxBytes);
+void RawDestroy(TRawHist *h);
+void RawSetLimit(TRawHist *h,unsigned long MaxBytes);
+char *RawReserve(TRawHist *h,int *len);
+void RawCommit(TRawHist *h,int len,LONGLONG Time);
+void RawAppend(TRawHist *h,const char *buf,int len,LONGLONG Time);
+const char *RawPeek(TRawHist *h,unsigned long long Pos,int *len);
+const char *RawHold(TRawHist *h,unsigned long long *Pos,int *len,TRawSeg **Seg);
+void RawRelease(TRawHist *h,TRawSeg *Seg);
+LONGLONG RawTime(TRawHist *h,unsigned long long Pos);
+int RawLocalTime(TRawHist *h,LONGLONG Time,SYSTEMTIME *St);
+int RawStamp(TRawHist *h,LONGLONG Time,char *s);
+
+#endif
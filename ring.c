@@ -0,0 +1,244 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file ring.c This file implements a lock-free byte ring buffer.
+  @defgroup ring Ring Buffer
+
+  @section intro Introduction
+
+  The ring is the hand-off between the serial port and the user
+  interface.  The serial I/O pool writes into it as fast as the port delivers,
+  and the UI drains it whenever it gets around to it.  Neither side ever
+  waits for the other; if the UI falls behind far enough to fill the ring,
+  new data is dropped and counted, so that the loss is visible instead of
+  showing up as an overrun in the driver.
+
+  Only one thread may write and only one thread may read a given ring at
+  a time.  The writer may change between calls, as the pool threads take
+  turns completing a port's reads, as long as the calls don't overlap.
+  The code uses no OS calls, only the GCC atomic builtins, which MinGW
+  supports.
+  @{
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "ring.h"
+
+/// Reads an index written by the other thread.
+#define LOAD(x)      __atomic_load_n(&(x),__ATOMIC_ACQUIRE)
+/// Publishes an index to the other thread.
+#define STORE(x,v)   __atomic_store_n(&(x),(v),__ATOMIC_RELEASE)
+
+/**
+   Creates a ring buffer.
+   @param Size Requested capacity in bytes.  Rounded up to a power of two.
+   @return Pointer to new ring, or NULL if the memory could not be allocated.
+ */
+TRing *RingCreate(unsigned long Size)
+{
+  TRing *r;
+  unsigned long n = 4096;
+
+  while (n < Size && n < 0x40000000UL)
+    n <<= 1;
+
+  r = malloc(sizeof(TRing));
+  if (!r)
+    return NULL;
+  memset(r,0,sizeof(TRing));
+  r->Buf = malloc(n);
+  if (!r->Buf)
+    {
+      free(r);
+      return NULL;
+    }
+  r->Size = n;
+  r->Mask = n - 1;
+  return r;
+}
+
+/**
+   De-allocates a ring buffer.  Both threads must be done with it.
+   @param r Pointer to ring to destroy.
+ */
+void RingDestroy(TRing *r)
+{
+  if (!r)
+    return;
+  free(r->Buf);
+  free(r);
+}
+
+/**
+   Returns the number of bytes waiting to be read.  May be called from
+   either thread.
+   @param r Pointer to ring.
+ */
+unsigned long RingCount(TRing *r)
+{
+  return LOAD(r->Head) - LOAD(r->Tail);
+}
+
+/**
+   Producer: copies data into the ring.  Whatever does not fit is dropped and
+   counted.
+   @param r Pointer to ring.
+   @param data Bytes to add.
+   @param len Number of bytes to add.
+   @return Number of bytes actually stored.
+ */
+unsigned long RingWrite(TRing *r,const void *data,unsigned long len)
+{
+  unsigned long n,done=0;
+  char *p;
+
+  while (done < len)
+    {
+      n = RingWritePtr(r,&p);
+      if (!n)
+        break;
+      if (n > len - done)
+        n = len - done;
+      memcpy(p,(const char *)data + done,n);
+      RingCommit(r,n);
+      done += n;
+    }
+  if (done < len)
+    RingDrop(r,len - done);
+  return done;
+}
+
+/**
+   Producer: gets the contiguous free space at the head of the ring, so that
+   data can be placed there directly (by ReadFile(), for example).  Follow
+   with RingCommit().
+   @param r Pointer to ring.
+   @param p Receives a pointer to the free space.
+   @return Number of contiguous bytes available, zero if the ring is full.
+ */
+unsigned long RingWritePtr(TRing *r,char **p)
+{
+  unsigned long Head = r->Head;
+  unsigned long Free = r->Size - (Head - LOAD(r->Tail));
+  unsigned long Edge = r->Size - (Head & r->Mask);
+
+  *p = r->Buf + (Head & r->Mask);
+  return Free < Edge ? Free : Edge;
+}
+
+/**
+   Producer: makes bytes placed with RingWritePtr() visible to the consumer.
+   @param r Pointer to ring.
+   @param n Number of bytes written.
+ */
+void RingCommit(TRing *r,unsigned long n)
+{
+  STORE(r->Head,r->Head + n);
+}
+
+/**
+   Producer: records bytes that were lost because the ring was full.
+   @param r Pointer to ring.
+   @param n Number of bytes lost.
+ */
+void RingDrop(TRing *r,unsigned long n)
+{
+  STORE(r->Dropped,r->Dropped + n);
+  STORE(r->Overflows,r->Overflows + 1);
+}
+
+/**
+   Consumer: copies bytes out of the ring.
+   @param r Pointer to ring.
+   @param data Destination buffer.
+   @param len Size of destination buffer.
+   @return Number of bytes copied, zero if the ring is empty.
+ */
+unsigned long RingRead(TRing *r,void *data,unsigned long len)
+{
+  unsigned long n,done=0;
+  const char *p;
+
+  while (done < len)
+    {
+      n = RingReadPtr(r,&p);
+      if (!n)
+        break;
+      if (n > len - done)
+        n = len - done;
+      memcpy((char *)data + done,p,n);
+      RingSkip(r,n);
+      done += n;
+    }
+  return done;
+}
+
+/**
+   Consumer: gets the contiguous readable bytes at the tail of the ring,
+   without copying them.  Follow with RingSkip().
+   @param r Pointer to ring.
+   @param p Receives a pointer to the data.
+   @return Number of contiguous bytes available, zero if the ring is empty.
+ */
+unsigned long RingReadPtr(TRing *r,const char **p)
+{
+  unsigned long Tail = r->Tail;
+  unsigned long Used = LOAD(r->Head) - Tail;
+  unsigned long Edge = r->Size - (Tail & r->Mask);
+
+  *p = r->Buf + (Tail & r->Mask);
+  return Used < Edge ? Used : Edge;
+}
+
+/**
+   Consumer: releases bytes obtained with RingReadPtr().
+   @param r Pointer to ring.
+   @param n Number of bytes consumed.
+ */
+void RingSkip(TRing *r,unsigned long n)
+{
+  STORE(r->Tail,r->Tail + n);
+}
+
+/**
+   Returns the total number of bytes dropped because the ring was full.
+   @param r Pointer to ring.
+ */
+unsigned long RingDropped(TRing *r)
+{
+  return LOAD(r->Dropped);
+}
+
+/**
+   Returns the number of writes that were truncated because the ring was full.
+   @param r Pointer to ring.
+ */
+unsigned long RingOverflows(TRing *r)
+{
+  return LOAD(r->Overflows);
+}
+
+/**
+   @}
+*/
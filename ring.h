@@ -0,0 +1,62 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef RING_H
+#define RING_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file ring.h Lock-free single-producer/single-consumer byte ring.
+   @addtogroup ring
+ */
+
+/**
+   A byte FIFO shared by exactly one producer thread and one consumer thread.
+   Head is only written by the producer and Tail only by the consumer, so no
+   locks are needed.  Both indices run freely and are masked on access.
+*/
+typedef struct {
+  char *Buf;                    ///< Storage, Size bytes.
+  unsigned long Size;           ///< Capacity in bytes, always a power of two.
+  unsigned long Mask;           ///< Size - 1.
+  unsigned long Head;           ///< Total bytes written.  Producer only.
+  char Pad1[64];                ///< Keeps Head and Tail in different cache lines.
+  unsigned long Tail;           ///< Total bytes read.  Consumer only.
+  char Pad2[64];
+  unsigned long Dropped;        ///< Bytes discarded because the ring was full.
+  unsigned long Overflows;      ///< Number of writes that did not fit.
+} TRing;
+
+TRing *RingCreate(unsigned long Size);
+void RingDestroy(TRing *r);
+unsigned long RingCount(TRing *r);
+unsigned long RingWrite(TRing *r,const void *data,unsigned long len);
+unsigned long RingWritePtr(TRing *r,char **p);
+void RingCommit(TRing *r,unsigned long n);
+void RingDrop(TRing *r,unsigned long n);
+unsigned long RingRead(TRing *r,void *data,unsigned long len);
+unsigned long RingReadPtr(TRing *r,const char **p);
+void RingSkip(TRing *r,unsigned long n);
+unsigned long RingDropped(TRing *r);
+unsigned long RingOverflows(TRing *r);
+
+#endif
@@ -0,0 +1,346 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file search.c This file implements the text matching used by Find.
+  @defgroup search Text Search
+
+  @section intro Introduction
+
+  Find has to get through millions of lines of scrollback, so the first step
+  of every search is a memchr() for the byte a match must start with.  The C
+  library's memchr() scans a word or a vector register at a time, which skips
+  over most of a line without looking at each byte.  Only where the lead byte
+  turns up is the full pattern tried.
+
+  Regular expressions are a small backtracking subset, enough for searching
+  terminal output:
+    - c matches the character c, and \\c matches c literally.
+    - . matches any character.
+    - [abc], [a-z] and [^abc] match a character class.
+    - \\d, \\w and \\s match a digit, word character or white space.
+    - *, + and ? repeat the item before them, longest match first.
+    - ^ and $ match the start and end of the line.
+  @{
+ */
+#include <ctype.h>
+#include <string.h>
+#include "search.h"
+
+/**
+   Finds the length of the pattern item at re.
+   @param re Pattern, at the start of an item.
+   @return Length of the item, or 0 if it is malformed.
+ */
+static int ItemLen(const char *re)
+{
+  const char *p = re;
+
+  if (*p == '\\')
+    return p[1] ? 2 : 0;
+  if (*p != '[')
+    return 1;
+  p++;
+  if (*p == '^')
+    p++;
+  if (*p == ']')                // a leading ] is part of the class
+    p++;
+  for (;*p && *p != ']';p++)
+    if (*p == '\\' && !*++p)
+      return 0;
+  return *p ? p + 1 - re : 0;
+}
+
+/**
+   Matches a character against a class escape like \\d, or a literal.
+   @param e The character after the backslash.
+   @param c Character to test.
+   @return Nonzero if it matches.
+ */
+static int EscMatch(int e,int c)
+{
+  switch (e)
+    {
+    case 'd':
+      return isdigit(c);
+    case 'w':
+      return isalnum(c) || c == '_';
+    case 's':
+      return isspace(c);
+    default:
+      return c == e;
+    }
+}
+
+/**
+   Matches a character against one pattern item.
+   @param p Pattern, for the case flag.
+   @param re Item: a character, ., an escape or a class.
+   @param c Character to test.
+   @return Nonzero if it matches.
+ */
+static int ItemMatch(TPattern *p,const char *re,int c)
+{
+  int Neg = 0,Hit = 0;
+  int lo,hi;
+
+  c = (unsigned char)c;
+  if (p->NoCase)
+    c = tolower(c);
+  switch (*re)
+    {
+    case '.':
+      return 1;
+    case '\\':
+      return EscMatch(p->NoCase ? tolower((unsigned char)re[1]) : re[1],c);
+    case '[':
+      break;
+    default:
+      return c == (p->NoCase ? tolower((unsigned char)*re) : (unsigned char)*re);
+    }
+
+  // character class
+  re++;
+  if (*re == '^')
+    {
+      Neg = 1;
+      re++;
+    }
+  do
+    {
+      if (*re == '\\')
+        {
+          Hit |= EscMatch(*++re,c);
+          continue;
+        }
+      lo = hi = (unsigned char)*re;
+      if (re[1] == '-' && re[2] && re[2] != ']')
+        {
+          hi = (unsigned char)re[2];
+          re += 2;
+        }
+      if (p->NoCase)
+        Hit |= (c >= tolower(lo) && c <= tolower(hi)) || (c >= toupper(lo) && c <= toupper(hi));
+      else
+        Hit |= c >= lo && c <= hi;
+    }
+  while (*++re != ']');
+  return Hit != Neg;
+}
+
+/**
+   Matches the rest of a regular expression at one place in the line.
+   @param p Pattern.
+   @param re Rest of the regular expression.
+   @param s Place in the line.
+   @param end End of the line.
+   @param mend Receives the end of the match.
+   @return Nonzero if it matches.
+ */
+static int MatchHere(TPattern *p,const char *re,const char *s,const char *end,const char **mend)
+{
+  int n,k,min;
+
+  for (;;)
+    {
+      if (!*re)
+        {
+          *mend = s;
+          return 1;
+        }
+      if (re[0] == '$' && !re[1])
+        {
+          *mend = s;
+          return s == end;
+        }
+
+      n = ItemLen(re);
+      switch (re[n])
+        {
+        case '*':
+        case '+':
+        case '?':
+          // take as many as possible, then back off until the rest matches
+          min = re[n] == '+';
+          for (k=0;s + k < end && (re[n] != '?' || k < 1) && ItemMatch(p,re,s[k]);k++)
+            ;
+          for (;k >= min;k--)
+            if (MatchHere(p,re + n + 1,s + k,end,mend))
+              return 1;
+          return 0;
+        }
+
+      if (s == end || !ItemMatch(p,re,*s))
+        return 0;
+      re += n;
+      s++;
+    }
+}
+
+/**
+   Prepares a pattern for searching.
+   @param p Pattern to fill in.
+   @param Text The pattern as typed, NUL terminated.
+   @param Regex Nonzero if Text is a regular expression, zero for a plain string.
+   @param NoCase Nonzero to ignore case.
+   @return Nonzero if the pattern is OK, zero if it is empty, too long, or not
+   a valid regular expression.
+ */
+int PatCompile(TPattern *p,const char *Text,int Regex,int NoCase)
+{
+  const char *re;
+  int n;
+
+  memset(p,0,sizeof(TPattern));
+  p->Len = strlen(Text);
+  if (!p->Len || p->Len >= PAT_MAX)
+    return 0;
+  strcpy(p->Text,Text);
+  p->Regex = Regex;
+  p->NoCase = NoCase;
+  p->Lead = (unsigned char)Text[0];
+
+  if (Regex)
+    {
+      // check the syntax, so matching never has to
+      re = Text;
+      if (*re == '^')
+        {
+          p->Anchored = 1;
+          re++;
+        }
+      while (*re)
+        {
+          if (*re == '*' || *re == '+' || *re == '?')
+            return 0;
+          if (*re == '$' && !re[1])
+            break;
+          if (!(n = ItemLen(re)))
+            return 0;
+          re += n;
+          if (*re == '*' || *re == '+' || *re == '?')
+            re++;
+        }
+
+      // a plain first character that can't be skipped gives a lead byte
+      re = Text + p->Anchored;
+      n = ItemLen(re);
+      if (strchr(".[\\$",*re) || re[n] == '*' || re[n] == '?')
+        p->Lead = -1;
+      else
+        p->Lead = (unsigned char)*re;
+    }
+  if (NoCase && p->Lead >= 0)
+    p->Lead = tolower(p->Lead);
+  return 1;
+}
+
+/**
+   Finds the next place in s that could start a match: an occurrence of the lead
+   byte, in either case if case is ignored.
+   @param p Pattern.
+   @param s Start of text to scan.
+   @param end End of text.
+   @return Pointer to the lead byte, or NULL if there is none.
+ */
+static const char *FindLead(TPattern *p,const char *s,const char *end)
+{
+  const char *a,*b;
+  int up;
+
+  if (p->Lead < 0)
+    return s < end ? s : NULL;
+  a = memchr(s,p->Lead,end - s);
+  up = p->NoCase ? toupper(p->Lead) : p->Lead;
+  if (up == p->Lead)
+    return a;
+  b = memchr(s,up,(a ? a : end) - s);
+  return b ? b : a;
+}
+
+/**
+   Searches one line for a pattern.
+   @param p Compiled pattern.
+   @param s Text of the line, not NUL terminated.
+   @param len Length of the line.
+   @param from Column to start looking from.
+   @param start Receives the column of the first match.
+   @param end Receives the column after the first match.  A regular expression
+   can match an empty string, so this may equal start.
+   @return Nonzero if a match was found.
+ */
+int PatMatch(TPattern *p,const char *s,int len,int from,int *start,int *end)
+{
+  const char *e = s + len;
+  const char *q = s + from;
+  const char *m;
+  int i;
+
+  if (p->Anchored)
+    {
+      if (from || !MatchHere(p,p->Text + 1,s,e,&m))
+        return 0;
+      *start = 0;
+      *end = m - s;
+      return 1;
+    }
+
+  for (;(q = FindLead(p,q,e)) != NULL;q++)
+    {
+      if (p->Regex)
+        {
+          if (!MatchHere(p,p->Text,q,e,&m))
+            continue;
+        }
+      else
+        {
+          if (e - q < p->Len)
+            return 0;
+          if (p->NoCase)
+            {
+              for (i=1;i<p->Len && tolower((unsigned char)q[i]) == tolower((unsigned char)p->Text[i]);i++)
+                ;
+              if (i < p->Len)
+                continue;
+            }
+          else if (memcmp(q + 1,p->Text + 1,p->Len - 1))
+            continue;
+          m = q + p->Len;
+        }
+      *start = q - s;
+      *end = m - s;
+      return 1;
+    }
+
+  // a regex like "x*" or "$" can match at the very end
+  if (p->Regex && p->Lead < 0 && MatchHere(p,p->Text,e,e,&m))
+    {
+      *start = *end = len;
+      return 1;
+    }
+  return 0;
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,49 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef SEARCH_H
+#define SEARCH_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file search.h Text search patterns.
+   @addtogroup search
+ */
+
+#define PAT_MAX 256             ///< Longest pattern, including the NUL.
+
+/**
+   A compiled search pattern, either a plain string or a regular expression.
+*/
+typedef struct {
+  char Text[PAT_MAX];           ///< The pattern as typed.
+  int Len;                      ///< Length of Text.
+  int Regex;                    ///< Flag: Text is a regular expression.
+  int NoCase;                   ///< Flag: ignore case.
+  int Lead;                     ///< Byte every match starts with, or -1 if not known.
+  int Anchored;                 ///< Flag: regex starts with ^, matches only at the line start.
+} TPattern;
+
+int PatCompile(TPattern *p,const char *Text,int Regex,int NoCase);
+int PatMatch(TPattern *p,const char *s,int len,int from,int *start,int *end);
+
+#endif
@@ -38,8 +38,9 @@
   
   You can use this file without the terminal application as a serial port driver under windows.
   The interface is simple to use, involving just a few basic functions, in this order:
+  - SerialSetRxBufSize() and SerialSetQueueSizes() (optional)
   - OpenPort()
-  - PutSerialChar()
+  - PutSerialChar() or PutSerialBuf()
   - SerialIsChar()
   - SerialGetChar()
   - CloseSerialPort()
@@ -47,25 +48,116 @@
   If you create a Win32 program using this interface, it will be easier to simply pass the handle
   of your main window to OpenPort, and then your main window will receive MESS_SERIAL messages
   every time incoming characters are availble.  All you have to do is handle the MESS_SERIAL
-  message.  See the FUNterm application for details.  As a Win32 app, you would not need to call
-  SerialGetChar() directly.
+  message by calling SerialRead() until it returns zero.  See the FUNterm application for details.
+  As a Win32 app, you would not need to call SerialGetChar() directly.
 
-  Note that this implementation only allows one open serial port at a time.  Having multiple serial
-  ports open at once is left as an excerise to the reader.
+  @section multi Multiple Ports
+
+  The functions above work on one port.  To have several ports open at once, use
+  SerialPortOpen(), which returns a TSerial for each port, and pass that to the
+  SerialPort...() functions.  Every port has its own rings, so a busy port never holds up
+  the others.  MESS_SERIAL and MESS_CTS carry the TSerial in lParam, so one window can
+  serve several ports.  The single-port functions are wrappers that use a default port.
+
+  @section engine How It Works
+
+  Ports have no threads of their own.  All reads and writes are overlapped, and every open
+  port is tied to one I/O completion port, where a pool of IO_THREADS threads completes them
+  and starts the next.  An idle port has a WaitCommEvent() outstanding and costs nothing, and
+  however many ports are busy, only the pool threads run for them.
+
+  Received characters are read straight into a lock-free ring buffer (see ring.c), so the pool
+  never waits for the application.  MESS_SERIAL is posted, not sent, and only once until the
+  application reads from the ring again.  If the application falls behind by more than the
+  ring size, the excess is dropped and counted; see SerialPortRxDropped().  The time each read
+  finished is kept alongside, for SerialPortReadStamped().
+
+  While characters trickle in, each read returns at once, for the lowest latency.  Under load,
+  reads wait a few milliseconds to gather a larger chunk, sized to the rate characters arrive
+  at, so there are fewer of them; see AdaptRead().  The driver's own queues are sized to hold
+  QUEUE_MS of characters at the baud rate, unless set with SerialSetQueueSizes(), so the driver
+  doesn't overrun while a read is on its way.
+
+  Characters to send go the other way, through a second ring.  SerialPortPut() copies them in
+  and returns, and the pool hands them to the driver in large writes, so sending a file costs
+  a few WriteFile() calls a second instead of one per byte.  SerialPortWrite() skips the ring
+  and writes straight from the caller's buffer, for sending memory mapped files.  A port has
+  one write in progress at a time.
+
+  Hardware flow control is left to the driver (fOutxCtsFlow), which holds the writes while CTS
+  is off, so nothing polls the modem lines.  The port also waits for EV_CTS, to keep track
+  of when the transmitter is held off: MESS_CTS is posted when that starts and stops, and
+  SerialPortTxBlockedTime() adds up how long it lasted.  While a port is held off, the pool
+  also wakes every WATCH_MS to check on it, and a SerialPortWrite() only gives up once CTS
+  has been off for CTS_TIMEOUT.
+
+  Line errors are counted too, so garbled characters can be told apart from dropped ones.
+  The port waits for EV_ERR, and while reads are batching, checks after each one, since then
+  there is no WaitCommEvent() outstanding.  ClearCommError() reports overruns, framing and
+  parity errors and Rx queue overflows, which are added up with the bytes in and out and
+  returned by SerialPortStats(); MESS_LINEERR is posted when they go up.
   @{
  */
+#include <string.h>
+#include <stdlib.h>
 #include "serial.h"
 
+// Defines:
+#define TX_BUF (1024*1024)  ///< Size of the Tx ring in bytes.
+#define TX_CHUNK 65536      ///< Most bytes handed to the driver in one write.
+#define TX_STALL 5000       ///< Milliseconds a write may make no progress, CTS aside.
+#define IO_THREADS 2        ///< Threads in the pool that completes I/O for all ports.
+#define WATCH_MS 250        ///< Milliseconds between checks on ports that need watching, see Watchdog().
+#define QUEUE_MS 200        ///< Driver queues hold this much time at the baud rate, unless set.
+#define QUEUE_MIN 4096      ///< Smallest driver queue sized from the baud rate.
+#define QUEUE_MAX 65536     ///< Largest driver queue sized from the baud rate.
+#define RX_RUN 4            ///< Reads in a row that find characters before reads start batching.
+#define RX_BATCH_MS 8       ///< Most milliseconds a batching read waits to fill, half a 60 Hz frame.
+#define RX_MIN_CHUNK 256    ///< Smallest read while batching.
+#define RX_MAX_CHUNK 65536  ///< Largest read while batching.
+
+// TSerialIo operations
+#define IO_READ 0           ///< ReadFile() into RxRing.
+#define IO_WAIT 1           ///< WaitCommEvent(), for characters or CTS.
+#define IO_WRITE 2          ///< WriteFile() from TxRing or ExtBuf.
+#define IO_KICK 3           ///< Posted by Kick(), to start writing.
+
 // Functions:
-HANDLE StartCommThread(void);
-DWORD WINAPI ThreadProc(void *p);
+static DWORD QueueSize(unsigned long Size,int baud);
+static void SetTimeouts(HANDLE Port,int HwFc,int Batch);
+static void AdaptRead(TSerial *s,DWORD Cnt);
+static BOOL AddPort(TSerial *s);
+static void RemovePort(TSerial *s);
+DWORD WINAPI PoolProc(void *p);
+static void Complete(TSerial *s,TSerialIo *io,BOOL ok,DWORD Cnt);
+static BOOL StartIo(TSerial *s,TSerialIo *io,int Op,const char *buf,DWORD n);
+static void StartRead(TSerial *s);
+static void StartWait(TSerial *s);
+static void Kick(TSerial *s);
+static void TxNext(TSerial *s);
+static void Wrote(TSerial *s,DWORD Cnt);
+static void EndExt(TSerial *s,int Result);
+static void SetRetry(TSerial *s,volatile LONG *Flag);
+static void Watch(int n);
+static void Watchdog(void);
+static void SetFlowState(TSerial *s,int Cts,int Busy);
+static void PollCts(TSerial *s);
+static DWORD BlockedFor(TSerial *s);
+static void CheckErrors(TSerial *s);
+static void AddMark(TSerial *s,DWORD Cnt);
 
 // Variables:
-HANDLE SerialPort=NULL;  ///< Handle of SerialPort itself.
-HANDLE Thread;           ///< Handle to the Rx thread.
-HWND handle=NULL;        ///< Handle to window that receives MESS_SERIAL messages.
-int StopThread=0;        ///< Flag: set to non-zero to stop the Rx thread.
-int FlowControl=0;       ///< Flag: is hardware flow-control active?
+TSerial *DefaultPort=NULL;  ///< Port used by OpenPort() and the other single-port functions.
+unsigned long RxBufSize=4*1024*1024;  ///< Size of each port's RxRing, see SerialSetRxBufSize().
+unsigned long RxQueueSize=0;  ///< Driver Rx queue size, or 0 to size it from the baud rate.  See SerialSetQueueSizes().
+unsigned long TxQueueSize=0;  ///< Driver Tx queue size, or 0 to size it from the baud rate.
+HANDLE Iocp=NULL;           ///< The I/O completion port all open ports are tied to, or NULL.
+HANDLE Workers[IO_THREADS]; ///< The pool threads waiting on Iocp.
+TSerial *Ports=NULL;        ///< List of open ports, for Watchdog().
+SRWLOCK PortLock=SRWLOCK_INIT;  ///< Guards Ports, Iocp and Workers.
+volatile LONG Watched=0;    ///< Number of reasons to run Watchdog(): ports held off by CTS or waiting to retry.
+volatile LONG LastWatch=0;  ///< GetTickCount() when Watchdog() last ran.
+OVERLAPPED PoolWake;        ///< Posted to wake a pool thread when Watched goes up from zero.
 
 
 /**
@@ -94,51 +186,62 @@ void ShowLastError(void)
 
 
 /**
-   Opens the COMM Port.
+   Opens a COMM Port, and ties it to the I/O completion port, starting the
+   pool if this is the first port open.
    @param port Port number.  COMM1 = 1, COMM2 = 2, etc.
    @param baud Baud rate, in BPS.  Commonly 9600, 38400, etc.
    @param HwFc Set to non-zero to use hardware flow-control, or zero
    for no flow control.
    @param hwnd Window handle to recieve MESS_SERIAL messages.  If set to NULL,
-   you can still get characters using SerialGetChar().
-   @return TRUE if port was opened, FALSE if opening failed.
+   you can still get characters using SerialPortRead().
+   @return Pointer to the new port, or NULL if opening failed.
  */
-BOOL OpenPort(int port,int baud,int HwFc, HWND hwnd)
+TSerial *SerialPortOpen(int port,int baud,int HwFc, HWND hwnd)
 {
   HANDLE Comport;
   DCB myDCB;
-  COMMTIMEOUTS CTout;
   char str[100];
-  
-  FlowControl = HwFc;
+  TSerial *s;
   
   // Open the serial port
   if (port > 9)
     sprintf(str,"\\\\.\\COM%d",port);
   else
     sprintf(str,"COM%d",port);
+  // The port is opened for overlapped I/O, so that no thread has to wait
+  // for it: the pool is told when something happens.
   Comport = CreateFile(str,GENERIC_READ|GENERIC_WRITE,0,
-                       NULL,OPEN_EXISTING,0,NULL);
+                       NULL,OPEN_EXISTING,FILE_FLAG_OVERLAPPED,NULL);
   if (Comport == INVALID_HANDLE_VALUE)
-    return FALSE;
-  // Configure Serial port (Setup Comm)
-  if (!SetupComm(Comport,350,20)) // Buffer sizes
-    return FALSE;
+    return NULL;
+  // Configure Serial port (Setup Comm).  Big enough queues that the
+  // driver doesn't overrun while the pool is busy with other ports; if
+  // the driver won't take the sizes asked for, try the usual ones.
+  if (!SetupComm(Comport,QueueSize(RxQueueSize,baud),QueueSize(TxQueueSize,baud)) &&
+      !SetupComm(Comport,QueueSize(0,baud),QueueSize(0,baud)))
+    {
+      CloseHandle(Comport);
+      return NULL;
+    }
   
   // setup DCB using current values
   if (!GetCommState(Comport,&myDCB))
-    return FALSE;
+    {
+      CloseHandle(Comport);
+      return NULL;
+    }
   myDCB.fInX = FALSE;     // Turn off xon/xoff handler
   myDCB.fOutX = FALSE;
   myDCB.fOutxDsrFlow = FALSE;
-  if (HwFc)       // no flow control
+  if (HwFc)       // hardware flow control
     {
-      myDCB.fOutxCtsFlow = TRUE;     // no hardware flow control.
+      myDCB.fOutxCtsFlow = TRUE;     // driver holds writes while CTS is off
       myDCB.fRtsControl = RTS_CONTROL_HANDSHAKE;
     }
   else
     {
       myDCB.fOutxCtsFlow = FALSE;    // no hardware flow control.
+      myDCB.fRtsControl = RTS_CONTROL_DISABLE;
     }
   
   myDCB.BaudRate = baud;
@@ -148,8 +251,8 @@ BOOL OpenPort(int port,int baud,int HwFc, HWND hwnd)
   myDCB.fDtrControl = DTR_CONTROL_DISABLE;
   myDCB.fDsrSensitivity = 0;
   myDCB.fTXContinueOnXoff = 1;
+  myDCB.fAbortOnError = 0;    // line errors are counted, see CheckErrors()
   myDCB.fNull = 0;
-  myDCB.fRtsControl = RTS_CONTROL_DISABLE;
   myDCB.fDummy2 = 0;
   myDCB.wReserved = 0;
   myDCB.Parity = NOPARITY;
@@ -161,180 +264,1074 @@ BOOL OpenPort(int port,int baud,int HwFc, HWND hwnd)
   if (!SetCommState(Comport,&myDCB))
     {
       ShowLastError();
-      return FALSE;
+      CloseHandle(Comport);
+      return NULL;
     }
   
-        // Set timeouts
-  CTout.ReadIntervalTimeout = 0xffffffff;
-  CTout.ReadTotalTimeoutMultiplier = 0;
-  CTout.ReadTotalTimeoutConstant = 0;
-  CTout.WriteTotalTimeoutMultiplier = 0;
-  CTout.WriteTotalTimeoutConstant = 5000;         // don't hang if CTS is locked, for example
-  
-  SetCommTimeouts(Comport,&CTout);
+  SetTimeouts(Comport,HwFc,FALSE);
   
   EscapeCommFunction(Comport,SETDTR);
   PurgeComm(Comport,PURGE_TXCLEAR | PURGE_RXCLEAR);
 
-  handle = hwnd;
-  SerialPort = Comport;
-  StartCommThread();
+  // Only complete WaitCommEvent() when characters arrive, a line error
+  // is seen, or CTS changes
+  if (!SetCommMask(Comport,HwFc ? EV_RXCHAR|EV_ERR|EV_CTS : EV_RXCHAR|EV_ERR))
+    {
+      CloseHandle(Comport);
+      return NULL;
+    }
 
-  return TRUE;
+  s = calloc(1,sizeof(TSerial));
+  if (!s)
+    {
+      CloseHandle(Comport);
+      return NULL;
+    }
+  s->RxRing = RingCreate(RxBufSize);
+  s->TxRing = RingCreate(TX_BUF);
+  if (!s->RxRing || !s->TxRing)
+    {
+      RingDestroy(s->RxRing);
+      RingDestroy(s->TxRing);
+      free(s);
+      CloseHandle(Comport);
+      return NULL;
+    }
+  // small enough writes that a stop request or a CTS timeout isn't held up long
+  s->TxChunk = baud/40;
+  if (s->TxChunk < 64)
+    s->TxChunk = 64;
+  if (s->TxChunk > TX_CHUNK)
+    s->TxChunk = TX_CHUNK;
+
+  s->Handle = Comport;
+  s->Number = port;
+  s->Wnd = hwnd;
+  s->FlowControl = HwFc;
+  s->CtsOn = TRUE;
+  s->RxChunk = RX_MIN_CHUNK;
+  s->Pending = 1;       // the open port itself, see SerialPortClose()
+  s->Idle = CreateEvent(NULL,TRUE,FALSE,NULL);
+  s->TxSpace = CreateEvent(NULL,FALSE,FALSE,NULL);
+  s->ExtDone = CreateEvent(NULL,FALSE,FALSE,NULL);
+  InitializeCriticalSection(&s->IoLock);
+  InitializeCriticalSection(&s->FlowLock);
+  PollCts(s);
+  if (!s->Idle || !s->TxSpace || !s->ExtDone || !AddPort(s))
+    {
+      SerialPortClose(s);
+      return NULL;
+    }
+
+  // from here on, there is always a read or a WaitCommEvent() in progress
+  StartRead(s);
+  return s;
 }
 
 /**
-   Closes the serial port.  Stops the Rx thread.
+   Closes a serial port opened with SerialPortOpen().  Cancels the port's
+   I/O, and waits for the pool to be done with it.  Characters not yet sent
+   are discarded.  Any SerialPortWrite() on the port must have returned
+   first.
+   @param s The port.  May be NULL.
+*/
+void SerialPortClose(TSerial *s)
+{
+  if (!s) return;
+
+  // start no more I/O, and cancel what is in progress
+  EnterCriticalSection(&s->IoLock);
+  s->Closing = TRUE;
+  CancelIoEx(s->Handle,NULL);
+  LeaveCriticalSection(&s->IoLock);
+  // the cancelled operations still come back through the pool
+  if (InterlockedDecrement(&s->Pending))
+    WaitForSingleObject(s->Idle,INFINITE);
+  RemovePort(s);
+  // nothing is left to watch
+  if (InterlockedExchange(&s->RxRetry,FALSE))
+    Watch(-1);
+  if (InterlockedExchange(&s->TxRetry,FALSE))
+    Watch(-1);
+  if (s->Blocked)
+    Watch(-1);
+
+  PurgeComm(s->Handle,PURGE_TXCLEAR | PURGE_RXCLEAR);
+  CloseHandle(s->Handle);
+  if (s->Idle)
+    CloseHandle(s->Idle);
+  if (s->TxSpace)
+    CloseHandle(s->TxSpace);
+  if (s->ExtDone)
+    CloseHandle(s->ExtDone);
+  DeleteCriticalSection(&s->IoLock);
+  DeleteCriticalSection(&s->FlowLock);
+  RingDestroy(s->RxRing);
+  RingDestroy(s->TxRing);
+  free(s);
+}
+
+/**
+   Opens the COMM Port as the default port, used by the single-port functions.
+   See SerialPortOpen() for the parameters.
+   @return TRUE if port was opened, FALSE if opening failed.
+ */
+BOOL OpenPort(int port,int baud,int HwFc, HWND hwnd)
+{
+  CloseSerialPort();
+  DefaultPort = SerialPortOpen(port,baud,HwFc,hwnd);
+  return DefaultPort != NULL;
+}
+
+/**
+   Closes the default serial port.
 */
 void CloseSerialPort(void)
 {
-  if (!SerialPort) return;
-  
-  if (Thread)
+  SerialPortClose(DefaultPort);
+  DefaultPort = NULL;
+}
+
+/**
+   Internal function that works out the size of a driver queue.
+   @param Size Size set with SerialSetQueueSizes(), or 0.
+   @param baud Baud rate of the port.
+   @return Size in bytes; QUEUE_MS worth of characters if Size is 0.
+ */
+static DWORD QueueSize(unsigned long Size,int baud)
+{
+  if (Size)
+    return Size;
+  Size = baud/10 * QUEUE_MS/1000;
+  if (Size < QUEUE_MIN)
+    Size = QUEUE_MIN;
+  if (Size > QUEUE_MAX)
+    Size = QUEUE_MAX;
+  return Size;
+}
+
+/**
+   Internal function that sets the timeouts of a port.  Normally reads return
+   immediately with whatever is in the driver's queue, and WaitCommEvent()
+   tells when there is more to read.  Batching reads wait up to RX_BATCH_MS
+   for their buffer to fill, see AdaptRead().
+   @param Port Handle of the port.
+   @param HwFc Flag: hardware flow control is on.
+   @param Batch Flag: set the timeouts for batching reads.
+ */
+static void SetTimeouts(HANDLE Port,int HwFc,int Batch)
+{
+  COMMTIMEOUTS CTout;
+
+  CTout.ReadIntervalTimeout = Batch ? 0 : MAXDWORD;
+  CTout.ReadTotalTimeoutMultiplier = 0;
+  CTout.ReadTotalTimeoutConstant = Batch ? RX_BATCH_MS : 0;
+  CTout.WriteTotalTimeoutMultiplier = 0;
+  // With flow control, a write may wait on CTS for a long time; Watchdog()
+  // times that out itself.  Without it, don't hang on a stuck driver.
+  CTout.WriteTotalTimeoutConstant = HwFc ? 0 : TX_STALL;
+  SetCommTimeouts(Port,&CTout);
+}
+
+/**
+   Internal function that sizes reads to the rate characters arrive at.
+   While they trickle in, each read returns at once with what the driver
+   has, and the port waits for the next one, for the lowest latency.  Once
+   RX_RUN reads in a row find characters, reads start batching: they wait
+   up to RX_BATCH_MS to gather RxChunk, so there are far fewer of them.
+   RxChunk doubles while reads fill it and halves while they come back less
+   than a quarter full.  A batching read that finds nothing at all goes
+   back to the start.
+   @param s The port.
+   @param Cnt Number of characters the last read got.
+ */
+static void AdaptRead(TSerial *s,DWORD Cnt)
+{
+  if (!s->RxBatch)
     {
-      StopThread = TRUE;
-      WaitForSingleObject(Thread,2000);
-      CloseHandle(Thread);
-      Thread = NULL;
-      StopThread = FALSE;             // reset for next time
+      s->RxRun = Cnt ? s->RxRun + 1 : 0;
+      if (s->RxRun < RX_RUN)
+        return;
+      s->RxBatch = TRUE;
     }
-  
-  PurgeComm(SerialPort,PURGE_TXCLEAR | PURGE_RXCLEAR);
-  CloseHandle(SerialPort);
-  SerialPort = NULL;
+  else if (!Cnt)
+    {
+      s->RxBatch = FALSE;
+      s->RxRun = 0;
+    }
+  else
+    {
+      if (Cnt == s->RxAsked && s->RxChunk < RX_MAX_CHUNK)
+        s->RxChunk *= 2;
+      else if (Cnt < s->RxAsked/4 && s->RxChunk > RX_MIN_CHUNK)
+        s->RxChunk /= 2;
+      return;
+    }
+  SetTimeouts(s->Handle,s->FlowControl,s->RxBatch);
+}
+
+/**
+   Internal function that adds a port to Ports, and ties it to the I/O
+   completion port.  Starts the pool first if no port is open.
+   @param s The port.
+   @return TRUE if the pool will complete the port's I/O.
+ */
+static BOOL AddPort(TSerial *s)
+{
+  DWORD ThreadID;
+  BOOL ok = FALSE;
+  int i;
+
+  AcquireSRWLockExclusive(&PortLock);
+  if (!Iocp)
+    {
+      // one thread running per CPU at most, and a couple in all
+      Iocp = CreateIoCompletionPort(INVALID_HANDLE_VALUE,NULL,0,0);
+      for (i=0;Iocp && i<IO_THREADS;i++)
+        {
+          Workers[i] = CreateThread(NULL,4096,PoolProc,Iocp,0,&ThreadID);
+          // Keep receive latency low when the UI is busy.
+          if (Workers[i])
+            SetThreadPriority(Workers[i],THREAD_PRIORITY_ABOVE_NORMAL);
+        }
+    }
+  if (Iocp && Workers[0] &&
+      CreateIoCompletionPort(s->Handle,Iocp,(ULONG_PTR)s,0))
+    {
+      s->Next = Ports;
+      Ports = s;
+      ok = TRUE;
+    }
+  ReleaseSRWLockExclusive(&PortLock);
+  if (!ok)
+    RemovePort(s);      // stops the pool again if it isn't needed
+  return ok;
 }
 
 /**
-   Puts a serial character out the serial port.  This assumes that the port
+   Internal function that takes a port off Ports, once the pool is done
+   with it.  Stops the pool when the last port is closed.
+   @param s The port.
+ */
+static void RemovePort(TSerial *s)
+{
+  TSerial **p;
+  HANDLE Port = NULL,Threads[IO_THREADS];
+  int i;
+
+  AcquireSRWLockExclusive(&PortLock);
+  for (p=&Ports;*p;p=&(*p)->Next)
+    if (*p == s)
+      {
+        *p = s->Next;
+        break;
+      }
+  if (!Ports && Iocp)
+    {
+      Port = Iocp;
+      Iocp = NULL;
+      memcpy(Threads,Workers,sizeof(Threads));
+      memset(Workers,0,sizeof(Workers));
+    }
+  ReleaseSRWLockExclusive(&PortLock);
+  if (!Port)
+    return;
+
+  // an empty packet tells a pool thread to quit
+  for (i=0;i<IO_THREADS;i++)
+    if (Threads[i])
+      PostQueuedCompletionStatus(Port,0,0,NULL);
+  for (i=0;i<IO_THREADS;i++)
+    if (Threads[i])
+      {
+        WaitForSingleObject(Threads[i],INFINITE);
+        CloseHandle(Threads[i]);
+      }
+  CloseHandle(Port);
+}
+
+/**
+   Puts a serial character out the default serial port.  This assumes that the port
    is already opened.
    @param c Character to send.
  */
 void PutSerialChar(int c)
 {
-  int Cnt;
-  DWORD ModemStat;
-  DWORD ticks;
-  int Cts=1;
-  
-  ticks = GetTickCount();
-  
-  // check for flow control
-  if (FlowControl)
+  char ch = c;
+
+  PutSerialBuf(&ch,1);
+}
+
+/**
+   Queues characters to be sent out the default serial port.  See SerialPortPut().
+ */
+int PutSerialBuf(const void *buf,int len)
+{
+  return DefaultPort ? SerialPortPut(DefaultPort,buf,len) : 0;
+}
+
+/**
+   Queues characters to be sent out a serial port, and returns as soon as
+   they are in the Tx ring.  If the ring is full, waits for the pool to
+   make room, for up to 5 seconds at a time, or CTS_TIMEOUT while CTS holds
+   it off.  Call from one thread only.
+   @param s The port.
+   @param buf Characters to send.
+   @param len Number of characters.
+   @return Number of characters queued, less than len if the driver stopped
+   taking them (e.g. CTS held off).
+*/
+int SerialPortPut(TSerial *s,const void *buf,int len)
+{
+  int Done = 0;
+  unsigned long n;
+  char *dest;
+
+  while (Done < len)
     {
-      while (Cts)
+      n = RingWritePtr(s->TxRing,&dest);
+      if (n)
         {
-          if (!GetCommModemStatus(SerialPort, &ModemStat))
+          if (n > (unsigned long)(len - Done))
+            n = len - Done;
+          memcpy(dest,(const char *)buf + Done,n);
+          RingCommit(s->TxRing,n);
+          Done += n;
+          Kick(s);
+          continue;
+        }
+      // ring is full, give up if the pool makes no progress
+      if (WaitForSingleObject(s->TxSpace,TX_STALL) == WAIT_TIMEOUT &&
+          (!s->Blocked || BlockedFor(s) >= CTS_TIMEOUT))
+        break;
+    }
+  return Done;
+}
+
+/**
+   Returns the number of characters queued by SerialPortPut() that have not
+   been sent yet.
+   @param s The port.
+ */
+unsigned long SerialPortTxPending(TSerial *s)
+{
+  return RingCount(s->TxRing);
+}
+
+/**
+   Returns the total number of characters the driver has sent since the
+   port was opened.  Subtract two readings to get the bytes sent in between.
+   @param s The port.
+ */
+unsigned long long SerialPortTxCount(TSerial *s)
+{
+  return __atomic_load_n(&s->TxCount,__ATOMIC_ACQUIRE);
+}
+
+/**
+   Returns TRUE while characters are waiting to be sent and the other end
+   holds CTS off.  MESS_CTS is posted when this changes.
+   @param s The port.
+*/
+BOOL SerialPortTxBlocked(TSerial *s)
+{
+  return s->Blocked;
+}
+
+/**
+   Returns the total time the transmitter has been held off by CTS since the
+   port was opened, including the current wait.
+   @param s The port.
+   @return Time in milliseconds.
+*/
+unsigned long SerialPortTxBlockedTime(TSerial *s)
+{
+  return s->BlockedMs + BlockedFor(s);
+}
+
+/**
+   Internal function that records a change in CTS or in the number of writers
+   with characters waiting, and keeps Blocked and BlockedMs up to date.
+   @param s The port.
+   @param Cts New state of CTS, or -1 if it did not change.
+   @param Busy Added to the number of writers waiting.
+*/
+static void SetFlowState(TSerial *s,int Cts,int Busy)
+{
+  int Now;
+
+  EnterCriticalSection(&s->FlowLock);
+  if (Cts >= 0)
+    s->CtsOn = Cts;
+  s->TxBusy += Busy;
+  Now = s->FlowControl && !s->CtsOn && s->TxBusy;
+  if (Now != s->Blocked)
+    {
+      if (Now)
+        s->BlockStart = GetTickCount();
+      else
+        s->BlockedMs += GetTickCount() - s->BlockStart;
+      s->Blocked = Now;
+      Watch(Now ? 1 : -1);
+      if (s->Wnd)
+        PostMessage(s->Wnd,MESS_CTS,Now,(LPARAM)s);
+    }
+  LeaveCriticalSection(&s->FlowLock);
+}
+
+/**
+   Internal function that reads CTS from the driver.
+   @param s The port.
+*/
+static void PollCts(TSerial *s)
+{
+  DWORD Status;
+
+  if (s->FlowControl && GetCommModemStatus(s->Handle,&Status))
+    SetFlowState(s,(Status & MS_CTS_ON) != 0,0);
+}
+
+/**
+   Internal function that returns how long the transmitter has been held off
+   by CTS this time.
+   @param s The port.
+   @return Time in milliseconds, or zero if it is not blocked.
+*/
+static DWORD BlockedFor(TSerial *s)
+{
+  DWORD ms = 0;
+
+  EnterCriticalSection(&s->FlowLock);
+  if (s->Blocked)
+    ms = GetTickCount() - s->BlockStart;
+  LeaveCriticalSection(&s->FlowLock);
+  return ms;
+}
+
+/**
+   Internal function that collects the line errors latched by the driver,
+   which clears them, and adds them to the port's counts.  Posts MESS_LINEERR
+   if there were any, unless one is already waiting.
+   @param s The port.
+*/
+static void CheckErrors(TSerial *s)
+{
+  DWORD Errors;
+
+  if (!ClearCommError(s->Handle,&Errors,NULL) ||
+      !(Errors &= CE_OVERRUN|CE_FRAME|CE_RXPARITY|CE_RXOVER))
+    return;
+  __atomic_or_fetch(&s->ErrFlags,Errors,__ATOMIC_RELEASE);
+  if (Errors & CE_OVERRUN)
+    InterlockedIncrement(&s->Overruns);
+  if (Errors & CE_FRAME)
+    InterlockedIncrement(&s->Framing);
+  if (Errors & CE_RXPARITY)
+    InterlockedIncrement(&s->Parity);
+  if (Errors & CE_RXOVER)
+    InterlockedIncrement(&s->QueueOverflows);
+  if (s->Wnd && !InterlockedExchange(&s->ErrPosted,TRUE))
+    PostMessage(s->Wnd,MESS_LINEERR,0,(LPARAM)s);
+}
+
+/**
+   Internal function that notes the time a read finished, before its
+   characters are committed to RxRing, so every character the reader can see
+   has a time.  If the reader has let RX_MARKS pile up, the characters go
+   without, and get the time of the next read.
+   @param s The port.
+   @param Cnt Number of characters read.
+*/
+static void AddMark(TSerial *s,DWORD Cnt)
+{
+  unsigned long Head = s->MarkHead;
+  LARGE_INTEGER Now;
+
+  s->RxIn += Cnt;
+  if (Head - __atomic_load_n(&s->MarkTail,__ATOMIC_ACQUIRE) >= RX_MARKS)
+    return;
+  QueryPerformanceCounter(&Now);
+  s->RxMarks[Head % RX_MARKS].End = s->RxIn;
+  s->RxMarks[Head % RX_MARKS].Time = Now.QuadPart;
+  __atomic_store_n(&s->MarkHead,Head + 1,__ATOMIC_RELEASE);
+}
+
+
+/**
+   Internal thread procedure of the pool.  Waits on the I/O completion port
+   for the operations of all open ports, and hands each to Complete().  Uses
+   no CPU while the ports are idle.  While Watched is set, also wakes every
+   WATCH_MS to run Watchdog().
+   @param p The I/O completion port.
+*/
+DWORD WINAPI PoolProc(void *p)
+{
+  HANDLE Port = p;
+  OVERLAPPED *ov;
+  ULONG_PTR Key;
+  DWORD Cnt;
+  BOOL ok;
+
+  for(;;)
+    {
+      ov = NULL;
+      ok = GetQueuedCompletionStatus(Port,&Cnt,&Key,&ov,Watched ? WATCH_MS : INFINITE);
+      if (ov && ov != &PoolWake)
+        Complete((TSerial *)Key,(TSerialIo *)ov,ok,Cnt);
+      else if (!ov && ok)
+        break;                  // RemovePort() is stopping the pool
+      if (Watched)
+        Watchdog();
+    }
+  return 0;
+}
+
+/**
+   Internal function that handles a finished operation, and starts the next
+   one.  Reads go straight into RxRing, and MESS_SERIAL is posted when
+   characters are received.  When the driver's queue is empty, the port
+   waits for EV_RXCHAR and EV_ERR, and with flow control also EV_CTS, to
+   track CTS for SerialPortTxBlocked().  Writes go on while there is anything to send.
+   @param s The port.
+   @param io The operation.
+   @param ok FALSE if the operation failed, or was cancelled.
+   @param Cnt Number of bytes transferred.
+*/
+static void Complete(TSerial *s,TSerialIo *io,BOOL ok,DWORD Cnt)
+{
+  switch (io->Op)
+    {
+    case IO_READ:
+      if (Cnt)
+        {
+          __atomic_add_fetch(&s->RxCount,Cnt,__ATOMIC_RELEASE);
+          if (s->RxDest == s->RxScratch)
+            RingDrop(s->RxRing,Cnt);
+          else
             {
-              ShowLastError();
-              return;
+              AddMark(s,Cnt);
+              RingCommit(s->RxRing,Cnt);
             }
-          Cts = !(ModemStat & MS_CTS_ON);
-          // timeout after 3 seconds
-          if (GetTickCount() > ticks + 1000)
-            break;
+          // signal main thread, unless it already has a message waiting
+          if (s->Wnd && !InterlockedExchange(&s->Posted,TRUE))
+            PostMessage(s->Wnd,MESS_SERIAL,0,(LPARAM)s);
+        }
+      AdaptRead(s,Cnt);
+      if (s->RxBatch)
+        {
+          // no WaitCommEvent() while batching, so look at CTS and
+          // line errors here
+          PollCts(s);
+          CheckErrors(s);
+          StartRead(s);
+        }
+      else if (Cnt)
+        StartRead(s);
+      else
+        StartWait(s);
+      break;
+    case IO_WAIT:
+      if (!ok)
+        {
+          // port is gone (e.g. USB adapter unplugged), don't spin
+          SetRetry(s,&s->RxRetry);
+          break;
         }
+      if (s->EvMask & EV_CTS)
+        PollCts(s);
+      if (s->EvMask & EV_ERR)
+        CheckErrors(s);
+      StartRead(s);
+      break;
+    case IO_WRITE:
+      Wrote(s,Cnt);
+      break;
+    case IO_KICK:
+      TxNext(s);
+      break;
     }
-  
-  
-  WriteFile(SerialPort,&c,1,(LPDWORD)&Cnt,NULL);
+  // the last use of s: SerialPortClose() may free it once Pending is zero
+  if (!InterlockedDecrement(&s->Pending))
+    SetEvent(s->Idle);
 }
 
+/**
+   Internal function that starts an overlapped operation on a port, unless
+   the port is being closed.
+   @param s The port.
+   @param io The operation's TSerialIo, which must not be in use.
+   @param Op IO_READ, IO_WAIT, IO_WRITE or IO_KICK.
+   @param buf Buffer to read into or write from.
+   @param n Size of buf.
+   @return TRUE if the operation is under way, and Complete() will be
+   called for it.  FALSE if it failed at once.
+ */
+static BOOL StartIo(TSerial *s,TSerialIo *io,int Op,const char *buf,DWORD n)
+{
+  BOOL ok = FALSE;
+
+  EnterCriticalSection(&s->IoLock);
+  if (!s->Closing)
+    {
+      memset(&io->ov,0,sizeof(io->ov));
+      io->Op = Op;
+      InterlockedIncrement(&s->Pending);
+      switch (Op)
+        {
+        case IO_READ:
+          ok = ReadFile(s->Handle,(char *)buf,n,NULL,&io->ov);
+          break;
+        case IO_WAIT:
+          ok = WaitCommEvent(s->Handle,&s->EvMask,&io->ov);
+          break;
+        case IO_WRITE:
+          ok = WriteFile(s->Handle,buf,n,NULL,&io->ov);
+          break;
+        case IO_KICK:
+          ok = PostQueuedCompletionStatus(Iocp,0,(ULONG_PTR)s,&io->ov);
+          break;
+        }
+      // even when it finished at once, the completion is queued to the pool
+      if (!ok && Op != IO_KICK && GetLastError() == ERROR_IO_PENDING)
+        ok = TRUE;
+      if (!ok)
+        InterlockedDecrement(&s->Pending);
+    }
+  LeaveCriticalSection(&s->IoLock);
+  return ok;
+}
 
 /**
-   Internal function to start the Rx thread.
-   @return Handle to new thread.
+   Internal function that reads everything already in the driver queue.  If
+   the ring is full the driver still has to be drained, or it will overrun;
+   those characters are dropped.
+   @param s The port.
  */
-HANDLE StartCommThread(void)
+static void StartRead(TSerial *s)
 {
-  int ThreadID;
-  
-  StopThread = FALSE;
-  Thread = CreateThread(NULL,4096,ThreadProc,SerialPort,0,(LPDWORD)&ThreadID);
-  return Thread;
+  DWORD Room = RingWritePtr(s->RxRing,&s->RxDest);
+
+  if (!Room)
+    {
+      s->RxDest = s->RxScratch;
+      Room = sizeof(s->RxScratch);
+    }
+  if (s->RxBatch && Room > s->RxChunk)
+    Room = s->RxChunk;
+  s->RxAsked = Room;
+  if (!StartIo(s,&s->RxIo,IO_READ,s->RxDest,Room))
+    StartWait(s);
 }
 
 /**
-   Internal thread procedure function.  Polls the serial port for received characters,
-   and sends a MESS_SERIAL message when characters are received.
+   Internal function that waits, without using a thread, until a character
+   arrives or CTS changes.
+   @param s The port.
  */
-DWORD WINAPI ThreadProc(void *p)
+static void StartWait(TSerial *s)
 {
-  int Cnt;
-  char buf[256];
-  // read serial port, signal any chars found
-  
-  if (!handle)
-    return;
+  if (!StartIo(s,&s->RxIo,IO_WAIT,NULL,0))
+    SetRetry(s,&s->RxRetry);
+}
+
+/**
+   Internal function that gets the pool writing, if it isn't already.
+   @param s The port.
+ */
+static void Kick(TSerial *s)
+{
+  if (!InterlockedExchange(&s->TxActive,TRUE))
+    StartIo(s,&s->KickIo,IO_KICK,NULL,0);
+}
+
+/**
+   Internal function that starts the next write, up to TxChunk from TxRing
+   or from SerialPortWrite()'s buffer, taking turns when there is both.
+   Lets go of TxActive when there is nothing left to send.  Only called by
+   the holder of TxActive, so there is one write at a time.
+   @param s The port.
+ */
+static void TxNext(TSerial *s)
+{
+  const char *src;
+  DWORD n;
 
   for(;;)
     {
-      // check for chars from port or kbd:
-      if (ReadFile(SerialPort,&buf,255,(LPDWORD)&Cnt,NULL) && Cnt)
+      if (s->ExtBuf && s->ExtAbort)
+        EndExt(s,-1);
+      n = RingReadPtr(s->TxRing,&src);
+      // busy from the first character queued until the ring is empty, so
+      // time held off by CTS is counted across retries
+      if ((n != 0) != s->TxRingBusy)
         {
-          // signal main thread
-          SendMessage(handle,MESS_SERIAL,(unsigned int)Cnt,(unsigned long)buf);
+          s->TxRingBusy = !s->TxRingBusy;
+          SetFlowState(s,-1,s->TxRingBusy ? 1 : -1);
         }
+      if (s->ExtBuf && (!n || !s->TxExt))
+        {
+          src = s->ExtBuf + s->ExtSent;
+          n = s->ExtLen - s->ExtSent;
+          s->TxExt = TRUE;
+        }
+      else if (n)
+        s->TxExt = FALSE;
       else
-        Sleep(50);
-      
-      if (StopThread)
-        break;
+        {
+          // nothing to send.  Kick() may have seen TxActive still set, and
+          // left the characters it just queued to us.
+          InterlockedExchange(&s->TxActive,FALSE);
+          if ((!RingCount(s->TxRing) && !s->ExtBuf) ||
+              InterlockedExchange(&s->TxActive,TRUE))
+            return;
+          continue;
+        }
+      if (n > s->TxChunk)
+        n = s->TxChunk;
+      if (StartIo(s,&s->TxIo,IO_WRITE,src,n) || s->Closing)
+        return;
+      Wrote(s,0);
+      return;
     }
-  return 0;
 }
 
 /**
-   Query function used to determine if serial port is open.
+   Internal function that finishes a write: takes the characters out of
+   TxRing, or counts them off SerialPortWrite()'s buffer, then starts the
+   next write.  Characters the driver didn't take stay in TxRing, and are
+   tried again after WATCH_MS.
+   @param s The port.
+   @param Cnt Number of characters the driver took.  Zero if the write
+   failed, or was cancelled.
+ */
+static void Wrote(TSerial *s,DWORD Cnt)
+{
+  if (Cnt)
+    __atomic_add_fetch(&s->TxCount,Cnt,__ATOMIC_RELEASE);
+  if (s->TxExt)
+    {
+      s->ExtSent += Cnt;
+      // a failed write ends SerialPortWrite() short, e.g. CTS held off too long
+      if (s->ExtAbort)
+        EndExt(s,-1);
+      else if (!Cnt || s->ExtSent == s->ExtLen)
+        EndExt(s,s->ExtSent);
+    }
+  else if (Cnt)
+    {
+      RingSkip(s->TxRing,Cnt);
+      SetEvent(s->TxSpace);
+    }
+  else
+    {
+      // keep TxActive, Watchdog() takes it from here
+      SetRetry(s,&s->TxRetry);
+      return;
+    }
+  TxNext(s);
+}
+
+/**
+   Internal function that hands SerialPortWrite()'s buffer back.
+   @param s The port.
+   @param Result What SerialPortWrite() returns.
+ */
+static void EndExt(TSerial *s,int Result)
+{
+  s->ExtResult = Result;
+  s->ExtBuf = NULL;
+  SetEvent(s->ExtDone);
+}
+
+/**
+   Internal function that sets a port's RxRetry or TxRetry, for Watchdog()
+   to try again.
+   @param s The port.
+   @param Flag The flag.
+ */
+static void SetRetry(TSerial *s,volatile LONG *Flag)
+{
+  if (!InterlockedExchange(Flag,TRUE))
+    Watch(1);
+}
+
+/**
+   Internal function that counts reasons to run Watchdog().  Wakes a pool
+   thread when the first one comes up, so it stops waiting forever.
+   @param n 1 or -1.
+ */
+static void Watch(int n)
+{
+  if (!InterlockedExchangeAdd(&Watched,n) && n > 0 && Iocp)
+    PostQueuedCompletionStatus(Iocp,0,0,&PoolWake);
+}
+
+/**
+   Internal function run by the pool every WATCH_MS while there is anything
+   to watch.  Tries again the reads and writes the driver refused, and checks
+   on writes held off by CTS.  A SerialPortWrite() is abandoned once CTS has
+   been off for CTS_TIMEOUT; characters in TxRing just wait.
+ */
+static void Watchdog(void)
+{
+  TSerial *s;
+  LONG Last = LastWatch;
+
+  // one pool thread at a time, and not too often
+  if (GetTickCount() - (DWORD)Last < WATCH_MS ||
+      InterlockedCompareExchange(&LastWatch,(LONG)GetTickCount(),Last) != Last)
+    return;
+  AcquireSRWLockShared(&PortLock);
+  for (s=Ports;s;s=s->Next)
+    {
+      if (InterlockedExchange(&s->RxRetry,FALSE))
+        {
+          Watch(-1);
+          StartRead(s);
+        }
+      if (InterlockedExchange(&s->TxRetry,FALSE))
+        {
+          Watch(-1);
+          TxNext(s);
+        }
+      if (s->Blocked)
+        {
+          // check CTS here too, in case the change was missed
+          PollCts(s);
+          if (s->ExtBuf && BlockedFor(s) >= CTS_TIMEOUT)
+            CancelIoEx(s->Handle,&s->TxIo.ov);
+        }
+    }
+  ReleaseSRWLockShared(&PortLock);
+}
+
+/**
+   Writes characters straight from the caller's buffer, without copying them
+   into the Tx ring, and waits until the driver has taken them.  Writes are
+   broken into pieces of TxChunk, and take turns with the ones from TxRing,
+   so characters typed meanwhile still go out.  Used to send memory mapped
+   files, see xfer.c.  Call from one thread at a time.
+   @param s The port.
+   @param buf Characters to send.
+   @param len Number of characters.
+   @param Cancel Event that abandons the write when signalled, or NULL.
+   @return Number of characters written, less than len if the driver stopped
+   taking them (e.g. CTS held off), or -1 if cancelled.
+*/
+int SerialPortWrite(TSerial *s,const void *buf,int len,HANDLE Cancel)
+{
+  HANDLE Waits[2];
+
+  if (len <= 0)
+    return 0;
+  s->ExtLen = len;
+  s->ExtSent = 0;
+  s->ExtAbort = FALSE;
+  SetFlowState(s,-1,1);
+  s->ExtBuf = buf;      // the pool's from here
+  Kick(s);
+
+  Waits[0] = s->ExtDone;
+  Waits[1] = Cancel;
+  if (WaitForMultipleObjects(Cancel ? 2 : 1,Waits,FALSE,INFINITE) != WAIT_OBJECT_0)
+    {
+      // abandon the write in progress; the pool lets go of buf when it's back
+      EnterCriticalSection(&s->IoLock);
+      s->ExtAbort = TRUE;
+      if (s->TxActive)
+        CancelIoEx(s->Handle,&s->TxIo.ov);
+      LeaveCriticalSection(&s->IoLock);
+      WaitForSingleObject(s->ExtDone,INFINITE);
+    }
+  SetFlowState(s,-1,-1);
+  return s->ExtResult;
+}
+
+/**
+   Query function used to determine if the default serial port is open.
    @return TRUE if serial port has been successfully opened, or FALSE otherwise.
  */
 int SerialPortIsOpen(void)
 {
-  if (SerialPort)
+  if (DefaultPort)
     return TRUE;
   return FALSE;
 }
 
 /**
-   Query function used to determine if there are serial characters available.
-   This function is only needed if the handle parameter to OpenPort() was NULL.
+   Query function used to determine if there are serial characters available
+   on the default port.  This function is only needed if the handle parameter
+   to OpenPort() was NULL.
    @return TRUE if there are one or more characters in the serial input buffer,
    FALSE if no characters are available.
  */
 BOOL SerialIsChar(void)
 {
-  int Cnt,Avail,Remain;
-  int buf;
-  char str[100];
-
-  PeekNamedPipe(SerialPort, (LPVOID)&buf, (DWORD) 1, (LPDWORD)&Cnt,(LPDWORD)&Avail, (LPDWORD)&Remain);
-
-  if (Avail)
+  if (DefaultPort && SerialPortRxPending(DefaultPort))
     return TRUE;
 
   return FALSE;
 }
 
 /**
-   Returns a character from the serial port buffer.  This function assumes that the port has
+   Returns a character from the default serial port's buffer.  This function assumes that the port has
    been already opened, and that characters have been detected with SerialIsChar().
    @return Character from serial port, or EOF on error.
  */
 int SerialGetChar(void)
 {
   char ch;
-  int Cnt;
 
-  if (!SerialPort)
+  if (!DefaultPort)
     return EOF;
 
-  ReadFile(SerialPort,&ch,1,(LPDWORD)&Cnt,NULL);
-  if (!Cnt)
+  if (!SerialPortRead(DefaultPort,&ch,1))
     return EOF;
 
   return (int) ch;
 }
 
 /**
-   @}
+   Reads received characters from the default port.  See SerialPortRead().
+ */
+int SerialRead(char *buf,int len)
+{
+  return DefaultPort ? SerialPortRead(DefaultPort,buf,len) : 0;
+}
+
+/**
+   Reads received characters.  Call this in response to MESS_SERIAL until it
+   returns zero.
+   @param s The port.
+   @param buf Buffer to receive the characters.
+   @param len Size of buf.
+   @return Number of characters copied to buf, zero if none are waiting.
+*/
+int SerialPortRead(TSerial *s,char *buf,int len)
+{
+  int n;
+
+  // re-arm the notification before reading, so nothing is missed
+  InterlockedExchange(&s->Posted,FALSE);
+  n = RingRead(s->RxRing,buf,len);
+  s->RxOut += n;
+  return n;
+}
+
+/**
+   Like SerialPortRead(), but also returns when the characters were received:
+   when the driver read them, not when the application got around to it.
+   Stops at the end of each read from the driver, so all the characters
+   returned have the same time.
+   @param s The port.
+   @param buf Buffer to receive the characters.
+   @param len Size of buf.
+   @param Time Receives the QueryPerformanceCounter() reading when the
+   characters were read from the driver.
+   @return Number of characters copied to buf, zero if none are waiting.
+*/
+int SerialPortReadStamped(TSerial *s,char *buf,int len,LONGLONG *Time)
+{
+  unsigned long Head = __atomic_load_n(&s->MarkHead,__ATOMIC_ACQUIRE);
+  unsigned long Tail = s->MarkTail;
+  TRxMark *m;
+  int n;
+
+  // pass the marks of reads already returned
+  while (Tail != Head && (long)(s->RxMarks[Tail % RX_MARKS].End - s->RxOut) <= 0)
+    Tail++;
+  __atomic_store_n(&s->MarkTail,Tail,__ATOMIC_RELEASE);
+  if (Tail != Head)
+    {
+      m = &s->RxMarks[Tail % RX_MARKS];
+      if ((unsigned long)len > m->End - s->RxOut)
+        len = m->End - s->RxOut;
+      s->RxTime = m->Time;
+    }
+  n = SerialPortRead(s,buf,len);
+  *Time = s->RxTime;
+  return n;
+}
+
+/**
+   Returns the number of received characters waiting to be read.
+   @param s The port.
 */
+unsigned long SerialPortRxPending(TSerial *s)
+{
+  return RingCount(s->RxRing);
+}
 
+/**
+   Sets the size of the receive ring buffer.  Takes effect the next time a
+   port is opened.
+   @param bytes Buffer size in bytes.  Rounded up to a power of two.
+ */
+void SerialSetRxBufSize(unsigned long bytes)
+{
+  RxBufSize = bytes;
+}
+
+/**
+   Sets the sizes of the driver's Rx and Tx queues.  Takes effect the next
+   time a port is opened.
+   @param Rx Rx queue size in bytes, or 0 to size it from the baud rate.
+   @param Tx Tx queue size in bytes, or 0 to size it from the baud rate.
+ */
+void SerialSetQueueSizes(unsigned long Rx,unsigned long Tx)
+{
+  RxQueueSize = Rx;
+  TxQueueSize = Tx;
+}
+
+/**
+   Returns the number of received characters lost because the application
+   did not read them fast enough.
+   @param s The port.
+ */
+unsigned long SerialPortRxDropped(TSerial *s)
+{
+  return RingDropped(s->RxRing);
+}
+
+/**
+   Returns the number of times the receive ring buffer overflowed.
+   @param s The port.
+ */
+unsigned long SerialPortRxOverflows(TSerial *s)
+{
+  return RingOverflows(s->RxRing);
+}
+
+/**
+   Gets the running totals of bytes in and out and of line errors since the
+   port was opened.  Also re-arms MESS_LINEERR, so call it when handling
+   that message.
+   @param s The port.
+   @param st Receives the totals.
+ */
+void SerialPortStats(TSerial *s,TSerialStats *st)
+{
+  InterlockedExchange(&s->ErrPosted,FALSE);
+  st->RxBytes = __atomic_load_n(&s->RxCount,__ATOMIC_ACQUIRE);
+  st->TxBytes = SerialPortTxCount(s);
+  st->Overruns = s->Overruns;
+  st->Framing = s->Framing;
+  st->Parity = s->Parity;
+  st->QueueOverflows = s->QueueOverflows;
+}
+
+/**
+   Returns the line errors seen since the last call, and clears them.  Used
+   to record them with the characters they came with, see capture.c.
+   @param s The port.
+   @return CE_OVERRUN, CE_FRAME, CE_RXPARITY and CE_RXOVER, or 0 for none.
+ */
+DWORD SerialPortTakeErrors(TSerial *s)
+{
+  return __atomic_exchange_n(&s->ErrFlags,0,__ATOMIC_ACQUIRE);
+}
+
+/**
+   @}
+*/
@@ -32,15 +32,138 @@
 
 #include <stdio.h>
 #include <windows.h>
+#include "ring.h"
 
 
-#define MESS_SERIAL (WM_USER+1)  ///< Custom windows message ID for serial messages.
+#define MESS_SERIAL (WM_USER+1)  ///< Custom windows message ID for serial messages, lParam is the TSerial.
+#define MESS_CTS (WM_USER+4)     ///< Custom windows message ID posted when CTS starts or stops holding off Tx, wParam is SerialPortTxBlocked(), lParam the TSerial.
+#define MESS_LINEERR (WM_USER+5) ///< Custom windows message ID posted when the driver reports new line errors, lParam is the TSerial.
+#define CTS_TIMEOUT 30000        ///< Milliseconds CTS may hold off Tx before a write gives up.
+#define RX_MARKS 1024            ///< Read times kept per port, see SerialPortReadStamped().
 
+/**
+   One overlapped operation on a port, queued to the I/O completion port.
+   The OVERLAPPED comes first, so the one the pool gets back can be cast
+   to this.
+*/
+typedef struct {
+  OVERLAPPED ov;                ///< Passed to ReadFile(), WriteFile() or WaitCommEvent().
+  int Op;                       ///< What the operation is: IO_READ, IO_WAIT, IO_WRITE or IO_KICK.
+} TSerialIo;
+
+/**
+   When a read from the driver finished, and where its characters end in
+   the Rx ring.
+*/
+typedef struct {
+  unsigned long End;            ///< RxIn after the read.
+  LONGLONG Time;                ///< QueryPerformanceCounter() when the read finished.
+} TRxMark;
+
+/**
+   Running totals for a port, see SerialPortStats().  The error counts are
+   of reports from ClearCommError(), each of which may cover several
+   characters.
+*/
+typedef struct {
+  unsigned long long RxBytes;   ///< Bytes read from the driver, including any dropped because the Rx ring was full.
+  unsigned long long TxBytes;   ///< Bytes the driver has sent.
+  unsigned long Overruns;       ///< CE_OVERRUN: the UART lost characters before the driver took them.
+  unsigned long Framing;        ///< CE_FRAME: characters with a bad stop bit, usually a baud rate mismatch.
+  unsigned long Parity;         ///< CE_RXPARITY: characters with a parity error.
+  unsigned long QueueOverflows; ///< CE_RXOVER: the driver's Rx queue was full.
+} TSerialStats;
+
+/**
+   An open serial port.  Returned by SerialPortOpen(); the fields are only
+   used by serial.c.  The port has no threads of its own: its reads and
+   writes are overlapped, and completed by the worker pool shared by all
+   ports.
+*/
+typedef struct TSerial {
+  HANDLE Handle;                ///< Handle of the port itself.
+  int Number;                   ///< Port number, COM1 = 1.
+  HWND Wnd;                     ///< Window that receives MESS_SERIAL and MESS_CTS, or NULL.
+  int FlowControl;              ///< Flag: is hardware flow-control active?
+  struct TSerial *Next;         ///< Next open port, see Ports in serial.c.
+  TSerialIo RxIo;               ///< The read or WaitCommEvent() in progress.  There is always one.
+  TSerialIo TxIo;               ///< The write in progress, if TxActive.
+  TSerialIo KickIo;             ///< Posted to the pool to start writing.
+  DWORD EvMask;                 ///< Events returned by WaitCommEvent().
+  char *RxDest;                 ///< Where the read in progress puts its characters.
+  char RxScratch[256];          ///< Receives characters when RxRing is full.
+  DWORD RxAsked;                ///< Size of the read in progress.
+  DWORD RxChunk;                ///< Size of batching reads, see AdaptRead() in serial.c.
+  int RxBatch;                  ///< Flag: reads wait to gather RxChunk, instead of returning at once.
+  int RxRun;                    ///< Reads in a row that found characters, while not batching.
+  CRITICAL_SECTION IoLock;      ///< Held while starting I/O, so SerialPortClose() can cancel all of it.
+  volatile LONG Closing;        ///< Flag: SerialPortClose() was called, start no more I/O.
+  volatile LONG Pending;        ///< One for the open port, plus one per operation queued to the pool.
+  HANDLE Idle;                  ///< Event: Pending has dropped to zero.
+  volatile LONG RxRetry;        ///< Flag: the driver refused to read, try again later.
+  volatile LONG TxRetry;        ///< Flag: the driver refused to write, try again later.
+  HANDLE TxSpace;               ///< Event: the pool took characters out of TxRing.
+  TRing *RxRing;                ///< Received characters, filled by the pool.
+  TRing *TxRing;                ///< Characters waiting to be sent, emptied by the pool.
+  volatile LONG Posted;         ///< Flag: a MESS_SERIAL message is waiting to be handled.
+  unsigned long long RxCount;   ///< Total bytes read from the driver.  Updated atomically.
+  volatile LONG Overruns;       ///< CE_OVERRUN reports, see CheckErrors() in serial.c.
+  volatile LONG Framing;        ///< CE_FRAME reports.
+  volatile LONG Parity;         ///< CE_RXPARITY reports.
+  volatile LONG QueueOverflows; ///< CE_RXOVER reports.
+  volatile LONG ErrPosted;      ///< Flag: a MESS_LINEERR message is waiting to be handled.
+  volatile DWORD ErrFlags;      ///< CE_ line errors seen since SerialPortTakeErrors() was last called.
+  TRxMark RxMarks[RX_MARKS];    ///< Times of the reads not read from RxRing yet, a ring of their own.
+  unsigned long MarkHead;       ///< Total marks added.  Written by the pool, atomically.
+  unsigned long MarkTail;       ///< Total marks used up.  Written by the reader, atomically.
+  unsigned long RxIn;           ///< Total characters put in RxRing.  Pool only.
+  unsigned long RxOut;          ///< Total characters taken out of RxRing.  Reader only.
+  LONGLONG RxTime;              ///< Time of the last characters returned by SerialPortReadStamped().
+  DWORD TxChunk;                ///< Bytes per write, about a quarter second's worth at the baud rate.
+  unsigned long long TxCount;   ///< Total bytes the driver has sent.  Updated atomically.
+  volatile LONG TxActive;       ///< Flag: a write is in progress, or about to be.  Only one is, per port.
+  int TxExt;                    ///< Flag: the write in progress is from ExtBuf, not TxRing.
+  int TxRingBusy;               ///< Flag: TxRing is counted in TxBusy.
+  const char * volatile ExtBuf; ///< Characters from SerialPortWrite(), or NULL.
+  int ExtLen;                   ///< Number of characters in ExtBuf.
+  int ExtSent;                  ///< Number of them sent so far.
+  volatile LONG ExtAbort;       ///< Flag: SerialPortWrite() was cancelled.
+  int ExtResult;                ///< What SerialPortWrite() returns.
+  HANDLE ExtDone;               ///< Event: the pool is done with ExtBuf.
+  CRITICAL_SECTION FlowLock;    ///< Protects the CTS state below.
+  int CtsOn;                    ///< Flag: CTS was on when last checked.
+  int TxBusy;                   ///< Number of writers with characters waiting to go.
+  volatile int Blocked;         ///< Flag: writes are waiting and CTS is off.
+  DWORD BlockStart;             ///< GetTickCount() when Blocked was set.
+  unsigned long BlockedMs;      ///< Total milliseconds the transmitter was held off by CTS.
+} TSerial;
+
+TSerial *SerialPortOpen(int port,int baud,int HwFc,HWND hwnd);
+void SerialPortClose(TSerial *s);
+int SerialPortPut(TSerial *s,const void *buf,int len);
+int SerialPortWrite(TSerial *s,const void *buf,int len,HANDLE Cancel);
+int SerialPortRead(TSerial *s,char *buf,int len);
+int SerialPortReadStamped(TSerial *s,char *buf,int len,LONGLONG *Time);
+unsigned long SerialPortRxPending(TSerial *s);
+unsigned long SerialPortTxPending(TSerial *s);
+unsigned long long SerialPortTxCount(TSerial *s);
+BOOL SerialPortTxBlocked(TSerial *s);
+unsigned long SerialPortTxBlockedTime(TSerial *s);
+unsigned long SerialPortRxDropped(TSerial *s);
+unsigned long SerialPortRxOverflows(TSerial *s);
+void SerialPortStats(TSerial *s,TSerialStats *st);
+DWORD SerialPortTakeErrors(TSerial *s);
+void SerialSetRxBufSize(unsigned long bytes);
+void SerialSetQueueSizes(unsigned long Rx,unsigned long Tx);
+
+// single port interface, using a default port
 BOOL OpenPort(int port,int baud,int HwFc, HWND handle);
 void CloseSerialPort(void);
 void PutSerialChar(int c);
+int PutSerialBuf(const void *buf,int len);
 int SerialPortIsOpen(void);
 BOOL SerialIsChar(void);
 int SerialGetChar(void);
+int SerialRead(char *buf,int len);
 
 #endif
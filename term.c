@@ -0,0 +1,884 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file term.c This file implements the terminal screen model.
+  @defgroup termcore Terminal Core
+
+  @section intro Introduction
+
+  The screen model (TLines) and the handling of escape sequences, in plain C
+  with no Win32 dependency.  Received characters go in through TermWrite(),
+  which runs them through the escape sequence parser (see vtparse.c); the
+  parser calls back to the Vt... functions here, which change the cells and
+  move the cursor.
+
+  Nothing is drawn here.  Changed parts of lines are recorded as dirty spans,
+  and the front end is told through the TTermCallbacks: Invalidate when there
+  is something to repaint, Scroll before lines leave the top of the screen so
+  they can be kept in the scrollback history, and Title for OSC window titles.
+  FUNterm wires these to its render timer, history and main window; the
+  native fuzz and benchmark programs in bench/ use the core on its own.
+  @{
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "term.h"
+
+static void VtPrint(void *User,const char *s,int n);
+static void VtExecute(void *User,int ch);
+static void VtEsc(void *User,TVt *vt,int final);
+static void VtCsi(void *User,TVt *vt,int final);
+static void VtOsc(void *User,TVt *vt);
+static int GrowLines(TLines *Lines,int Rows,int Cols);
+
+/// Parser callbacks.  User is the TLines structure.
+static const TVtHandlers VtHandlers = {VtPrint,VtExecute,VtEsc,VtCsi,VtOsc};
+
+/// Tells the front end there is something to repaint.
+#define INVALIDATE(L) do { if ((L)->Cb && (L)->Cb->Invalidate) (L)->Cb->Invalidate((L)->User); } while (0)
+
+/**
+   Creates and initializes a TLines structure.  The text is kept in one contiguous
+   block of Count rows by MaxCols cells, with a parallel block of attributes, so
+   that nothing is allocated while characters are being displayed.  The blocks
+   are only made larger by TermResize(), for a window bigger than they hold.
+   @param Count Number of lines to be allocated.
+   @param Mode Parser mode, VT_ANSI or VT_ADM.
+   @param Cb Front end callbacks, may be NULL.
+   @param User Passed to the callbacks.
+   @return Pointer to new TLines structure.
+*/
+TLines *CreateLines(int Count,int Mode,const TTermCallbacks *Cb,void *User)
+{
+  // create the struct.
+  TLines *Lines = malloc(sizeof(TLines));
+  memset(Lines,0,sizeof(TLines));
+  Lines->Count = 0;
+  Lines->Rows = Count;
+  Lines->Cols = MaxCols;
+  Lines->Width = 80;
+  Lines->Height = Count < 24 ? Count : 24;
+  Lines->First = 0;
+  Lines->Cursor = 1;
+  Lines->Cb = Cb;
+  Lines->User = User;
+  VtInit(&Lines->Vt,Mode,&VtHandlers,Lines);
+
+  // allocate cell space
+  Lines->Chars = malloc(Count*MaxCols);
+  Lines->Attrs = malloc(Count*MaxCols*sizeof(unsigned short));
+  memset(Lines->Attrs,0,Count*MaxCols*sizeof(unsigned short));
+  Lines->Len = malloc(Count*sizeof(int));
+  memset(Lines->Len,0,Count*sizeof(int));
+  Lines->Dirty = malloc(Count);
+  memset(Lines->Dirty,0,Count);
+  Lines->DirtyStart = malloc(Count*sizeof(int));
+  Lines->DirtyEnd = malloc(Count*sizeof(int));
+
+  return Lines;
+}
+
+/**
+   De-allocates TLines structure, including the cells allocated by CreateLines().
+   @param Lines Pointer to TLines structure to destroy.
+*/
+void DestroyLines(TLines *Lines)
+{
+  free(Lines->Chars);
+  free(Lines->Attrs);
+  free(Lines->Len);
+  free(Lines->Dirty);
+  free(Lines->DirtyStart);
+  free(Lines->DirtyEnd);
+  free(Lines);
+}
+
+/**
+   Adds received characters to the terminal display.  The whole buffer goes
+   through the escape sequence parser, which calls back to the Vt... functions
+   below.  Runs of plain text are copied to the screen in bulk.
+   @param Lines Pointer to TLines structure.
+   @param buf Characters to add to the display.
+   @param len Number of characters.
+*/
+void TermWrite(TLines *Lines,const char *buf,int len)
+{
+  VtParse(&Lines->Vt,buf,len);
+}
+
+/**
+   Sets the size of the window.  If the screen got shorter, lines scroll off
+   the top so that the cursor stays on it.  If it is bigger than the cell
+   blocks, they are made larger.
+   @param Lines Pointer to TLines structure.
+   @param Width Width in characters.
+   @param Height Number of lines.  Check the Height field afterwards; it is
+   limited to the allocated rows if there is no memory for more.
+*/
+void TermResize(TLines *Lines,int Width,int Height)
+{
+  if (Height < 1)
+    Height = 1;
+  if (Width < 2)
+    Width = 2;
+  // grow the blocks for a bigger window; if that fails, use what there is
+  if ((Height > Lines->Rows || Width > Lines->Cols) && !GrowLines(Lines,Height,Width))
+    {
+      if (Height > Lines->Rows)
+        Height = Lines->Rows;
+      if (Width > Lines->Cols)
+        Width = Lines->Cols;
+    }
+  Lines->Width = Width;
+  Lines->Height = Height;
+  SetCursY(Lines,Lines->CursY);
+  Lines->AllDirty = 1;
+  INVALIDATE(Lines);
+}
+
+/**
+   Internal function that makes the cell blocks larger.  The lines are copied
+   in First order, so line y ends up in row y.  Only called on a resize, so
+   printing and scrolling still never allocate.
+   @param Lines Pointer to TLines structure.
+   @param Rows Number of lines needed.
+   @param Cols Number of characters per line needed.
+   @return Zero if out of memory; the blocks are left as they were.
+*/
+static int GrowLines(TLines *Lines,int Rows,int Cols)
+{
+  char *Chars,*Dirty;
+  unsigned short *Attrs;
+  int *Len,*DirtyStart,*DirtyEnd;
+  int y;
+
+  if (Rows < Lines->Rows)
+    Rows = Lines->Rows;
+  if (Cols < Lines->Cols)
+    Cols = Lines->Cols;
+  Chars = malloc(Rows*Cols);
+  Attrs = calloc(Rows*Cols,sizeof(unsigned short));
+  Len = calloc(Rows,sizeof(int));
+  Dirty = calloc(Rows,1);
+  DirtyStart = malloc(Rows*sizeof(int));
+  DirtyEnd = malloc(Rows*sizeof(int));
+  if (!Chars || !Attrs || !Len || !Dirty || !DirtyStart || !DirtyEnd)
+    {
+      free(Chars);
+      free(Attrs);
+      free(Len);
+      free(Dirty);
+      free(DirtyStart);
+      free(DirtyEnd);
+      return 0;
+    }
+  for (y=0;y<Lines->Rows;y++)
+    {
+      memcpy(Chars + y*Cols,LineText(Lines,y),Lines->Cols);
+      memcpy(Attrs + y*Cols,LineAttr(Lines,y),Lines->Cols*sizeof(unsigned short));
+      Len[y] = LineLen(Lines,y);
+    }
+  free(Lines->Chars);
+  free(Lines->Attrs);
+  free(Lines->Len);
+  free(Lines->Dirty);
+  free(Lines->DirtyStart);
+  free(Lines->DirtyEnd);
+  Lines->Chars = Chars;
+  Lines->Attrs = Attrs;
+  Lines->Len = Len;
+  Lines->Dirty = Dirty;
+  Lines->DirtyStart = DirtyStart;
+  Lines->DirtyEnd = DirtyEnd;
+  Lines->Rows = Rows;
+  Lines->Cols = Cols;
+  Lines->First = 0;
+  // everything is repainted after a resize anyway
+  Lines->AllDirty = 1;
+  return 1;
+}
+
+/**
+   Marks part of a line as changed, so that it gets repainted on the next render
+   tick.  Spans marked on the same line between ticks are merged.
+   @param Lines Pointer to TLines structure.
+   @param y Line number, zero-based.
+   @param x0 First column changed.
+   @param x1 Column after the last one changed, or ToEol.
+*/
+void MarkDirty(TLines *Lines,int y,int x0,int x1)
+{
+  if (y < 0 || y >= Lines->Rows)
+    return;
+  if (!Lines->Dirty[y])
+    {
+      Lines->Dirty[y] = 1;
+      Lines->DirtyStart[y] = x0;
+      Lines->DirtyEnd[y] = x1;
+    }
+  else
+    {
+      if (x0 < Lines->DirtyStart[y])
+        Lines->DirtyStart[y] = x0;
+      if (x1 > Lines->DirtyEnd[y])
+        Lines->DirtyEnd[y] = x1;
+    }
+  INVALIDATE(Lines);
+}
+
+/**
+   Sets the current cursor's column position.  Manages the TLines structure
+   to move the cursor.
+   @param Lines Pointer to TLines structure.
+   @param x New column position, zero-based.
+*/
+void SetCursX(TLines *Lines,int x)
+{
+  int y = Lines->CursY;
+  char *p = LineText(Lines,y);
+  int z;
+
+  if (x < 0) return;
+  if (x >= Lines->Cols) return;
+
+  // add spaces if nec.
+  z = LineLen(Lines,y);
+  if (z < x)
+    {
+      memset(p+z,' ',x-z);
+      memset(LineAttr(Lines,y)+z,0,(x-z)*sizeof(unsigned short));
+      LineLen(Lines,y) = x;
+    }
+
+  // redraw if cursor is visible and has moved.
+  if ((x != Lines->CursX) && Lines->Cursor)
+    {
+      MarkDirty(Lines,y,Lines->CursX,Lines->CursX+1);
+      MarkDirty(Lines,y,x,x+1);
+    }
+  Lines->CursX = x;
+}
+
+
+/**
+   Sets the current cursor's row position.  Manages the TLines structure
+   to move the cursor.  Scrolls lines off the top of the screen as necessary,
+   by moving the circular row index, after handing them to the Scroll callback.
+   @param Lines Pointer to TLines structure.
+   @param y New column position, zero-based.
+*/
+void SetCursY(TLines *Lines,int y)
+{
+  int i;
+
+  if (y >= Lines->Rows) return;
+  if (y < 0) return;
+
+  // redraw if cursor has moved.
+  if ((y != Lines->CursY) && Lines->Cursor)
+    {
+      MarkDirty(Lines,Lines->CursY,Lines->CursX,Lines->CursX+1);
+      MarkDirty(Lines,y,Lines->CursX,Lines->CursX+1);
+    }
+  Lines->CursY = y;
+
+  // adjust line count
+  if (y >= Lines->Count)
+    Lines->Count = y + 1;
+  SetCursX(Lines,Lines->CursX);   // force Y line to be padded if necessary.
+
+  // Remove lines if too many
+  if (Lines->Count > Lines->Height)
+    {
+      // move lines down
+      int x = Lines->Count+1 - Lines->Height;
+      // top lines go to the front end, and become the new empty lines at the bottom
+      if (Lines->Cb && Lines->Cb->Scroll)
+        Lines->Cb->Scroll(Lines->User,Lines,x);
+      for(i=0;i<x;i++)
+        LineLen(Lines,i) = 0;
+      Lines->First = (Lines->First + x) % Lines->Rows;
+      Lines->Count -= x;
+      // one line more than needed goes, so on a one line screen this would be -1
+      SetCursY(Lines,Lines->CursY-x < 0 ? 0 : Lines->CursY-x);
+      Lines->AllDirty = 1;
+      INVALIDATE(Lines);
+    }
+}
+
+/**
+   Adds characters to the TLines structure at the cursor, wrapping to the next
+   line at the right edge of the window.  Each piece that fits on a line is
+   copied in one go.
+   @param Lines Pointer to TLines structure.
+   @param s Characters to add to display.
+   @param n Number of characters.
+*/
+void PutText(TLines *Lines,const char *s,int n)
+{
+  int x,y,k,i,Len;
+  int Wrap = Lines->Width - 1;
+  char *p;
+  unsigned short *a;
+
+  if (Wrap > Lines->Cols - 1)
+    Wrap = Lines->Cols - 1;
+  while (n > 0)
+    {
+      // check for word wrap
+      if (Lines->CursX >= Wrap)
+        {
+          // fake cr/lf
+          SetCursX(Lines,0);
+          SetCursY(Lines,Lines->CursY+1);
+        }
+      y = Lines->CursY;
+      x = Lines->CursX;
+      k = Wrap - x;
+      if (k < 1)
+        k = 1;
+      if (k > n)
+        k = n;
+
+      // add the chars
+      p = LineText(Lines,y);
+      a = LineAttr(Lines,y);
+      Len = LineLen(Lines,y);
+      if (x > Len)
+        {
+          memset(p+Len,' ',x-Len);
+          for (i=Len;i<x;i++)
+            a[i] = 0;
+        }
+      memcpy(p+x,s,k);
+      for (i=x;i<x+k;i++)
+        a[i] = Lines->Attr;
+      if (x+k > Len)
+        LineLen(Lines,y) = x+k;
+      MarkDirty(Lines,y,x,x+k);
+
+      SetCursX(Lines,x+k);
+      if (Lines->CursY >= Lines->Count)
+        Lines->Count = Lines->CursY+1;
+      s += k;
+      n -= k;
+    }
+}
+
+/**
+   Clears all data from display.
+   @param Lines Pointer to TLines structure.
+*/
+void ClearScreen(TLines *Lines)
+{
+  int x;
+
+  SetCursX(Lines,0);
+  SetCursY(Lines,0);
+  for(x=0;x<Lines->Count;x++)
+    LineLen(Lines,x) = 0;
+  Lines->AllDirty = 1;
+  INVALIDATE(Lines);
+}
+
+/**
+   Clears part of a line.  Clearing to the end of the line just shortens it.
+   @param Lines Pointer to TLines structure.
+   @param y Line number.
+   @param x0 First column to clear.
+   @param x1 Column after the last one to clear, or ToEol.
+*/
+static void EraseLine(TLines *Lines,int y,int x0,int x1)
+{
+  int i;
+  char *p = LineText(Lines,y);
+  unsigned short *a = LineAttr(Lines,y);
+
+  if (x1 > LineLen(Lines,y))
+    x1 = LineLen(Lines,y);
+  if (x0 >= x1)
+    return;
+  if (x1 == LineLen(Lines,y))
+    LineLen(Lines,y) = x0;
+  else
+    {
+      memset(p+x0,' ',x1-x0);
+      for (i=x0;i<x1;i++)
+        a[i] = 0;
+    }
+  MarkDirty(Lines,y,x0,ToEol);
+}
+
+/**
+   Copies one screen line over another.
+   @param Lines Pointer to TLines structure.
+   @param dst Line to copy to.
+   @param src Line to copy from.
+*/
+static void CopyLine(TLines *Lines,int dst,int src)
+{
+  memcpy(LineText(Lines,dst),LineText(Lines,src),LineLen(Lines,src));
+  memcpy(LineAttr(Lines,dst),LineAttr(Lines,src),LineLen(Lines,src)*sizeof(unsigned short));
+  LineLen(Lines,dst) = LineLen(Lines,src);
+}
+
+/**
+   Inserts or deletes lines at a screen line, moving the lines below it down
+   or up.  Lines moved off the bottom of the screen are lost, and new lines
+   are blank.
+   @param Lines Pointer to TLines structure.
+   @param y First line affected.
+   @param n Number of lines to insert, or minus the number to delete.
+*/
+static void InsertLines(TLines *Lines,int y,int n)
+{
+  int i,Bottom = Lines->Height - 1;
+
+  if (y > Bottom)
+    return;
+  if (n > 0)
+    {
+      if (n > Bottom + 1 - y)
+        n = Bottom + 1 - y;
+      for (i=Bottom;i>=y+n;i--)
+        CopyLine(Lines,i,i-n);
+      for (i=y;i<y+n;i++)
+        LineLen(Lines,i) = 0;
+      Lines->Count += n;
+    }
+  else
+    {
+      n = -n;
+      if (n > Bottom + 1 - y)
+        n = Bottom + 1 - y;
+      for (i=y;i<=Bottom-n;i++)
+        CopyLine(Lines,i,i+n);
+      for (;i<=Bottom;i++)
+        LineLen(Lines,i) = 0;
+    }
+  if (Lines->Count > Lines->Height)
+    Lines->Count = Lines->Height;
+  Lines->AllDirty = 1;
+  INVALIDATE(Lines);
+  SetCursX(Lines,Lines->CursX);   // re-pad the cursor line
+}
+
+/**
+   Inserts or deletes characters at the cursor, moving the rest of the line
+   right or left.
+   @param Lines Pointer to TLines structure.
+   @param n Number of blanks to insert, or minus the number of characters to delete.
+*/
+static void InsertChars(TLines *Lines,int n)
+{
+  int y = Lines->CursY;
+  int x = Lines->CursX;
+  int Len = LineLen(Lines,y);
+  char *p = LineText(Lines,y);
+  unsigned short *a = LineAttr(Lines,y);
+  int i;
+
+  if (x >= Len)
+    return;
+  if (n > 0)
+    {
+      if (n > Lines->Cols - x)
+        n = Lines->Cols - x;
+      if (Len + n > Lines->Cols)
+        Len = Lines->Cols - n;
+      if (Len > x)
+        {
+          memmove(p+x+n,p+x,Len-x);
+          memmove(a+x+n,a+x,(Len-x)*sizeof(unsigned short));
+        }
+      memset(p+x,' ',n);
+      for (i=x;i<x+n;i++)
+        a[i] = 0;
+      LineLen(Lines,y) = Len + n;
+    }
+  else
+    {
+      n = -n;
+      if (n > Len - x)
+        n = Len - x;
+      memmove(p+x,p+x+n,Len-x-n);
+      memmove(a+x,a+x+n,(Len-x-n)*sizeof(unsigned short));
+      LineLen(Lines,y) = Len - n;
+    }
+  MarkDirty(Lines,y,x,ToEol);
+}
+
+/**
+   Parser callback: prints a run of characters at the cursor, wrapping at the
+   right edge of the window.
+   @param User Pointer to TLines structure.
+   @param s Characters to print.
+   @param n Number of characters.
+*/
+static void VtPrint(void *User,const char *s,int n)
+{
+  PutText(User,s,n);
+}
+
+/**
+   Parser callback: carries out a control character.
+   @param User Pointer to TLines structure.
+   @param ch The control character.
+*/
+static void VtExecute(void *User,int ch)
+{
+  TLines *Lines = User;
+  int x;
+
+  switch (ch)
+    {
+    case 0x1e:
+    case 0x18:
+      // Home position (??)
+      if (Lines->Vt.Mode != VT_ADM)
+        break;                  // CAN in ANSI mode, just cancels a sequence
+      SetCursX(Lines,0);
+      SetCursY(Lines,0);
+      break;
+    case 0x1a:    // Control-z
+      // Clear Screen and home (cntrl-z)
+      if (Lines->Vt.Mode == VT_ADM)
+        ClearScreen(Lines);
+      break;
+    case 12:      // Form-feed (cntrl-l)
+      if (Lines->Vt.Mode == VT_ADM)
+        {
+          ClearScreen(Lines);
+          break;
+        }
+      // VT100 treats FF like LF
+      /* fall through */
+    case 10:
+    case 11:
+      if (Lines->CrLf)
+        // implied CR
+        SetCursX(Lines,0);
+      SetCursY(Lines,Lines->CursY+1);
+      break;
+    case 13:
+      SetCursX(Lines,0);
+      break;
+    case 8:         // backspace
+      SetCursX(Lines,Lines->CursX - 1);
+      break;
+    case 9:         // tab
+      // to the next multiple of 8, padding with spaces
+      x = (Lines->CursX/8 + 1)*8;
+      if (x > Lines->Width - 1)
+        x = Lines->Width - 1;
+      if (x > Lines->CursX)
+        SetCursX(Lines,x);
+      break;
+    }
+}
+
+/**
+   Parser callback: carries out an escape sequence.  In ADM mode these are the
+   legacy escapes; otherwise the DEC ones.
+   @param User Pointer to TLines structure.
+   @param vt Parser, holding the sequence.
+   @param final The final character.
+*/
+static void VtEsc(void *User,TVt *vt,int final)
+{
+  TLines *Lines = User;
+  int x;
+
+  if (vt->Mode == VT_ADM)
+    {
+      switch (toupper(final))
+        {
+        case 'T':
+          // Clear to EOL
+          EraseLine(Lines,Lines->CursY,Lines->CursX,ToEol);
+          break;
+        case 'Y':
+          // Clear to EOF
+          EraseLine(Lines,Lines->CursY,Lines->CursX,ToEol);
+          for(x=Lines->CursY+1;x<Lines->Count;x++)
+            EraseLine(Lines,x,0,ToEol);
+          break;
+        case '.':
+          // cursor on/off
+          Lines->Cursor = vt->Params[0] != '0';
+          MarkDirty(Lines,Lines->CursY,Lines->CursX,Lines->CursX+1);
+          break;
+        case '=':
+          // cursor position, biased by 0x20
+          SetCursY(Lines,vt->Params[0] - 0x20);
+          SetCursX(Lines,vt->Params[1] - 0x20);
+          break;
+        }
+      return;
+    }
+
+  if (vt->NInter)
+    return;                     // character sets etc., not supported
+  switch (final)
+    {
+    case '7':                   // DECSC save cursor
+      Lines->SavedX = Lines->CursX;
+      Lines->SavedY = Lines->CursY;
+      Lines->SavedAttr = Lines->Attr;
+      break;
+    case '8':                   // DECRC restore cursor
+      SetCursY(Lines,Lines->SavedY);
+      SetCursX(Lines,Lines->SavedX);
+      Lines->Attr = Lines->SavedAttr;
+      break;
+    case 'D':                   // IND index
+      SetCursY(Lines,Lines->CursY+1);
+      break;
+    case 'E':                   // NEL next line
+      SetCursX(Lines,0);
+      SetCursY(Lines,Lines->CursY+1);
+      break;
+    case 'M':                   // RI reverse index
+      if (Lines->CursY > 0)
+        SetCursY(Lines,Lines->CursY-1);
+      else
+        InsertLines(Lines,0,1);
+      break;
+    case 'c':                   // RIS reset
+      Lines->Attr = 0;
+      Lines->Cursor = 1;
+      ClearScreen(Lines);
+      break;
+    }
+}
+
+/**
+   Converts SGR parameters to a character attribute.
+   @param vt Parser, holding the parameters.
+   @param Attr Attribute to start from.
+   @return The new attribute.
+*/
+static unsigned short SetGraphics(TVt *vt,unsigned short Attr)
+{
+  int i,p;
+
+  if (!vt->NParams)
+    return 0;
+  for (i=0;i<vt->NParams;i++)
+    {
+      p = vt->Params[i];
+      if (p == 0)
+        Attr = 0;
+      else if (p == 1)
+        Attr |= ATTR_BOLD;
+      else if (p == 4)
+        Attr |= ATTR_UNDERLINE;
+      else if (p == 7)
+        Attr |= ATTR_REVERSE;
+      else if (p == 22)
+        Attr &= ~ATTR_BOLD;
+      else if (p == 24)
+        Attr &= ~ATTR_UNDERLINE;
+      else if (p == 27)
+        Attr &= ~ATTR_REVERSE;
+      else if (p >= 30 && p <= 37)
+        Attr = (Attr & ~ATTR_FG) | ATTR_FGSET | (p - 30);
+      else if (p >= 90 && p <= 97)
+        Attr = (Attr & ~ATTR_FG) | ATTR_FGSET | (p - 90 + 8);
+      else if (p == 39)
+        Attr &= ~(ATTR_FG|ATTR_FGSET);
+      else if (p >= 40 && p <= 47)
+        Attr = (Attr & ~ATTR_BG) | ATTR_BGSET | (p - 40) << 4;
+      else if (p >= 100 && p <= 107)
+        Attr = (Attr & ~ATTR_BG) | ATTR_BGSET | (p - 100 + 8) << 4;
+      else if (p == 49)
+        Attr &= ~(ATTR_BG|ATTR_BGSET);
+      else if (p == 38 || p == 48)
+        {
+          // 256 color and RGB forms: keep the 16 basic colors, skip the rest
+          if (i + 2 < vt->NParams && vt->Params[i+1] == 5)
+            {
+              if (vt->Params[i+2] < 16)
+                Attr = p == 38 ? (Attr & ~ATTR_FG) | ATTR_FGSET | vt->Params[i+2] :
+                  (Attr & ~ATTR_BG) | ATTR_BGSET | vt->Params[i+2] << 4;
+              i += 2;
+            }
+          else if (i + 1 < vt->NParams && vt->Params[i+1] == 2)
+            i += 4;
+        }
+    }
+  return Attr;
+}
+
+/**
+   Parser callback: carries out a control sequence (CSI).
+   @param User Pointer to TLines structure.
+   @param vt Parser, holding the sequence.
+   @param final The final character.
+*/
+static void VtCsi(void *User,TVt *vt,int final)
+{
+  TLines *Lines = User;
+  int y = Lines->CursY;
+  int x = Lines->CursX;
+  int n = VtParam(vt,0,1);
+  int Bottom = Lines->Height - 1;
+  int i;
+
+  if (vt->Inter[0] == '?')
+    {
+      // DEC private modes: only the cursor is supported
+      if ((final == 'h' || final == 'l') && VtParam(vt,0,0) == 25)
+        {
+          Lines->Cursor = final == 'h';
+          MarkDirty(Lines,y,x,x+1);
+        }
+      return;
+    }
+  if (vt->NInter)
+    return;
+
+  switch (final)
+    {
+    case 'A':                   // CUU cursor up
+      SetCursY(Lines,y - n < 0 ? 0 : y - n);
+      break;
+    case 'B':                   // CUD cursor down
+    case 'e':                   // VPR
+      SetCursY(Lines,y + n > Bottom ? Bottom : y + n);
+      break;
+    case 'C':                   // CUF cursor forward
+    case 'a':                   // HPR
+      SetCursX(Lines,x + n > Lines->Cols - 1 ? Lines->Cols - 1 : x + n);
+      break;
+    case 'D':                   // CUB cursor back
+      SetCursX(Lines,x - n < 0 ? 0 : x - n);
+      break;
+    case 'E':                   // CNL cursor next line
+      SetCursX(Lines,0);
+      SetCursY(Lines,y + n > Bottom ? Bottom : y + n);
+      break;
+    case 'F':                   // CPL cursor previous line
+      SetCursX(Lines,0);
+      SetCursY(Lines,y - n < 0 ? 0 : y - n);
+      break;
+    case 'G':                   // CHA cursor column
+    case '`':                   // HPA
+      SetCursX(Lines,n - 1 > Lines->Cols - 1 ? Lines->Cols - 1 : n - 1);
+      break;
+    case 'd':                   // VPA cursor row
+      SetCursY(Lines,n - 1 > Bottom ? Bottom : n - 1);
+      break;
+    case 'H':                   // CUP cursor position
+    case 'f':                   // HVP
+      y = VtParam(vt,0,1) - 1;
+      x = VtParam(vt,1,1) - 1;
+      SetCursY(Lines,y > Bottom ? Bottom : y);
+      SetCursX(Lines,x > Lines->Cols - 1 ? Lines->Cols - 1 : x);
+      break;
+    case 'J':                   // ED erase in display
+      switch (VtParam(vt,0,0))
+        {
+        case 0:
+          EraseLine(Lines,y,x,ToEol);
+          for (i=y+1;i<Lines->Count;i++)
+            EraseLine(Lines,i,0,ToEol);
+          break;
+        case 1:
+          for (i=0;i<y;i++)
+            EraseLine(Lines,i,0,ToEol);
+          EraseLine(Lines,y,0,x+1);
+          break;
+        default:
+          for (i=0;i<Lines->Count;i++)
+            EraseLine(Lines,i,0,ToEol);
+          break;
+        }
+      SetCursX(Lines,x);        // re-pad the cursor line
+      break;
+    case 'K':                   // EL erase in line
+      switch (VtParam(vt,0,0))
+        {
+        case 0:
+          EraseLine(Lines,y,x,ToEol);
+          break;
+        case 1:
+          EraseLine(Lines,y,0,x+1);
+          break;
+        default:
+          EraseLine(Lines,y,0,ToEol);
+          break;
+        }
+      SetCursX(Lines,x);
+      break;
+    case 'L':                   // IL insert lines
+      InsertLines(Lines,y,n);
+      break;
+    case 'M':                   // DL delete lines
+      InsertLines(Lines,y,-n);
+      break;
+    case '@':                   // ICH insert characters
+      InsertChars(Lines,n);
+      break;
+    case 'P':                   // DCH delete characters
+      InsertChars(Lines,-n);
+      break;
+    case 'X':                   // ECH erase characters
+      EraseLine(Lines,y,x,x+n);
+      SetCursX(Lines,x);
+      break;
+    case 'm':                   // SGR character attributes
+      Lines->Attr = SetGraphics(vt,Lines->Attr);
+      break;
+    case 's':                   // save cursor
+      Lines->SavedX = x;
+      Lines->SavedY = y;
+      break;
+    case 'u':                   // restore cursor
+      SetCursY(Lines,Lines->SavedY);
+      SetCursX(Lines,Lines->SavedX);
+      break;
+    }
+}
+
+/**
+   Parser callback: handles an operating system command.  Only setting the
+   window title is supported; it goes to the Title callback.
+   @param User Pointer to TLines structure.
+   @param vt Parser, holding the command string.
+*/
+static void VtOsc(void *User,TVt *vt)
+{
+  TLines *Lines = User;
+
+  if ((vt->Osc[0] == '0' || vt->Osc[0] == '2') && vt->Osc[1] == ';')
+    if (Lines->Cb && Lines->Cb->Title)
+      Lines->Cb->Title(Lines->User,vt->Osc + 2);
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,111 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef TERM_H
+#define TERM_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file term.h Terminal screen model and escape sequence handling, without
+   any Win32 dependency.
+   @addtogroup termcore
+ */
+
+#include "vtparse.h"
+
+#define ToEol 0x7fff            ///< Dirty span end meaning "to the end of the line".
+#define MaxLines 301            ///< Number of screen lines TLines starts with.  TermResize() adds more.
+#define MaxCols 301             ///< Number of character cells per line TLines starts with.  TermResize() adds more.
+
+// Character attributes.  Zero is the default, black on white.
+#define ATTR_FG 0x000f          ///< Foreground color, index into the palette.
+#define ATTR_BG 0x00f0          ///< Background color, index into the palette << 4.
+#define ATTR_FGSET 0x0100       ///< Flag: ATTR_FG is set, otherwise default.
+#define ATTR_BGSET 0x0200       ///< Flag: ATTR_BG is set, otherwise default.
+#define ATTR_BOLD 0x0400        ///< Bold, shown as the bright color.
+#define ATTR_UNDERLINE 0x0800   ///< Underlined.
+#define ATTR_REVERSE 0x1000     ///< Foreground and background swapped.
+
+typedef struct TLines TLines;
+
+/**
+   What the terminal core calls to tell the front end about changes.  Any of
+   these may be NULL.
+*/
+typedef struct {
+  /// Lines were marked dirty or AllDirty was set; schedule a repaint.
+  void (*Invalidate)(void *User);
+  /// Screen lines 0 to n-1 are about to scroll off the top and be reused.
+  void (*Scroll)(void *User,TLines *Lines,int n);
+  /// The host set the window title, with OSC 0 or 2.
+  void (*Title)(void *User,const char *Title);
+} TTermCallbacks;
+
+/** Contains the state of the display.  This structure describes the current
+    state of the display - which characters are displayed, and the cursor
+    position and state.
+*/
+struct TLines {
+  char *Chars;		///< Rows x Cols characters.  Lines are not NUL terminated.
+  unsigned short *Attrs;	///< Rows x Cols attributes, one per character, ATTR_BOLD etc.
+  int *Len;		///< Number of characters used in each row.
+  int Rows;		///< Allocated number of lines.  Grows with the window, see TermResize().
+  int Cols;		///< Allocated number of characters per line.  Grows with the window.
+  int First;		///< Row holding line 0.  Scrolling just moves this.
+  int Count;		///< Number of lines in display.
+  int Width;		///< Width of the window in characters; text wraps before the last one.
+  int Height;		///< Number of lines on the screen, at most Rows.
+  int CursX,CursY;	///< Current cursor position.
+  int Cursor;		///< On/off state of cursor.
+  unsigned short Attr;	///< Attribute for new characters.
+  int CrLf;		///< Flag: LF implies CR, for unix hosts.
+  int SavedX,SavedY;	///< Cursor position saved by ESC 7 or CSI s.
+  unsigned short SavedAttr;	///< Character attribute saved by ESC 7.
+  char *Dirty;		///< Per-line flags: line changed since it was last painted.
+  int *DirtyStart;	///< Per-line first changed column, valid if Dirty is set.
+  int *DirtyEnd;	///< Per-line column after the last changed one, or ToEol.
+  int AllDirty;		///< Flag: lines have moved or were cleared, repaint the whole screen.
+  TVt Vt;		///< Escape sequence parser for received characters.
+  const TTermCallbacks *Cb;	///< Front end callbacks.
+  void *User;		///< Passed to the callbacks.
+};
+
+/// Row of the cell block holding line y.
+#define LineRow(L,y) (((L)->First + (y)) % (L)->Rows)
+/// Pointer to the characters of line y.
+#define LineText(L,y) ((L)->Chars + LineRow(L,y)*(L)->Cols)
+/// Pointer to the attributes of line y.
+#define LineAttr(L,y) ((L)->Attrs + LineRow(L,y)*(L)->Cols)
+/// Number of characters in line y.  May be assigned to.
+#define LineLen(L,y) ((L)->Len[LineRow(L,y)])
+
+TLines *CreateLines(int Count,int Mode,const TTermCallbacks *Cb,void *User);
+void DestroyLines(TLines *Lines);
+void TermWrite(TLines *Lines,const char *buf,int len);
+void TermResize(TLines *Lines,int Width,int Height);
+void ClearScreen(TLines *Lines);
+void PutText(TLines *Lines,const char *s,int n);
+void SetCursX(TLines *Lines,int x);
+void SetCursY(TLines *Lines,int y);
+void MarkDirty(TLines *Lines,int y,int x0,int x1);
+
+#endif
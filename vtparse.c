@@ -0,0 +1,502 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file vtparse.c This file implements the escape sequence parser.
+  @defgroup vtparse Escape Sequence Parser
+
+  @section intro Introduction
+
+  The parser is the state machine from Paul Williams' description of the DEC
+  VT500 series parser (https://vt100.net/emu/dec_ansi_parser).  Every state
+  has a 256 entry table giving the action to take and the state to go to for
+  each byte, so parsing a byte is one table lookup.  The tables are built once
+  from the byte ranges in that description.
+
+  Bytes 0xA0-0xFF inside a sequence act like 0x20-0x7F, as on the VT500.  The
+  8-bit C1 controls are not recognized, since serial devices send all sorts
+  of 8-bit data; in the ground state every byte from 0x80 up is printed.
+
+  Most of the data is plain text, so the ground state doesn't go through the
+  table at all.  It scans for the end of the run of printable bytes and hands
+  the whole run to the Print handler in one call.  The scan looks at 16 bytes
+  at a time with SSE2, or 32 with AVX2, if the processor has them; which one
+  is picked at run time, so the program still runs on anything.
+
+  The legacy ADM-style escapes get a table of their own, which differs only
+  in what ESC leads to.
+  @{
+ */
+#include <string.h>
+#include "vtparse.h"
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include <immintrin.h>
+#define VT_X86 1                ///< Build the SSE2 and AVX2 scanners.
+#endif
+
+/// Actions.  A table entry is the action << 8 | the next state.
+enum {
+  A_NONE,       ///< Nothing, just change state.
+  A_IGNORE,     ///< Drop the byte.
+  A_PRINT,      ///< Print the byte.
+  A_EXECUTE,    ///< Carry out a control character.
+  A_COLLECT,    ///< Keep an intermediate or private marker.
+  A_PARAM,      ///< Add a digit or ; to the parameters.
+  A_ESC,        ///< Dispatch an escape sequence.
+  A_CSI,        ///< Dispatch a control sequence.
+  A_OSCPUT,     ///< Add a byte to the OSC string.
+  A_ADMARG,     ///< Keep a raw ADM argument byte.
+  A_ADM         ///< Keep the last ADM argument byte and dispatch.
+};
+
+#define STAY 0xff               ///< Next state meaning "no state change".
+
+static unsigned short AnsiTable[VT_NSTATES][256];   ///< Transitions in ANSI mode.
+static unsigned short AdmTable[VT_NSTATES][256];    ///< Transitions in ADM mode.
+static int TablesBuilt = 0;     ///< Flag: the tables are ready.
+
+/// True for a byte that ends a run of printable text: C0 controls, including ESC, and DEL.
+#define IS_CTRL(c) ((c) < 0x20 || (c) == 0x7f)
+
+/**
+   Finds the end of a run of printable bytes, one byte at a time.
+   @param s Start of the run.
+   @param end End of the buffer.
+   @return Pointer to the first control byte, or end.
+ */
+static const unsigned char *ScanScalar(const unsigned char *s,const unsigned char *end)
+{
+  while (s < end && !IS_CTRL(*s))
+    s++;
+  return s;
+}
+
+#ifdef VT_X86
+/**
+   Finds the end of a run of printable bytes, 16 at a time.  A byte is a
+   control if max(byte,0x1F) == 0x1F, unsigned, or if it is 0x7F.
+   @param s Start of the run.
+   @param end End of the buffer.
+   @return Pointer to the first control byte, or end.
+ */
+__attribute__((target("sse2")))
+static const unsigned char *ScanSse2(const unsigned char *s,const unsigned char *end)
+{
+  const __m128i c1f = _mm_set1_epi8(0x1f);
+  const __m128i c7f = _mm_set1_epi8(0x7f);
+  const unsigned char *s0 = s;
+  __m128i v,m;
+  int bits;
+
+  for (;end - s >= 16;s += 16)
+    {
+      v = _mm_loadu_si128((const __m128i *)s);
+      m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v,c1f),c1f),_mm_cmpeq_epi8(v,c7f));
+      bits = _mm_movemask_epi8(m);
+      if (bits)
+        return s + __builtin_ctz(bits);
+    }
+  if (s == end || end - s0 < 16)
+    return ScanScalar(s,end);
+
+  // the last few bytes: load the last 16, overlapping bytes already checked
+  v = _mm_loadu_si128((const __m128i *)(end - 16));
+  m = _mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v,c1f),c1f),_mm_cmpeq_epi8(v,c7f));
+  bits = _mm_movemask_epi8(m) & (0xffff << (16 - (end - s)));
+  return bits ? end - 16 + __builtin_ctz(bits) : end;
+}
+
+/**
+   Finds the end of a run of printable bytes, 32 at a time.
+   @param s Start of the run.
+   @param end End of the buffer.
+   @return Pointer to the first control byte, or end.
+ */
+__attribute__((target("avx2")))
+static const unsigned char *ScanAvx2(const unsigned char *s,const unsigned char *end)
+{
+  const __m256i c1f = _mm256_set1_epi8(0x1f);
+  const __m256i c7f = _mm256_set1_epi8(0x7f);
+  __m256i v,m;
+  unsigned bits;
+
+  for (;end - s >= 32;s += 32)
+    {
+      v = _mm256_loadu_si256((const __m256i *)s);
+      m = _mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v,c1f),c1f),_mm256_cmpeq_epi8(v,c7f));
+      bits = _mm256_movemask_epi8(m);
+      if (bits)
+        return s + __builtin_ctz(bits);
+    }
+  return ScanSse2(s,end);       // fewer than 32 left
+}
+#endif
+
+/// The printable run scanner in use, NULL until one is chosen.
+static const unsigned char *(*Scan)(const unsigned char *s,const unsigned char *end) = NULL;
+static int SimdLevel = 0;       ///< Scanner in use: 0 scalar, 1 SSE2, 2 AVX2.
+
+/**
+   Chooses the printable run scanner.  The fastest one the processor supports
+   is chosen when the first parser is set up; this is only needed to compare
+   them.
+   @param Max Fastest scanner allowed: 0 scalar, 1 SSE2, 2 AVX2.
+   @return The scanner now in use, 0 to 2.
+ */
+int VtSetSimd(int Max)
+{
+  Scan = ScanScalar;
+  SimdLevel = 0;
+#ifdef VT_X86
+  __builtin_cpu_init();
+  if (Max >= 2 && __builtin_cpu_supports("avx2"))
+    {
+      Scan = ScanAvx2;
+      SimdLevel = 2;
+    }
+  else if (Max >= 1 && __builtin_cpu_supports("sse2"))
+    {
+      Scan = ScanSse2;
+      SimdLevel = 1;
+    }
+#endif
+  return SimdLevel;
+}
+
+/**
+   Sets the transition for a range of bytes.
+   @param t Table to fill in.
+   @param s State.
+   @param lo First byte.
+   @param hi Last byte.
+   @param a Action.
+   @param next Next state, or STAY.
+ */
+static void Rule(unsigned short t[][256],int s,int lo,int hi,int a,int next)
+{
+  for (;lo <= hi;lo++)
+    t[s][lo] = a << 8 | next;
+}
+
+/**
+   Sets the transition for the C0 control characters that are executed
+   or ignored inside a sequence: all but CAN, SUB and ESC.
+   @param t Table to fill in.
+   @param s State.
+   @param a Action.
+ */
+static void Controls(unsigned short t[][256],int s,int a)
+{
+  Rule(t,s,0x00,0x17,a,STAY);
+  Rule(t,s,0x19,0x19,a,STAY);
+  Rule(t,s,0x1c,0x1f,a,STAY);
+}
+
+/**
+   Builds the transition tables.
+ */
+static void BuildTables(void)
+{
+  unsigned short (*t)[256] = AnsiTable;
+  int s;
+
+  // everything not listed is ignored
+  for (s=0;s<VT_NSTATES;s++)
+    Rule(t,s,0x00,0xff,A_IGNORE,STAY);
+
+  Controls(t,VT_GROUND,A_EXECUTE);
+  Rule(t,VT_GROUND,0x20,0x7e,A_PRINT,STAY);
+  Rule(t,VT_GROUND,0x80,0xff,A_PRINT,STAY);
+
+  Controls(t,VT_ESCAPE,A_EXECUTE);
+  Rule(t,VT_ESCAPE,0x20,0x2f,A_COLLECT,VT_ESCAPE_INTER);
+  Rule(t,VT_ESCAPE,0x30,0x7e,A_ESC,VT_GROUND);
+  Rule(t,VT_ESCAPE,'P','P',A_NONE,VT_DCS_ENTRY);
+  Rule(t,VT_ESCAPE,'X','X',A_NONE,VT_SOS_PM_APC);
+  Rule(t,VT_ESCAPE,'[','[',A_NONE,VT_CSI_ENTRY);
+  Rule(t,VT_ESCAPE,']',']',A_NONE,VT_OSC);
+  Rule(t,VT_ESCAPE,'^','_',A_NONE,VT_SOS_PM_APC);
+
+  Controls(t,VT_ESCAPE_INTER,A_EXECUTE);
+  Rule(t,VT_ESCAPE_INTER,0x20,0x2f,A_COLLECT,STAY);
+  Rule(t,VT_ESCAPE_INTER,0x30,0x7e,A_ESC,VT_GROUND);
+
+  Controls(t,VT_CSI_ENTRY,A_EXECUTE);
+  Rule(t,VT_CSI_ENTRY,0x20,0x2f,A_COLLECT,VT_CSI_INTER);
+  Rule(t,VT_CSI_ENTRY,0x30,0x39,A_PARAM,VT_CSI_PARAM);
+  Rule(t,VT_CSI_ENTRY,0x3a,0x3a,A_NONE,VT_CSI_IGNORE);
+  Rule(t,VT_CSI_ENTRY,0x3b,0x3b,A_PARAM,VT_CSI_PARAM);
+  Rule(t,VT_CSI_ENTRY,0x3c,0x3f,A_COLLECT,VT_CSI_PARAM);
+  Rule(t,VT_CSI_ENTRY,0x40,0x7e,A_CSI,VT_GROUND);
+
+  Controls(t,VT_CSI_PARAM,A_EXECUTE);
+  Rule(t,VT_CSI_PARAM,0x20,0x2f,A_COLLECT,VT_CSI_INTER);
+  Rule(t,VT_CSI_PARAM,0x30,0x39,A_PARAM,STAY);
+  Rule(t,VT_CSI_PARAM,0x3a,0x3a,A_NONE,VT_CSI_IGNORE);
+  Rule(t,VT_CSI_PARAM,0x3b,0x3b,A_PARAM,STAY);
+  Rule(t,VT_CSI_PARAM,0x3c,0x3f,A_NONE,VT_CSI_IGNORE);
+  Rule(t,VT_CSI_PARAM,0x40,0x7e,A_CSI,VT_GROUND);
+
+  Controls(t,VT_CSI_INTER,A_EXECUTE);
+  Rule(t,VT_CSI_INTER,0x20,0x2f,A_COLLECT,STAY);
+  Rule(t,VT_CSI_INTER,0x30,0x3f,A_NONE,VT_CSI_IGNORE);
+  Rule(t,VT_CSI_INTER,0x40,0x7e,A_CSI,VT_GROUND);
+
+  Controls(t,VT_CSI_IGNORE,A_EXECUTE);
+  Rule(t,VT_CSI_IGNORE,0x40,0x7e,A_NONE,VT_GROUND);
+
+  Rule(t,VT_DCS_ENTRY,0x20,0x2f,A_COLLECT,VT_DCS_INTER);
+  Rule(t,VT_DCS_ENTRY,0x30,0x39,A_PARAM,VT_DCS_PARAM);
+  Rule(t,VT_DCS_ENTRY,0x3a,0x3a,A_NONE,VT_DCS_IGNORE);
+  Rule(t,VT_DCS_ENTRY,0x3b,0x3b,A_PARAM,VT_DCS_PARAM);
+  Rule(t,VT_DCS_ENTRY,0x3c,0x3f,A_COLLECT,VT_DCS_PARAM);
+  Rule(t,VT_DCS_ENTRY,0x40,0x7e,A_NONE,VT_DCS_PASS);
+
+  Rule(t,VT_DCS_PARAM,0x20,0x2f,A_COLLECT,VT_DCS_INTER);
+  Rule(t,VT_DCS_PARAM,0x30,0x39,A_PARAM,STAY);
+  Rule(t,VT_DCS_PARAM,0x3a,0x3a,A_NONE,VT_DCS_IGNORE);
+  Rule(t,VT_DCS_PARAM,0x3b,0x3b,A_PARAM,STAY);
+  Rule(t,VT_DCS_PARAM,0x3c,0x3f,A_NONE,VT_DCS_IGNORE);
+  Rule(t,VT_DCS_PARAM,0x40,0x7e,A_NONE,VT_DCS_PASS);
+
+  Rule(t,VT_DCS_INTER,0x20,0x2f,A_COLLECT,STAY);
+  Rule(t,VT_DCS_INTER,0x30,0x3f,A_NONE,VT_DCS_IGNORE);
+  Rule(t,VT_DCS_INTER,0x40,0x7e,A_NONE,VT_DCS_PASS);
+
+  // device control strings are passed over; nothing here uses them
+
+  Rule(t,VT_OSC,0x07,0x07,A_NONE,VT_GROUND);   // xterm ends OSC with BEL too
+  Rule(t,VT_OSC,0x20,0x7f,A_OSCPUT,STAY);
+
+  for (s=0;s<VT_NSTATES;s++)
+    {
+      if (s != VT_GROUND)
+        {
+          // GR acts like GL inside sequences
+          memcpy(&t[s][0xa0],&t[s][0x20],0x60*sizeof(t[s][0]));
+          Rule(t,s,0x80,0x9f,A_IGNORE,STAY);
+        }
+      // anywhere
+      Rule(t,s,0x18,0x18,A_EXECUTE,VT_GROUND);
+      Rule(t,s,0x1a,0x1a,A_EXECUTE,VT_GROUND);
+      Rule(t,s,0x1b,0x1b,A_NONE,VT_ESCAPE);
+    }
+
+  // ADM mode: the same ground state, but its own escapes.  The argument
+  // bytes can be anything at all.
+  memcpy(AdmTable,AnsiTable,sizeof(AdmTable));
+  t = AdmTable;
+  Rule(t,VT_GROUND,0x1b,0x1b,A_NONE,VT_ADM_ESCAPE);
+  Rule(t,VT_ADM_ESCAPE,0x00,0xff,A_ESC,VT_GROUND);
+  Rule(t,VT_ADM_ESCAPE,'.','.',A_COLLECT,VT_ADM_ARG1);
+  Rule(t,VT_ADM_ESCAPE,'=','=',A_COLLECT,VT_ADM_ARG2);
+  Rule(t,VT_ADM_ARG2,0x00,0xff,A_ADMARG,VT_ADM_ARG1);
+  Rule(t,VT_ADM_ARG1,0x00,0xff,A_ADM,VT_GROUND);
+
+  if (!Scan)
+    VtSetSimd(2);
+  TablesBuilt = 1;
+}
+
+/**
+   Sets up a parser.
+   @param vt Parser to set up.
+   @param Mode VT_ANSI or VT_ADM.
+   @param H Handlers to call.
+   @param User Passed to the handlers.
+ */
+void VtInit(TVt *vt,int Mode,const TVtHandlers *H,void *User)
+{
+  memset(vt,0,sizeof(TVt));
+  vt->H = H;
+  vt->User = User;
+  VtSetMode(vt,Mode);
+}
+
+/**
+   Changes the parser mode.  Any sequence in progress is dropped.
+   @param vt Parser.
+   @param Mode VT_ANSI or VT_ADM.
+ */
+void VtSetMode(TVt *vt,int Mode)
+{
+  if (!TablesBuilt)
+    BuildTables();
+  vt->Mode = Mode;
+  vt->Table = Mode == VT_ADM ? &AdmTable[0][0] : &AnsiTable[0][0];
+  vt->State = VT_GROUND;
+}
+
+/**
+   Gets a numeric parameter of the sequence being dispatched.
+   @param vt Parser.
+   @param i Parameter number, zero-based.
+   @param def Default, used if the parameter is missing or zero.
+   @return The parameter value.
+ */
+int VtParam(TVt *vt,int i,int def)
+{
+  if (i >= vt->NParams || !vt->Params[i])
+    return def;
+  return vt->Params[i];
+}
+
+/**
+   Starts a new sequence: the entry action of the escape and control
+   string states.
+   @param vt Parser.
+ */
+static void Clear(TVt *vt)
+{
+  vt->NInter = 0;
+  vt->Inter[0] = 0;
+  vt->NParams = 0;
+  vt->Overflow = 0;
+  memset(vt->Params,0,sizeof(vt->Params));
+}
+
+/**
+   Carries out one action.
+   @param vt Parser.
+   @param a Action.
+   @param ch The byte that caused it.
+ */
+static void Action(TVt *vt,int a,int ch)
+{
+  const TVtHandlers *H = vt->H;
+  char c = ch;
+  int *p;
+
+  switch (a)
+    {
+    case A_PRINT:
+      if (H->Print)
+        H->Print(vt->User,&c,1);
+      break;
+    case A_EXECUTE:
+      if (H->Execute)
+        H->Execute(vt->User,ch);
+      break;
+    case A_COLLECT:
+      if (vt->NInter < VT_MAXINTER)
+        {
+          vt->Inter[vt->NInter++] = ch;
+          vt->Inter[vt->NInter] = 0;
+        }
+      else
+        vt->Overflow = 1;
+      break;
+    case A_PARAM:
+      if (!vt->NParams)
+        vt->NParams = 1;
+      if (ch == ';')
+        {
+          if (vt->NParams < VT_MAXPARAMS)
+            vt->NParams++;
+          else
+            vt->Overflow = 1;
+        }
+      else
+        {
+          p = &vt->Params[vt->NParams-1];
+          if (*p < 10000)
+            *p = *p*10 + (ch & 0x0f);
+        }
+      break;
+    case A_ESC:
+      if (!vt->Overflow && H->EscDispatch)
+        H->EscDispatch(vt->User,vt,ch);
+      break;
+    case A_CSI:
+      if (!vt->Overflow && H->CsiDispatch)
+        H->CsiDispatch(vt->User,vt,ch);
+      break;
+    case A_OSCPUT:
+      if (vt->OscLen < VT_MAXOSC-1)
+        vt->Osc[vt->OscLen++] = ch;
+      break;
+    case A_ADMARG:
+    case A_ADM:
+      vt->Params[vt->NParams++] = (unsigned char)ch;
+      if (a == A_ADM && H->EscDispatch)
+        H->EscDispatch(vt->User,vt,vt->Inter[0]);
+      break;
+    }
+}
+
+/**
+   Parses a buffer of received bytes, calling the handlers as it goes.  A
+   sequence may be split across calls.
+   @param vt Parser.
+   @param buf Bytes to parse.
+   @param len Number of bytes.
+ */
+void VtParse(TVt *vt,const char *buf,int len)
+{
+  const unsigned char *s = (const unsigned char *)buf;
+  const unsigned char *end = s + len;
+  const unsigned char *run;
+  unsigned short t;
+  int next;
+
+  while (s < end)
+    {
+      // fast path: a run of printable text
+      if (vt->State == VT_GROUND && !IS_CTRL(*s))
+        {
+          run = s;
+          s = Scan(s,end);
+          if (vt->H->Print)
+            vt->H->Print(vt->User,(const char *)run,s - run);
+          continue;
+        }
+
+      t = vt->Table[vt->State*256 + *s];
+      next = t & 0xff;
+      if (next == STAY)
+        {
+          Action(vt,t >> 8,*s++);
+          continue;
+        }
+
+      // exit action
+      if (vt->State == VT_OSC)
+        {
+          vt->Osc[vt->OscLen] = 0;
+          if (vt->H->OscDispatch)
+            vt->H->OscDispatch(vt->User,vt);
+        }
+      Action(vt,t >> 8,*s++);
+      // entry action
+      vt->State = next;
+      if (next == VT_ESCAPE || next == VT_CSI_ENTRY || next == VT_DCS_ENTRY || next == VT_ADM_ESCAPE)
+        Clear(vt);
+      else if (next == VT_OSC)
+        vt->OscLen = 0;
+    }
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,108 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef VTPARSE_H
+#define VTPARSE_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file vtparse.h DEC/ANSI escape sequence parser.
+   @addtogroup vtparse
+ */
+
+#define VT_MAXPARAMS 16         ///< Most numeric parameters kept per sequence.
+#define VT_MAXINTER 4           ///< Most intermediate and private marker characters kept.
+#define VT_MAXOSC 256           ///< Longest OSC string kept, including the NUL.
+
+/// Parser modes, see VtSetMode().
+enum {
+  VT_ANSI,                      ///< DEC VT100/VT500 and ANSI escape sequences.
+  VT_ADM                        ///< Legacy ADM-style escapes: ESC T, ESC Y, ESC . x, ESC = row col.
+};
+
+/// Parser states, after Paul Williams' DEC ANSI parser, plus the ADM states.
+enum {
+  VT_GROUND,
+  VT_ESCAPE,
+  VT_ESCAPE_INTER,
+  VT_CSI_ENTRY,
+  VT_CSI_PARAM,
+  VT_CSI_INTER,
+  VT_CSI_IGNORE,
+  VT_DCS_ENTRY,
+  VT_DCS_PARAM,
+  VT_DCS_INTER,
+  VT_DCS_PASS,
+  VT_DCS_IGNORE,
+  VT_OSC,
+  VT_SOS_PM_APC,
+  VT_ADM_ESCAPE,
+  VT_ADM_ARG2,
+  VT_ADM_ARG1,
+  VT_NSTATES
+};
+
+typedef struct TVt TVt;
+
+/**
+   What the parser calls as it recognizes things.  Any of these may be NULL.
+*/
+typedef struct {
+  /// A run of printable characters.
+  void (*Print)(void *User,const char *s,int n);
+  /// A control character to carry out.
+  void (*Execute)(void *User,int ch);
+  /// An escape sequence.  In ADM mode, final is the command character and
+  /// the parameters are the raw argument bytes.
+  void (*EscDispatch)(void *User,TVt *vt,int final);
+  /// A control sequence (CSI).
+  void (*CsiDispatch)(void *User,TVt *vt,int final);
+  /// An operating system command string, in vt->Osc.
+  void (*OscDispatch)(void *User,TVt *vt);
+} TVtHandlers;
+
+/**
+   State of the parser.  The sequence being parsed is collected here, and
+   handlers can read it when they are called.
+*/
+struct TVt {
+  int Mode;                     ///< VT_ANSI or VT_ADM.
+  int State;                    ///< Current state, VT_GROUND etc.
+  const unsigned short *Table;  ///< Transition table for the mode.
+  char Inter[VT_MAXINTER+1];    ///< Intermediate and private marker characters, NUL terminated.
+  int NInter;                   ///< Number of characters in Inter.
+  int Params[VT_MAXPARAMS];     ///< Numeric parameters.  Missing ones are zero.
+  int NParams;                  ///< Number of parameters given.
+  int Overflow;                 ///< Flag: too many characters, ignore the sequence.
+  char Osc[VT_MAXOSC];          ///< OSC string, NUL terminated.
+  int OscLen;                   ///< Length of Osc.
+  const TVtHandlers *H;         ///< Handlers to call.
+  void *User;                   ///< Passed to the handlers.
+};
+
+void VtInit(TVt *vt,int Mode,const TVtHandlers *H,void *User);
+void VtSetMode(TVt *vt,int Mode);
+void VtParse(TVt *vt,const char *buf,int len);
+int VtParam(TVt *vt,int i,int def);
+int VtSetSimd(int Max);
+
+#endif
@@ -0,0 +1,281 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+/**
+  @file xfer.c This file implements the background file sender.
+  @defgroup xfer File Sender
+
+  @section intro Introduction
+
+  Sends a file out a serial port from a worker thread, so the window keeps
+  working during long transfers and the send can be cancelled.  Each send is
+  a TXfer, so every open port can be sending a file at the same time.
+
+  The file is memory mapped, a view of XFER_VIEW bytes at a time, and sent
+  with SerialPortWrite() straight from the mapping, so a large image is never
+  copied.  Optional pacing, for bootloaders that can't keep up, waits a number
+  of milliseconds after every character, and another number after every line
+  feed.  With pacing, characters are written one at a time (or one line at a
+  time), and the delays are rounded up to the system timer tick.
+
+  The window that starts the send gets a MESS_XFER message when it ends, and
+  can show the progress in the meantime with XferProgress().  It must call
+  XferStop() to clean up, and before closing the serial port.
+
+  XferStartBuf() sends a block of memory the same way, for pasting from the
+  clipboard, so a long paste doesn't hold up the window either.
+  @{
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "xfer.h"
+
+// Defines:
+#define XFER_VIEW (16*1024*1024)  ///< Bytes of the file mapped at a time, a multiple of 64 KB.
+#define XFER_PIECE 65536          ///< Most bytes passed to SerialPortWrite() at a time, for timely progress.
+
+// Functions:
+DWORD WINAPI XferProc(void *p);
+static BOOL StartThread(TXfer *x,TSerial *Port,HWND hwnd);
+static int SendView(TXfer *x,const char *p,DWORD len);
+
+/**
+   Starts sending a file in the background.
+   @param x The send.  Must not be running already.
+   @param FileName File to send.
+   @param Port Serial port to send it out on.
+   @param CharDelay Milliseconds to wait after each character, or zero.
+   @param LineDelay Milliseconds to wait after each line feed, or zero.
+   @param hwnd Window to post MESS_XFER to when the send ends.
+   @return FALSE if the send is already running or the thread can't be started.
+ */
+BOOL XferStart(TXfer *x,const char *FileName,TSerial *Port,int CharDelay,int LineDelay,HWND hwnd)
+{
+  if (x->Thread)
+    return FALSE;
+  strncpy(x->Name,FileName,MAX_PATH-1);
+  x->Name[MAX_PATH-1] = 0;
+  x->Buf = NULL;
+  x->CharDelay = CharDelay;
+  x->LineDelay = LineDelay;
+  x->Size = 0;
+  return StartThread(x,Port,hwnd);
+}
+
+/**
+   Starts sending a block of memory in the background, without pacing.
+   @param x The send.  Must not be running already.
+   @param Buf Characters to send, from malloc().  On success the send owns
+   them, and XferStop() frees them.
+   @param Size Number of characters.
+   @param Port Serial port to send them out on.
+   @param hwnd Window to post MESS_XFER to when the send ends.
+   @return FALSE if the send is already running or the thread can't be started.
+ */
+BOOL XferStartBuf(TXfer *x,char *Buf,DWORD Size,TSerial *Port,HWND hwnd)
+{
+  if (x->Thread)
+    return FALSE;
+  x->Name[0] = 0;
+  x->Buf = Buf;
+  x->CharDelay = x->LineDelay = 0;
+  x->Size = Size;
+  if (StartThread(x,Port,hwnd))
+    return TRUE;
+  x->Buf = NULL;
+  return FALSE;
+}
+
+/**
+   Internal function that starts the worker thread, once the source is set.
+   @param x The send.
+   @param Port Serial port to send out on.
+   @param hwnd Window to post MESS_XFER to when the send ends.
+   @return FALSE if the thread can't be started.
+ */
+static BOOL StartThread(TXfer *x,TSerial *Port,HWND hwnd)
+{
+  DWORD ThreadID;
+
+  x->Port = Port;
+  x->Wnd = hwnd;
+  x->Sent = 0;
+  x->StartTick = GetTickCount();
+  x->Cancel = CreateEvent(NULL,TRUE,FALSE,NULL);
+  x->Thread = CreateThread(NULL,4096,XferProc,x,0,&ThreadID);
+  if (!x->Thread)
+    {
+      CloseHandle(x->Cancel);
+      x->Cancel = NULL;
+      return FALSE;
+    }
+  return TRUE;
+}
+
+/**
+   Stops the send, if one is running, and waits for the worker to finish.
+   Also call this after MESS_XFER arrives, to clean up.
+   @param x The send.
+ */
+void XferStop(TXfer *x)
+{
+  if (!x->Thread)
+    return;
+  SetEvent(x->Cancel);
+  WaitForSingleObject(x->Thread,INFINITE);
+  CloseHandle(x->Thread);
+  CloseHandle(x->Cancel);
+  x->Thread = x->Cancel = NULL;
+  free(x->Buf);
+  x->Buf = NULL;
+}
+
+/**
+   Tells whether a send has been started and not yet stopped.
+   @param x The send.
+   @return TRUE while XferStop() has not been called.
+ */
+BOOL XferActive(TXfer *x)
+{
+  return x->Thread != NULL;
+}
+
+/**
+   Gets the progress of the current or last send.
+   @param x The send.
+   @param Sent Receives the bytes sent so far.
+   @param Size Receives the size of the file or block.
+   @param ms Receives the milliseconds since the send started.
+ */
+void XferProgress(TXfer *x,unsigned long long *Sent,unsigned long long *Size,DWORD *ms)
+{
+  *Sent = __atomic_load_n(&x->Sent,__ATOMIC_ACQUIRE);
+  *Size = __atomic_load_n(&x->Size,__ATOMIC_ACQUIRE);
+  *ms = GetTickCount() - x->StartTick;
+}
+
+/**
+   Internal function that sends a mapped view of the file, with the pacing.
+   @param x The send.
+   @param p Start of the view.
+   @param len Bytes in the view.
+   @return XFER_DONE, or how the send ended.
+ */
+static int SendView(TXfer *x,const char *p,DWORD len)
+{
+  const char *nl;
+  DWORD n,Delay;
+  int w;
+
+  while (len)
+    {
+      // with pacing, one character or one line at a time
+      if (x->CharDelay)
+        n = 1;
+      else if (x->LineDelay && (nl = memchr(p,'\n',len)) != NULL)
+        n = nl - p + 1;
+      else
+        n = len;
+      if (n > XFER_PIECE)
+        n = XFER_PIECE;
+
+      w = SerialPortWrite(x->Port,p,n,x->Cancel);
+      if (w < 0)
+        return XFER_CANCELLED;
+      if (!w)
+        return XFER_ERROR;
+      __atomic_add_fetch(&x->Sent,w,__ATOMIC_RELEASE);
+      p += w;
+      len -= w;
+
+      Delay = x->CharDelay;
+      if (p[-1] == '\n')
+        Delay += x->LineDelay;
+      if (Delay && WaitForSingleObject(x->Cancel,Delay) == WAIT_OBJECT_0)
+        return XFER_CANCELLED;
+    }
+  return XFER_DONE;
+}
+
+/**
+   Internal worker thread procedure.  Maps the file a view at a time and
+   sends each view, or sends the block, then posts MESS_XFER with the result.
+   @param p The send.
+ */
+DWORD WINAPI XferProc(void *p)
+{
+  TXfer *x = p;
+  HANDLE File,Map = NULL;
+  DWORD High,Low,Len;
+  unsigned long long Off,Size;
+  const char *View;
+  int Result = XFER_DONE;
+
+  if (x->Buf)
+    {
+      Result = SendView(x,x->Buf,(DWORD)x->Size);
+      PostMessage(x->Wnd,MESS_XFER,Result,(LPARAM)x);
+      return 0;
+    }
+
+  File = CreateFile(x->Name,GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
+                    FILE_FLAG_SEQUENTIAL_SCAN,NULL);
+  if (File == INVALID_HANDLE_VALUE)
+    {
+      PostMessage(x->Wnd,MESS_XFER,XFER_ERROR,(LPARAM)x);
+      return 0;
+    }
+  Low = GetFileSize(File,&High);
+  Size = (unsigned long long)High << 32 | Low;
+  __atomic_store_n(&x->Size,Size,__ATOMIC_RELEASE);
+  // an empty file can't be mapped, and there is nothing to send anyway
+  if (Size)
+    {
+      Map = CreateFileMapping(File,NULL,PAGE_READONLY,0,0,NULL);
+      if (!Map)
+        Result = XFER_ERROR;
+    }
+
+  for (Off=0;Off<Size && Result==XFER_DONE;Off+=Len)
+    {
+      Len = Size - Off < XFER_VIEW ? (DWORD)(Size - Off) : XFER_VIEW;
+      View = MapViewOfFile(Map,FILE_MAP_READ,(DWORD)(Off >> 32),(DWORD)Off,Len);
+      if (!View)
+        {
+          Result = XFER_ERROR;
+          break;
+        }
+      Result = SendView(x,View,Len);
+      UnmapViewOfFile(View);
+    }
+
+  if (Map)
+    CloseHandle(Map);
+  CloseHandle(File);
+  PostMessage(x->Wnd,MESS_XFER,Result,(LPARAM)x);
+  return 0;
+}
+
+/**
+   @}
+*/
@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2008 by Blake Leverett                                  *
+ *   bleverett@gmail.com
+ *                                                                         *
+ *   FUNterm is free software; you can redistribute it and/or modify       *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, see <http://www.gnu.org/licenses/>.  *
+ ***************************************************************************/
+#ifndef XFER_H
+#define XFER_H
+/*
+  CVS info:
+  $Id$
+  $Revision$
+  $Date$
+ */
+
+/**
+   @file xfer.h Background file sender.
+   @addtogroup xfer
+ */
+
+#include <windows.h>
+#include "serial.h"
+
+#define MESS_XFER (WM_USER+3)   ///< Custom windows message ID posted when a file send ends, wParam is the result, lParam the TXfer.
+
+/// Results of a file send, passed in MESS_XFER.
+enum {
+  XFER_DONE,                    ///< The whole file was sent.
+  XFER_CANCELLED,               ///< Stopped by XferStop() or by closing the port.
+  XFER_ERROR                    ///< The file could not be read, or the port stopped taking data.
+};
+
+/**
+   A file send.  Filled in by XferStart() or XferStartBuf(); the caller provides the memory
+   and keeps it until XferStop() has been called.
+*/
+typedef struct {
+  HANDLE Thread;                ///< Handle to the worker thread, NULL when not sending.
+  HANDLE Cancel;                ///< Event: tells the worker to stop.
+  HWND Wnd;                     ///< Window that gets MESS_XFER.
+  TSerial *Port;                ///< Port the file goes out on.
+  char Name[MAX_PATH];          ///< File being sent.
+  char *Buf;                    ///< Characters being sent instead of a file, see XferStartBuf(), or NULL.
+  int CharDelay;                ///< Milliseconds to wait after each character.
+  int LineDelay;                ///< Milliseconds to wait after each line feed.
+  unsigned long long Sent;      ///< Bytes sent so far.  Written by the worker only.
+  unsigned long long Size;      ///< Size of the file.
+  DWORD StartTick;              ///< Tick count when the send started.
+} TXfer;
+
+BOOL XferStart(TXfer *x,const char *FileName,TSerial *Port,int CharDelay,int LineDelay,HWND hwnd);
+BOOL XferStartBuf(TXfer *x,char *Buf,DWORD Size,TSerial *Port,HWND hwnd);
+void XferStop(TXfer *x);
+BOOL XferActive(TXfer *x);
+void XferProgress(TXfer *x,unsigned long long *Sent,unsigned long long *Size,DWORD *ms);
+
+#endif